@@ -0,0 +1,156 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * arena.c - 
+ *    Bump allocator for many small, similarly sized records that are released all at once.
+ *    Individually freed blocks are kept on per-size free lists and handed back out by
+ *    subsequent allocations of the same rounded size.
+ */
+
+#include "main.h"
+#include "arena.h"
+
+LPARENACHUNK _ArenaNewChunk(LPARENA arena, unsigned int size);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+LPARENA ArenaInit() {
+	LPARENA arena;
+
+	arena = malloc(sizeof(ARENA));
+	if (!arena)
+		return NULL;
+
+	memset(arena, 0, sizeof(ARENA));
+	return arena;
+}
+
+
+LPARENACHUNK _ArenaNewChunk(LPARENA arena, unsigned int size) {
+	LPARENACHUNK chunk;
+
+	if (size < ARENA_CHUNK_SIZE)
+		size = ARENA_CHUNK_SIZE;
+
+	chunk = malloc(sizeof(ARENACHUNK) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->size  = size;
+	chunk->used  = 0;
+	chunk->next  = arena->chunks;
+	arena->chunks = chunk;
+
+	return chunk;
+}
+
+
+void *ArenaAlloc(LPARENA arena, unsigned int size) {
+	LPARENACHUNK chunk;
+	LPARENAFREE blk;
+	unsigned int index;
+	void *ptr;
+
+	if (!arena || !size)
+		return NULL;
+
+	size  = ARENA_ROUNDUP(size);
+	index = size / ARENA_GRANULARITY - 1;
+
+	if (index < ARENA_NFREELISTS && arena->freelists[index]) {
+		blk = arena->freelists[index];
+		arena->freelists[index] = blk->next;
+		return blk;
+	}
+
+	chunk = arena->chunks;
+	if (!chunk || chunk->used + size > chunk->size) {
+		chunk = _ArenaNewChunk(arena, size);
+		if (!chunk)
+			return NULL;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+
+void ArenaFree(LPARENA arena, void *ptr, unsigned int size) {
+	LPARENAFREE blk;
+	unsigned int index;
+
+	if (!arena || !ptr)
+		return;
+
+	index = ARENA_ROUNDUP(size) / ARENA_GRANULARITY - 1;
+	if (index >= ARENA_NFREELISTS)
+		return;
+
+	blk = ptr;
+	blk->next = arena->freelists[index];
+	arena->freelists[index] = blk;
+}
+
+
+//keeps the most recently allocated chunk around so a reload doesn't go right back to malloc
+void ArenaReset(LPARENA arena) {
+	LPARENACHUNK chunk, next;
+
+	if (!arena)
+		return;
+
+	chunk = arena->chunks;
+	if (chunk) {
+		next = chunk->next;
+		chunk->next = NULL;
+		chunk->used = 0;
+
+		while (next) {
+			chunk = next;
+			next  = chunk->next;
+			free(chunk);
+		}
+	}
+
+	memset(arena->freelists, 0, sizeof(arena->freelists));
+}
+
+
+void ArenaDestroy(LPARENA arena) {
+	LPARENACHUNK chunk, next;
+
+	if (!arena)
+		return;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
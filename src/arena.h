@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARENA_HEADER
+#define ARENA_HEADER
+
+/////////// Compile-time configuration ////////////
+#define ARENA_CHUNK_SIZE  (64 * 1024) //Size of each block requested from malloc()
+#define ARENA_GRANULARITY 8           //Allocation sizes are rounded up to a multiple of this
+#define ARENA_NFREELISTS  64          //Freed blocks larger than ARENA_GRANULARITY * ARENA_NFREELISTS
+                                      // are not recycled until the next ArenaReset()
+///////////////////////////////////////////////////
+
+#define ARENA_ROUNDUP(x) (((x) + ARENA_GRANULARITY - 1) & ~(ARENA_GRANULARITY - 1))
+
+typedef struct _arenachunk {
+	struct _arenachunk *next;
+	unsigned int size;
+	unsigned int used;
+	char data[0];
+} ARENACHUNK, *LPARENACHUNK;
+
+typedef struct _arenafree {
+	struct _arenafree *next;
+} ARENAFREE, *LPARENAFREE;
+
+typedef struct _arena {
+	LPARENACHUNK chunks;
+	LPARENAFREE freelists[ARENA_NFREELISTS];
+} ARENA, *LPARENA;
+
+LPARENA ArenaInit();
+void *ArenaAlloc(LPARENA arena, unsigned int size);
+void ArenaFree(LPARENA arena, void *ptr, unsigned int size);
+void ArenaReset(LPARENA arena);
+void ArenaDestroy(LPARENA arena);
+
+#endif //ARENA_HEADER
@@ -0,0 +1,242 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * batch.c - 
+ *    Compares one reference image against a stream of files without using a cache
+ */
+
+#include "main.h"
+#include "stats.h"
+#include "mmfile.h"
+#include "bptree.h"
+#include "hashdb.h"
+#include "pathdict.h"
+#include "img.h"
+#include "hist.h"
+#include "lru.h"
+#include "thumb.h"
+#include "batch.h"
+
+THREADPROC(_BatchWorker, arg);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * files are compared against reffile by a pool of worker threads, each decoding and
+ * comparing one file at a time.  If nfiles is 0, filenames are read from stdin, one
+ * per line.  Matches are printed as soon as they're found, in no particular order.
+ */
+int BatchComparePerform(const char *reffile, char **files, int nfiles) {
+	THREAD threads[BATCH_MAX_THREADS];
+	char line[MAX_PATH], *nl;
+	BATCHCTX ctx;
+	int i, nworkers, nstarted, c;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (!ImgProbe(reffile, &ctx.refinfo)) {
+		fprintf(stderr, "ERROR: %s is not a recognized image\n", reffile);
+		return 0;
+	}
+
+	ctx.ref = ThumbCreate(reffile, NULL, ctx.refhash);
+	if (!ctx.ref) {
+		fprintf(stderr, "ERROR: couldn't create thumbnail of %s\n", reffile);
+		return 0;
+	}
+
+	if (match_engine == MATCH_ENGINE_HISTRGB)
+		HistCalc(ctx.ref->tpixels, ctx.refhist, NULL);
+	else if (match_engine == MATCH_ENGINE_HISTHSV)
+		HistCalc(ctx.ref->tpixels, NULL, ctx.refhist);
+
+	MutexInit(&ctx.qlock);
+	MutexInit(&ctx.outlock);
+	CondInit(&ctx.notempty);
+	CondInit(&ctx.notfull);
+
+	nworkers = nthreads ? nthreads : GetNumberOfProcessors();
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > BATCH_MAX_THREADS)
+		nworkers = BATCH_MAX_THREADS;
+
+	for (nstarted = 0; nstarted != nworkers; nstarted++) {
+		if (!ThreadCreate(&threads[nstarted], _BatchWorker, &ctx)) {
+			fprintf(stderr, "WARNING: only started %d of %d worker threads\n",
+				nstarted, nworkers);
+			break;
+		}
+	}
+
+	if (nstarted) {
+		if (nfiles) {
+			for (i = 0; i != nfiles; i++)
+				_BatchEnqueue(&ctx, strdup(files[i]));
+		} else {
+			while (fgets(line, sizeof(line), stdin)) {
+				nl = strpbrk(line, "\r\n");
+				if (!nl && !feof(stdin)) {
+					fprintf(stderr, "ERROR: filename %s... too long, skipping\n", line);
+					while ((c = getchar()) != EOF && c != '\n');
+					continue;
+				}
+				if (nl)
+					*nl = '\0';
+				if (line[0])
+					_BatchEnqueue(&ctx, strdup(line));
+			}
+		}
+	} else {
+		fprintf(stderr, "ERROR: failed to start any worker threads\n");
+	}
+
+	MutexLock(&ctx.qlock);
+	ctx.done = 1;
+	CondBroadcast(&ctx.notempty);
+	MutexUnlock(&ctx.qlock);
+
+	for (i = 0; i != nstarted; i++)
+		ThreadJoin(threads[i]);
+
+	if (verbose)
+		printf("Compared %u files, %u matched\n", ctx.ncompared, ctx.nmatched);
+
+	CondDestroy(&ctx.notfull);
+	CondDestroy(&ctx.notempty);
+	MutexDestroy(&ctx.outlock);
+	MutexDestroy(&ctx.qlock);
+	gdImageDestroy(ctx.ref);
+
+	return nstarted != 0;
+}
+
+
+THREADPROC(_BatchWorker, arg) {
+	LPBATCHCTX ctx = arg;
+	char *filename;
+
+	while ((filename = _BatchDequeue(ctx))) {
+		_BatchCompareFile(ctx, filename);
+		free(filename);
+	}
+
+	PROF_THREAD_END();
+	return 0;
+}
+
+
+//blocks while the queue is full, so reading filenames never runs far ahead
+void _BatchEnqueue(LPBATCHCTX ctx, char *filename) {
+	if (!filename)
+		return;
+
+	MutexLock(&ctx->qlock);
+	while (ctx->count == BATCH_QUEUE_LEN)
+		CondWait(&ctx->notfull, &ctx->qlock);
+
+	ctx->queue[(ctx->head + ctx->count) % BATCH_QUEUE_LEN] = filename;
+	ctx->count++;
+
+	CondSignal(&ctx->notempty);
+	MutexUnlock(&ctx->qlock);
+}
+
+
+//returns NULL once the queue is drained and nothing more is coming
+char *_BatchDequeue(LPBATCHCTX ctx) {
+	char *filename = NULL;
+
+	MutexLock(&ctx->qlock);
+	while (!ctx->count && !ctx->done)
+		CondWait(&ctx->notempty, &ctx->qlock);
+
+	if (ctx->count) {
+		filename  = ctx->queue[ctx->head];
+		ctx->head = (ctx->head + 1) % BATCH_QUEUE_LEN;
+		ctx->count--;
+		CondSignal(&ctx->notfull);
+	}
+	MutexUnlock(&ctx->qlock);
+
+	return filename;
+}
+
+
+void _BatchCompareFile(LPBATCHCTX ctx, const char *filename) {
+	uint32_t hash[IMG_HASH_LEN];
+	HISTBIN hist[HIST_HSV_BINS];
+	const char *how;
+	gdImagePtr thumb;
+	IMGINFO info;
+
+	if (!ImgProbe(filename, &info)) {
+		fprintf(stderr, "WARNING: %s is not a recognized image, skipping\n", filename);
+		return;
+	}
+
+	how = NULL;
+
+	//the thumb comparison can't match across aspect ratios, so don't bother decoding
+	if (match_engine != MATCH_ENGINE_THUMB ||
+		ImgAspectMatch(ctx->refinfo.width, ctx->refinfo.height, info.width, info.height)) {
+		thumb = ThumbCreate(filename, NULL, hash);
+		if (!thumb) {
+			fprintf(stderr, "WARNING: couldn't create thumbnail of %s\n", filename);
+			return;
+		}
+
+		if (!memcmp(hash, ctx->refhash, sizeof(hash))) {
+			how = "identical";
+		} else {
+			switch (match_engine) {
+				case MATCH_ENGINE_HISTRGB:
+					HistCalc(thumb->tpixels, hist, NULL);
+					if (HistMatch(ctx->refhist, hist, HIST_RGB_BINS))
+						how = "similar";
+					break;
+				case MATCH_ENGINE_HISTHSV:
+					HistCalc(thumb->tpixels, NULL, hist);
+					if (HistMatch(ctx->refhist, hist, HIST_HSV_BINS))
+						how = "similar";
+					break;
+				default:
+					if (ImgCompareFuzzy(ctx->ref, thumb))
+						how = "similar";
+			}
+		}
+		gdImageDestroy(thumb);
+	}
+
+	MutexLock(&ctx->outlock);
+	ctx->ncompared++;
+	if (how) {
+		ctx->nmatched++;
+		printf("%s: %s\n", how, filename);
+		fflush(stdout);
+	}
+	MutexUnlock(&ctx->outlock);
+}
@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BATCH_HEADER
+#define BATCH_HEADER
+
+/////////// Compile-time configuration ////////////
+#define BATCH_QUEUE_LEN   256 //filenames read ahead of the workers
+#define BATCH_MAX_THREADS 64
+///////////////////////////////////////////////////
+
+typedef struct _batchctx {
+	gdImagePtr ref;
+	IMGINFO refinfo;
+	uint32_t refhash[IMG_HASH_LEN];
+	HISTBIN refhist[HIST_HSV_BINS];
+
+	char *queue[BATCH_QUEUE_LEN];
+	unsigned int head;
+	unsigned int count;
+	int done;
+	MUTEX qlock;
+	CONDVAR notempty;
+	CONDVAR notfull;
+
+	MUTEX outlock;
+	unsigned int ncompared;
+	unsigned int nmatched;
+} BATCHCTX, *LPBATCHCTX;
+
+int BatchComparePerform(const char *reffile, char **files, int nfiles);
+
+void _BatchEnqueue(LPBATCHCTX ctx, char *filename);
+char *_BatchDequeue(LPBATCHCTX ctx);
+void _BatchCompareFile(LPBATCHCTX ctx, const char *filename);
+
+#endif //BATCH_HEADER
@@ -0,0 +1,243 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * hashdb.c - 
+ *    File-backed open addressing hash index mapping 32 bit hashes to 32 bit values,
+ *    meant to be mapped and used as is rather than rebuilt on every run
+ */
+
+#include "main.h"
+#include "mmfile.h"
+#include "hashdb.h"
+
+void _HdbInitNewDB(LPHASHDB hdb);
+void _HdbInsertSlot(LPHASHDB hdb, uint32_t hash, uint32_t val);
+int _HdbRehash(LPHASHDB hdb, uint32_t nslots);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+void _HdbInitNewDB(LPHASHDB hdb) {
+	memset(hdb->fmi.addr, 0, HDB_FILE_SIZE(HDB_INITIAL_SLOTS));
+
+	hdb->header = hdb->fmi.addr;
+	hdb->slots  = (LPHDBSLOT)(hdb->header + 1);
+
+	hdb->header->signature = 'HSDB';
+	hdb->header->nslots    = HDB_INITIAL_SLOTS;
+}
+
+
+LPHASHDB HdbOpen(const char *filename) {
+	LPHASHDB hdb;
+	LPHDBHEADER header;
+	int status;
+
+	hdb = malloc(sizeof(HASHDB));
+	if (!hdb)
+		return NULL;
+
+	status = MMFileOpen(filename, HDB_FILE_SIZE(HDB_INITIAL_SLOTS), &hdb->fmi);
+	if (!status) {
+		fprintf(stderr, "ERROR: HdbOpen: failed to open db\n");
+		free(hdb);
+		return NULL;
+	}
+
+	header = hdb->fmi.addr;
+	hdb->header = header;
+	hdb->slots  = (LPHDBSLOT)(header + 1);
+	hdb->isnew  = 0;
+
+	if (status == -1 || header->signature != 'HSDB' || header->dirty ||
+		!header->nslots || (header->nslots & (header->nslots - 1)) ||
+		HDB_FILE_SIZE(header->nslots) != hdb->fmi.maplen) {
+		if (status != -1)
+			printf("hash index %s is stale, reinitializing\n", filename);
+
+		if (hdb->fmi.maplen != HDB_FILE_SIZE(HDB_INITIAL_SLOTS) &&
+			!MMFileResize(&hdb->fmi, HDB_FILE_SIZE(HDB_INITIAL_SLOTS))) {
+			fprintf(stderr, "ERROR: HdbOpen: failed to resize db\n");
+			free(hdb);
+			return NULL;
+		}
+		_HdbInitNewDB(hdb);
+		hdb->isnew = 1;
+	}
+
+	return hdb;
+}
+
+
+void HdbClose(LPHASHDB hdb) {
+	if (!hdb)
+		return;
+
+	MMFileClose(&hdb->fmi);
+	free(hdb);
+}
+
+
+void _HdbInsertSlot(LPHASHDB hdb, uint32_t hash, uint32_t val) {
+	LPHDBSLOT slot;
+	uint32_t i, mask;
+
+	mask = hdb->header->nslots - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		slot = &hdb->slots[i];
+		if (slot->val == HDB_EMPTY || slot->val == HDB_DELETED)
+			break;
+	}
+
+	if (slot->val == HDB_DELETED)
+		hdb->header->ndeleted--;
+
+	slot->hash = hash;
+	slot->val  = val;
+	hdb->header->nused++;
+}
+
+
+int _HdbRehash(LPHASHDB hdb, uint32_t nslots) {
+	LPHDBSLOT oldslots;
+	uint32_t i, oldnslots;
+
+	oldnslots = hdb->header->nslots;
+	oldslots  = malloc(oldnslots * sizeof(HDBSLOT));
+	if (!oldslots) {
+		fprintf(stderr, "ERROR: _HdbRehash: out of memory\n");
+		return 0;
+	}
+	memcpy(oldslots, hdb->slots, oldnslots * sizeof(HDBSLOT));
+
+	if (nslots != oldnslots) {
+		if (!MMFileResize(&hdb->fmi, HDB_FILE_SIZE(nslots))) {
+			fprintf(stderr, "ERROR: _HdbRehash: failed to resize db\n");
+			free(oldslots);
+			return 0;
+		}
+		hdb->header = hdb->fmi.addr;
+		hdb->slots  = (LPHDBSLOT)(hdb->header + 1);
+	}
+
+	memset(hdb->slots, 0, nslots * sizeof(HDBSLOT));
+	hdb->header->nslots   = nslots;
+	hdb->header->nused    = 0;
+	hdb->header->ndeleted = 0;
+
+	for (i = 0; i != oldnslots; i++) {
+		if (oldslots[i].val != HDB_EMPTY && oldslots[i].val != HDB_DELETED)
+			_HdbInsertSlot(hdb, oldslots[i].hash, oldslots[i].val);
+	}
+
+	free(oldslots);
+	return 1;
+}
+
+
+int HdbInsert(LPHASHDB hdb, uint32_t hash, uint32_t val) {
+	LPHDBHEADER header;
+	uint32_t nslots;
+
+	if (!hdb || val == HDB_EMPTY || val == HDB_DELETED)
+		return 0;
+
+	header = hdb->header;
+	header->dirty = 1;
+
+	if ((uint64_t)(header->nused + header->ndeleted + 1) * 100 >
+		(uint64_t)header->nslots * HDB_MAX_LOAD_PCT) {
+		//only double if tombstones alone can't make enough room
+		nslots = header->nslots;
+		if ((uint64_t)(header->nused + 1) * 200 > (uint64_t)nslots * HDB_MAX_LOAD_PCT)
+			nslots <<= 1;
+		if (!_HdbRehash(hdb, nslots))
+			return 0;
+		header = hdb->header;
+	}
+
+	_HdbInsertSlot(hdb, hash, val);
+
+	header->dirty = 0;
+	return 1;
+}
+
+
+int HdbRemove(LPHASHDB hdb, uint32_t hash, uint32_t val) {
+	LPHDBSLOT slot;
+	uint32_t i, mask;
+
+	if (!hdb || val == HDB_EMPTY || val == HDB_DELETED)
+		return 0;
+
+	mask = hdb->header->nslots - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		slot = &hdb->slots[i];
+		if (slot->val == HDB_EMPTY)
+			return 0;
+		if (slot->hash == hash && slot->val == val)
+			break;
+	}
+
+	slot->val = HDB_DELETED;
+	hdb->header->nused--;
+	hdb->header->ndeleted++;
+
+	return 1;
+}
+
+
+uint32_t HdbLookup(LPHASHDB hdb, uint32_t hash, unsigned int *iter) {
+	LPHDBSLOT slot;
+	uint32_t i, mask;
+
+	if (!hdb || !iter)
+		return HDB_EMPTY;
+
+	mask = hdb->header->nslots - 1;
+	for (i = *iter; i <= mask; i++) {
+		slot = &hdb->slots[(hash + i) & mask];
+		if (slot->val == HDB_EMPTY)
+			break;
+		if (slot->val != HDB_DELETED && slot->hash == hash) {
+			*iter = i + 1;
+			return slot->val;
+		}
+	}
+
+	*iter = mask + 1;
+	return HDB_EMPTY;
+}
+
+
+void HdbClear(LPHASHDB hdb) {
+	if (!hdb)
+		return;
+
+	memset(hdb->slots, 0, hdb->header->nslots * sizeof(HDBSLOT));
+	hdb->header->nused    = 0;
+	hdb->header->ndeleted = 0;
+	hdb->header->dirty    = 0;
+}
@@ -0,0 +1,160 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HASHDB_HEADER
+#define HASHDB_HEADER
+
+/////////// Compile-time configuration ////////////
+#define HDB_INITIAL_SLOTS 1024 //Must be a power of 2
+#define HDB_MAX_LOAD_PCT  70   //Table is grown once used + deleted slots exceed this
+///////////////////////////////////////////////////
+
+#include "mmfile.h"
+
+#define HDB_EMPTY   0
+#define HDB_DELETED 0xFFFFFFFF
+
+/*
+ *	HDB File format:
+ *
+ *	[UINT32] 'HSDB'
+ *	[UINT32] number of slots, always a power of 2
+ *	[UINT32] number of used slots
+ *	[UINT32] number of deleted slots
+ *	[UINT32] dirty flag
+ *	[UINT32] stamp, left for the owner to tie the index to whatever it indexes
+ *	For each slot:
+ *	    [UINT32] 32 bit hash of the key
+ *	    [UINT32] value, HDB_EMPTY or HDB_DELETED if the slot is unused
+ */
+
+typedef struct _hdbheader {
+	uint32_t signature;
+	uint32_t nslots;
+	uint32_t nused;
+	uint32_t ndeleted;
+	uint32_t dirty;
+	uint32_t stamp;
+} HDBHEADER, *LPHDBHEADER;
+
+typedef struct _hdbslot {
+	uint32_t hash;
+	uint32_t val;
+} HDBSLOT, *LPHDBSLOT;
+
+typedef struct _hashdb {
+	LPHDBHEADER header;
+	LPHDBSLOT slots;
+	int isnew;
+	FMAPINFO fmi;
+} HASHDB, *LPHASHDB;
+
+#define HDB_FILE_SIZE(nslots) (sizeof(HDBHEADER) + (nslots) * sizeof(HDBSLOT))
+
+
+LPHASHDB HdbOpen(const char *filename);
+/*
+ * Routine Description:
+ *    This routine opens a file-backed hash index mapping 32 bit hashes to 32 bit values.
+ *    If the file does not exist, is not a hash index, or was left dirty by an
+ *    interrupted update, it is (re)initialized empty and isnew is set so the caller
+ *    knows to repopulate it.
+ *
+ * Arguments:
+ *    filename	filename of the index to open.  If NULL, the mapping is not file-backed.
+ *
+ * Return Value:
+ *    A pointer to a HASHDB structure passed to all subsequent operations (success),
+ *    or NULL (failure).
+ */
+
+void HdbClose(LPHASHDB hdb);
+/*
+ * Routine Description:
+ *    This routine closes a hash index.  After this operation, hdb is no longer valid.
+ *
+ * Arguments:
+ *    hdb		index to close
+ *
+ * Return Value:
+ *    (none)
+ */
+
+int HdbInsert(LPHASHDB hdb, uint32_t hash, uint32_t val);
+/*
+ * Routine Description:
+ *    This routine associates val with hash.  Duplicate hashes and duplicate pairs
+ *    are both allowed.  The table is grown as needed.
+ *
+ * Arguments:
+ *    hdb		index to insert into
+ *    hash		hash of the key
+ *    val		value to associate; may not be HDB_EMPTY or HDB_DELETED
+ *
+ * Return Value:
+ *    1 (success) or 0 (failure)
+ */
+
+int HdbRemove(LPHASHDB hdb, uint32_t hash, uint32_t val);
+/*
+ * Routine Description:
+ *    This routine removes one association of val with hash.
+ *
+ * Arguments:
+ *    hdb		index to remove from
+ *    hash		hash of the key
+ *    val		value to disassociate
+ *
+ * Return Value:
+ *    0 (not found) or 1 (success)
+ */
+
+uint32_t HdbLookup(LPHASHDB hdb, uint32_t hash, unsigned int *iter);
+/*
+ * Routine Description:
+ *    This routine retrieves the values associated with hash, one per call.  Since
+ *    only hashes are stored, the caller is responsible for weeding out collisions.
+ *
+ * Arguments:
+ *    hdb		index to search
+ *    hash		hash of the key to look up
+ *    iter		(IN/OUT) search position; set to 0 before the first call and
+ *              pass back unmodified to retrieve the next value
+ *
+ * Return Value:
+ *    The next value associated with hash, or HDB_EMPTY if there are no more.
+ */
+
+void HdbClear(LPHASHDB hdb);
+/*
+ * Routine Description:
+ *    This routine removes every item from the index, keeping its current size.
+ *
+ * Arguments:
+ *    hdb		index to clear
+ *
+ * Return Value:
+ *    (none)
+ */
+
+#endif //HASHDB_HEADER
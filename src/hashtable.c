@@ -1,238 +1,334 @@
-/*-
- * Copyright (c) 2008 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-/* 
- * hashtable.c - 
- *    High performance hashtable routines and general purpose 32 bit hash functions
- */
-
-
-#include "main.h"
-#include "vector.h"
-#include "hashtable.h"
-
-uint32_t crc_tab[256];
-
-
-///////////////////////////////////////////////////////////////////////////////
-
-
-//set keylen to 0 for an null terminated string
-LPHT HtInit(unsigned int tablelen, unsigned int keylen, int algorithm, unsigned int num_initial_slots) {
-	LPHT ht;
-	
-	ht = malloc(sizeof(HT));
-	ht->tablelen = tablelen - 1;
-	ht->keylen   = keylen;
-	ht->vectlen  = num_initial_slots;
-	ht->table    = malloc(sizeof(LPVECTOR) * tablelen);
-	memset(ht->table, 0, sizeof(LPVECTOR) * tablelen);
-
-	switch (algorithm) {
-		case HT_HASH_CRC32:
-			if (!crc_tab[0])
-				HtCrc32GenTab();
-			ht->hash = HtCrc32Hash;
-			break;
-		case HT_HASH_ADLER32:
-			ht->hash = HtAdler32Hash;
-			break;
-		case HT_HASH_DEFAULT:
-			ht->hash = HtDefaultHash;
-			break;
-		default:
-			printf("WARNING: unimplemented hash algorithm.\n");
-			ht->hash = HtDefaultHash;
-	}
-
-	return ht;
-}
-
-
-void HtDestroy(LPHT ht) {
-	free(ht);
-}
-
-
-void HtInsertItem(LPHT ht, const void *key, void *newentry) {
-	unsigned int index;
-	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
-	LPVECTOR *table = ht->table;
-
-	index = ht->hash(key, keylen) & ht->tablelen;
-
-	if (!table[index])
-		table[index] = VectorInit(ht->vectlen);
-	table[index] = VectorAdd(table[index], newentry);
-}
-
-
-int HtInsertItemUnique(LPHT ht, const void *key, void *newentry) {
-	unsigned int index, i;
-	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
-	LPVECTOR *table = ht->table;
-
-	index = ht->hash(key, keylen) & ht->tablelen;
-
-	if (!table[index]) {
-		table[index] = VectorInit(ht->vectlen);
-	} else { 
-		for (i = 0; i != table[index]->numelem; i++) {
-			if (!memcmp(key, table[index]->elem[i], keylen))
-				return 0;
-		}
-	}
-
-	table[index] = VectorAdd(table[index], newentry);
-	return 1;
-}
-
-
-int HtRemoveItem(LPHT ht, const void *key) {
-	unsigned int index, i;
-	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
-	LPVECTOR *table = ht->table;
-	
-	index = ht->hash(key, keylen) & ht->tablelen;
-
-	if (table[index]) {
-		for (i = 0; i != table[index]->numelem; i++) {
-			if (!memcmp(key, table[index]->elem[i], keylen)) {
-				table[index]->numelem--;
-				free(table[index]->elem[i]);
-				table[index]->elem[i] = table[index]->elem[table[index]->numelem];
-				return 1;
-			}
-		}
-	}
-	return 0;
-}
-
-
-void *HtUnassociateItem(LPHT ht, const void *key) {
-	void *item;
-	unsigned int index, i;
-	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
-	LPVECTOR *table = ht->table;
-	
-	index = ht->hash(key, keylen) & ht->tablelen;
-
-	if (table[index]) {
-		for (i = 0; i != table[index]->numelem; i++) {
-			if (!memcmp(key, table[index]->elem[i], keylen)) {
-				table[index]->numelem--;
-				item = table[index]->elem[i];
-				table[index]->elem[i] = table[index]->elem[table[index]->numelem];
-				return item;
-			}
-		}
-	}
-	return NULL;
-}
-
-
-void *HtGetItem(LPHT ht, const void *key) {
-	unsigned int index, i;
-	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
-	LPVECTOR *table = ht->table;
-
-	index = ht->hash(key, keylen) & ht->tablelen;
-
-	if (table[index]) {
-		for (i = 0; i != table[index]->numelem; i++) {
-			if (!memcmp(key, table[index]->elem[i], keylen))
-				return table[index]->elem[i];
-		}
-	}
-	return NULL;
-}
-
-
-void HtResetContents(LPHT ht) {
-	unsigned int i;
-	LPVECTOR *table = ht->table;
-
-	for (i = 0; i != ht->tablelen; i++) {
-		if (table[i]) {
-			VectorDelete(table[i]);
-			table[i] = NULL;
-		}
-	}
-}
-
-
-uint32_t HtDefaultHash(const void *key, unsigned int len) {
-    uint32_t hash = 0;
-	const unsigned char *k = key;
-
-	while (len--) {
-		hash += *k;
-		hash += (hash << 10);
-		hash ^= (hash >> 6);
-		k++;
-	}
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
-}
-
-
-void HtCrc32GenTab() {
-	uint32_t crc;
-	int i, j;
-
-	for (i = 0; i != 256; i++) {
-		crc = i;
-		for (j = 8; j > 0; j--)
-			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320L : crc >> 1;
-		crc_tab[i] = crc;
-	}
-}
-
-
-uint32_t HtCrc32Hash(const void *key, unsigned int len) {
-	unsigned int i;
-	uint32_t crc;
-	const unsigned char *k = key;
-
-	crc = 0xFFFFFFFF;
-	for (i = 0; i != len; i++)
-		crc = ((crc >> 8) & 0x00FFFFFF) ^ crc_tab[(crc ^ *k++) & 0xFF];
-
-	return (crc ^ 0xFFFFFFFF);
-}
-
-
-uint32_t HtAdler32Hash(const void *key, unsigned int len) {
-	unsigned int i;
-	uint32_t a = 1, b = 0;
-
-	for (i = 0; i < len; i++) {
-		a = (a + ((unsigned char *)key)[i]) % 65521;
-		b = (b + a) % 65521;
-	}
-
-	return (b << 16) | a;
-}
-
+/*-
+ * Copyright (c) 2008 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * hashtable.c - 
+ *    High performance hashtable routines and general purpose 32 and 128 bit hash functions
+ */
+
+
+#include "main.h"
+#include "vector.h"
+#include "hashtable.h"
+
+uint32_t crc_tab[256];
+
+static inline uint64_t _HtMurmur3Fmix64(uint64_t k);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+//set keylen to 0 for an null terminated string
+LPHT HtInit(unsigned int tablelen, unsigned int keylen, int algorithm, unsigned int num_initial_slots) {
+	LPHT ht;
+	
+	ht = malloc(sizeof(HT));
+	if (!ht)
+		return NULL;
+	ht->tablelen = tablelen - 1;
+	ht->keylen   = keylen;
+	ht->vectlen  = num_initial_slots;
+	ht->table    = malloc(sizeof(LPVECTOR) * tablelen);
+	if (!ht->table) {
+		free(ht);
+		return NULL;
+	}
+	memset(ht->table, 0, sizeof(LPVECTOR) * tablelen);
+
+	switch (algorithm) {
+		case HT_HASH_CRC32:
+			if (!crc_tab[0])
+				HtCrc32GenTab();
+			ht->hash = HtCrc32Hash;
+			break;
+		case HT_HASH_ADLER32:
+			ht->hash = HtAdler32Hash;
+			break;
+		case HT_HASH_DEFAULT:
+			ht->hash = HtDefaultHash;
+			break;
+		default:
+			printf("WARNING: unimplemented hash algorithm.\n");
+			ht->hash = HtDefaultHash;
+	}
+
+	return ht;
+}
+
+
+//the items and their vectors have to be gone already, see HtResetContents and HtResetTable
+void HtDestroy(LPHT ht) {
+	free(ht->table);
+	free(ht);
+}
+
+
+void HtInsertItem(LPHT ht, const void *key, void *newentry) {
+	unsigned int index;
+	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
+	LPVECTOR *table = ht->table;
+
+	index = ht->hash(key, keylen) & ht->tablelen;
+
+	if (!table[index])
+		table[index] = VectorInit(ht->vectlen);
+	table[index] = VectorAdd(table[index], newentry);
+}
+
+
+int HtInsertItemUnique(LPHT ht, const void *key, void *newentry) {
+	unsigned int index, i;
+	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
+	LPVECTOR *table = ht->table;
+
+	index = ht->hash(key, keylen) & ht->tablelen;
+
+	if (!table[index]) {
+		table[index] = VectorInit(ht->vectlen);
+	} else { 
+		for (i = 0; i != table[index]->numelem; i++) {
+			if (!memcmp(key, table[index]->elem[i], keylen))
+				return 0;
+		}
+	}
+
+	table[index] = VectorAdd(table[index], newentry);
+	return 1;
+}
+
+
+int HtRemoveItem(LPHT ht, const void *key) {
+	unsigned int index, i;
+	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
+	LPVECTOR *table = ht->table;
+	
+	index = ht->hash(key, keylen) & ht->tablelen;
+
+	if (table[index]) {
+		for (i = 0; i != table[index]->numelem; i++) {
+			if (!memcmp(key, table[index]->elem[i], keylen)) {
+				table[index]->numelem--;
+				free(table[index]->elem[i]);
+				table[index]->elem[i] = table[index]->elem[table[index]->numelem];
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+void *HtUnassociateItem(LPHT ht, const void *key) {
+	void *item;
+	unsigned int index, i;
+	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
+	LPVECTOR *table = ht->table;
+	
+	index = ht->hash(key, keylen) & ht->tablelen;
+
+	if (table[index]) {
+		for (i = 0; i != table[index]->numelem; i++) {
+			if (!memcmp(key, table[index]->elem[i], keylen)) {
+				table[index]->numelem--;
+				item = table[index]->elem[i];
+				table[index]->elem[i] = table[index]->elem[table[index]->numelem];
+				return item;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+void *HtGetItem(LPHT ht, const void *key) {
+	unsigned int index, i;
+	unsigned int keylen = ht->keylen ? ht->keylen : strlen(key);
+	LPVECTOR *table = ht->table;
+
+	index = ht->hash(key, keylen) & ht->tablelen;
+
+	if (table[index]) {
+		for (i = 0; i != table[index]->numelem; i++) {
+			if (!memcmp(key, table[index]->elem[i], keylen))
+				return table[index]->elem[i];
+		}
+	}
+	return NULL;
+}
+
+
+void HtResetContents(LPHT ht) {
+	unsigned int i;
+	LPVECTOR *table = ht->table;
+
+	for (i = 0; i != ht->tablelen; i++) {
+		if (table[i]) {
+			VectorDelete(table[i]);
+			table[i] = NULL;
+		}
+	}
+}
+
+
+//Like HtResetContents, but for tables whose items are owned by someone else
+void HtResetTable(LPHT ht) {
+	unsigned int i;
+	LPVECTOR *table = ht->table;
+
+	for (i = 0; i <= ht->tablelen; i++) {
+		if (table[i]) {
+			free(table[i]);
+			table[i] = NULL;
+		}
+	}
+}
+
+
+uint32_t HtDefaultHash(const void *key, unsigned int len) {
+    uint32_t hash = 0;
+	const unsigned char *k = key;
+
+	while (len--) {
+		hash += *k;
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+		k++;
+	}
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+
+void HtCrc32GenTab() {
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i != 256; i++) {
+		crc = i;
+		for (j = 8; j > 0; j--)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320L : crc >> 1;
+		crc_tab[i] = crc;
+	}
+}
+
+
+uint32_t HtCrc32Hash(const void *key, unsigned int len) {
+	unsigned int i;
+	uint32_t crc;
+	const unsigned char *k = key;
+
+	crc = 0xFFFFFFFF;
+	for (i = 0; i != len; i++)
+		crc = ((crc >> 8) & 0x00FFFFFF) ^ crc_tab[(crc ^ *k++) & 0xFF];
+
+	return (crc ^ 0xFFFFFFFF);
+}
+
+
+uint32_t HtAdler32Hash(const void *key, unsigned int len) {
+	unsigned int i;
+	uint32_t a = 1, b = 0;
+
+	for (i = 0; i < len; i++) {
+		a = (a + ((unsigned char *)key)[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t _HtMurmur3Fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+
+/*
+ * MurmurHash3, x64 128 bit variant.  Meant for telling whole files apart, not for
+ * bucketing, so out receives all 128 bits as four 32 bit words.
+ */
+void HtMurmur3Hash128(const void *key, unsigned int len, uint32_t seed, uint32_t *out) {
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const unsigned char *data = key, *tail;
+	unsigned int i, nblocks = len / 16;
+	uint64_t h1 = seed, h2 = seed, k1, k2;
+
+	for (i = 0; i != nblocks; i++) {
+		k1 = LE64(UAR64((void *)(data + i * 16)));
+		k2 = LE64(UAR64((void *)(data + i * 16 + 8)));
+
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	tail = data + nblocks * 16;
+	k1 = 0;
+	k2 = 0;
+	switch (len & 15) {
+		case 15: k2 ^= (uint64_t)tail[14] << 48;
+		case 14: k2 ^= (uint64_t)tail[13] << 40;
+		case 13: k2 ^= (uint64_t)tail[12] << 32;
+		case 12: k2 ^= (uint64_t)tail[11] << 24;
+		case 11: k2 ^= (uint64_t)tail[10] << 16;
+		case 10: k2 ^= (uint64_t)tail[9]  << 8;
+		case 9:  k2 ^= (uint64_t)tail[8];
+			k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		case 8:  k1 ^= (uint64_t)tail[7]  << 56;
+		case 7:  k1 ^= (uint64_t)tail[6]  << 48;
+		case 6:  k1 ^= (uint64_t)tail[5]  << 40;
+		case 5:  k1 ^= (uint64_t)tail[4]  << 32;
+		case 4:  k1 ^= (uint64_t)tail[3]  << 24;
+		case 3:  k1 ^= (uint64_t)tail[2]  << 16;
+		case 2:  k1 ^= (uint64_t)tail[1]  << 8;
+		case 1:  k1 ^= (uint64_t)tail[0];
+			k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = _HtMurmur3Fmix64(h1);
+	h2 = _HtMurmur3Fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	out[0] = (uint32_t)h1;
+	out[1] = (uint32_t)(h1 >> 32);
+	out[2] = (uint32_t)h2;
+	out[3] = (uint32_t)(h2 >> 32);
+}
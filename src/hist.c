@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * hist.c - 
+ *    Color histograms of thumbnails and the kernels used to compare them
+ */
+
+#include "main.h"
+#include "hist.h"
+
+#ifdef HIST_USE_SSE2
+#	include <emmintrin.h>
+#endif
+
+static inline unsigned int _HistHsvBin(int r, int g, int b);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * Either histogram may be NULL if it isn't wanted.  Both are filled in a single
+ * pass over the pixels.
+ */
+void HistCalc(int **tpixels, HISTBIN *histrgb, HISTBIN *histhsv) {
+	int pixel, r, g, b, x, y;
+
+	if (histrgb)
+		memset(histrgb, 0, HIST_RGB_BINS * sizeof(HISTBIN));
+	if (histhsv)
+		memset(histhsv, 0, HIST_HSV_BINS * sizeof(HISTBIN));
+
+	for (y = 0; y != THUMB_CY; y++) {
+		for (x = 0; x != THUMB_CX; x++) {
+			pixel = tpixels[y][x];
+			r = gdTrueColorGetRed(pixel);
+			g = gdTrueColorGetGreen(pixel);
+			b = gdTrueColorGetBlue(pixel);
+
+			if (histrgb)
+				histrgb[((r >> 6) << 4) | ((g >> 6) << 2) | (b >> 6)]++;
+			if (histhsv)
+				histhsv[_HistHsvBin(r, g, b)]++;
+		}
+	}
+}
+
+
+static inline unsigned int _HistHsvBin(int r, int g, int b) {
+	int max, min, delta, hnum;
+	unsigned int hbin, sbin, vbin;
+
+	max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+	min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+	delta = max - min;
+
+	vbin = max * HIST_HSV_V / 256;
+	sbin = max ? (delta * 255 / max) * HIST_HSV_S / 256 : 0;
+
+	//hue as a fraction of 6 * delta, one delta per sector of the color wheel
+	if (!delta) {
+		hbin = 0;
+	} else {
+		if (max == r) {
+			hnum = g - b;
+			if (hnum < 0)
+				hnum += 6 * delta;
+		} else if (max == g) {
+			hnum = b - r + 2 * delta;
+		} else {
+			hnum = r - g + 4 * delta;
+		}
+		hbin = hnum * HIST_HSV_H / (6 * delta);
+		if (hbin >= HIST_HSV_H)
+			hbin = HIST_HSV_H - 1;
+	}
+
+	return (hbin * HIST_HSV_S + sbin) * HIST_HSV_V + vbin;
+}
+
+
+/*
+ * Returns the overlap of the two histograms, from 0 (disjoint) to 1 (identical).
+ */
+float HistIntersection(const HISTBIN *hist1, const HISTBIN *hist2, int nbins) {
+	unsigned int total;
+	int i = 0;
+#ifdef HIST_USE_SSE2
+	__m128i a, b, acc, ones;
+	uint32_t sums[4];
+
+	acc  = _mm_setzero_si128();
+	ones = _mm_set1_epi16(1);
+	for (; i + 8 <= nbins; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(hist1 + i));
+		b = _mm_loadu_si128((const __m128i *)(hist2 + i));
+
+		//counts never exceed THUMB_NPIXELS, so the signed min is safe
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_min_epi16(a, b), ones));
+	}
+	_mm_storeu_si128((__m128i *)sums, acc);
+	total = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	total = 0;
+#endif
+
+	for (; i < nbins; i++)
+		total += hist1[i] < hist2[i] ? hist1[i] : hist2[i];
+
+	return (float)total / (float)THUMB_NPIXELS;
+}
+
+
+/*
+ * Returns the chi-square distance between the two histograms, scaled to run from
+ * 0 (identical) to 1 (disjoint).
+ */
+float HistChiSquare(const HISTBIN *hist1, const HISTBIN *hist2, int nbins) {
+	float total, a, b;
+	int i = 0;
+#ifdef HIST_USE_SSE2
+	__m128i h1, h2, zero;
+	__m128 fa, fb, diff, sum, acc;
+	float sums[4];
+
+	acc  = _mm_setzero_ps();
+	zero = _mm_setzero_si128();
+	for (; i + 8 <= nbins; i += 8) {
+		h1 = _mm_loadu_si128((const __m128i *)(hist1 + i));
+		h2 = _mm_loadu_si128((const __m128i *)(hist2 + i));
+
+		fa   = _mm_cvtepi32_ps(_mm_unpacklo_epi16(h1, zero));
+		fb   = _mm_cvtepi32_ps(_mm_unpacklo_epi16(h2, zero));
+		diff = _mm_sub_ps(fa, fb);
+		sum  = _mm_add_ps(fa, fb);
+		//empty bin pairs come out 0/0; the mask drops those lanes
+		acc  = _mm_add_ps(acc, _mm_and_ps(_mm_cmpgt_ps(sum, _mm_setzero_ps()),
+			_mm_div_ps(_mm_mul_ps(diff, diff), sum)));
+
+		fa   = _mm_cvtepi32_ps(_mm_unpackhi_epi16(h1, zero));
+		fb   = _mm_cvtepi32_ps(_mm_unpackhi_epi16(h2, zero));
+		diff = _mm_sub_ps(fa, fb);
+		sum  = _mm_add_ps(fa, fb);
+		acc  = _mm_add_ps(acc, _mm_and_ps(_mm_cmpgt_ps(sum, _mm_setzero_ps()),
+			_mm_div_ps(_mm_mul_ps(diff, diff), sum)));
+	}
+	_mm_storeu_ps(sums, acc);
+	total = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	total = 0.f;
+#endif
+
+	for (; i < nbins; i++) {
+		a = hist1[i];
+		b = hist2[i];
+		if (a + b > 0.f)
+			total += (a - b) * (a - b) / (a + b);
+	}
+
+	return total / (2.f * THUMB_NPIXELS);
+}
@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HIST_HEADER
+#define HIST_HEADER
+
+/////////// Compile-time configuration ////////////
+#define HIST_MIN_INTERSECTION 0.80f //normalized overlap needed to call two images alike
+#define HIST_MAX_CHISQUARE    0.10f //normalized chi-square distance allowed on top of that
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define HIST_USE_SSE2
+#endif
+///////////////////////////////////////////////////
+
+//4x4x4 bins of the top two bits of each of red, green, and blue
+#define HIST_RGB_BINS 64
+//8x4x4 bins of hue, saturation, and value
+#define HIST_HSV_H 8
+#define HIST_HSV_S 4
+#define HIST_HSV_V 4
+#define HIST_HSV_BINS (HIST_HSV_H * HIST_HSV_S * HIST_HSV_V)
+
+/*
+ * Bins hold pixel counts of a THUMB_CX x THUMB_CY thumb, so they always fit in 16
+ * bits, and both histogram sizes are multiples of 8 bins for the SIMD kernels.
+ */
+typedef uint16_t HISTBIN;
+
+void HistCalc(int **tpixels, HISTBIN *histrgb, HISTBIN *histhsv);
+float HistIntersection(const HISTBIN *hist1, const HISTBIN *hist2, int nbins);
+float HistChiSquare(const HISTBIN *hist1, const HISTBIN *hist2, int nbins);
+
+static inline int HistMatch(const HISTBIN *hist1, const HISTBIN *hist2, int nbins) {
+	return HistIntersection(hist1, hist2, nbins) >= HIST_MIN_INTERSECTION &&
+		HistChiSquare(hist1, hist2, nbins) <= HIST_MAX_CHISQUARE;
+}
+
+#endif //HIST_HEADER
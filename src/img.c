@@ -1,322 +1,711 @@
-/*-
- * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-/* 
- * img.c - 
- *    Routines to load, save, compare and verify images using libgd.
- */
-
-#include "main.h"
-#include "img.h"
-
-inline int ImgPixelCompareFuzzy(int p1, int p2);
-
-
-///////////////////////////////////////////////////////////////////////////////
-
-
-gdImagePtr ImgLoadGd(const char *filename, unsigned int *filesize) {
-	FILE *file;
-	gdImagePtr img;
-	char blah[4], *tmp;
-	uint16_t sig16;
-	uint32_t sig32;
-	long filelen;
-
-	if (!filename)
-		return NULL;
-
-	file = NULL;
-	tmp  = NULL;
-	img  = NULL;
-
-	file = fopen(filename, "rb");
-	if (!file)
-		return NULL;
-
-	if (!fread(blah, 4, 1, file))
-		goto done;
-
-	fseek(file, 0, SEEK_END);
-	filelen = ftell(file);
-	rewind(file);
-
-	if (filesize)
-		*filesize = filelen;
-
-	tmp = malloc(filelen);
-	if (!fread(tmp, filelen, 1, file))
-		goto done;
-
-	sig16 = LE16(*(uint16_t *)blah);
-	sig32 = LE32(*(uint32_t *)blah);
-
-	if (sig16 == 0xD8FF) {
-		img = gdImageCreateFromJpegPtr(filelen, tmp);
-	} else if (sig32 == 'GNP\x89') {
-		img = gdImageCreateFromPngPtr(filelen, tmp);
-	} else if (sig32 == '8FIG') {
-		img = gdImageCreateFromGifPtr(filelen, tmp);
-	} else if (sig16 == 'MB') {
-		img = gdImageCreateFromWBMPPtr(filelen, tmp);
-	} else {
-		fprintf(stderr, "WARNING: %s is an unsupported image format\n", filename);
-	}
-
-done:
-	if (file)
-		fclose(file);
-	if (tmp)
-		free(tmp);
-	return img;
-}
-
-
-int ImgSavePng(const char *filename, gdImagePtr im) {
-	FILE *out;
-	int size;
-	char *data;
-
-	out = fopen(filename, "wb");
-	if (!out)
-		return 0;
-
-	data = (char *)gdImagePngPtr(im, &size);
-	if (!data) {
-		fclose(out);
-		return 0;
-	}
-
-	fwrite(data, 1, size, out);
-
-	fclose(out);
-	gdFree(data);
-	return 1;
-}
-
-
-int ImgIsImageFile(const char *filename) {
-	const char *ext;
-
-	ext = strrchr(filename, '.');
-	if (!ext)
-		return 0;
-
-	switch (LE32(UAR32(ext))) {
-		case 'gpj.': //.jpg
-		case 'gnp.': //.png
-		case 'fig.': //.gif
-		case 'epj.': //.jpeg
-		case 'pmb.': //.bmp
-		case 'bid.': //.dib
-			return 1;
-	}
-
-	return 0;
-}
-
-
-int ImgCompareFuzzy(gdImagePtr img1, gdImagePtr img2) {
-	int x, y, sx, sy, npixwrong, match;
-	float aspect_diff;
-	gdImagePtr imgtmp;
-	
-	match  = 1;
-	imgtmp = NULL;
-
-	if (img1->sx != img2->sx || img1->sy != img2->sy) {
-		aspect_diff = ((float)img1->sy / (float)img1->sx) - ((float)img2->sy / (float)img2->sx);
-		if (aspect_diff >= MAX_RATIODIFF || aspect_diff <= -MAX_RATIODIFF)
-			return 0;
-
-		if (img1->sx * img1->sy < img2->sx * img2->sy) {
-			sx = img1->sx;
-			sy = img1->sy;
-			imgtmp = gdImageCreateTrueColor(sx, sy);
-			gdImageCopyResampled(imgtmp, img2, 0, 0, 0, 0, sx, sy, img2->sx, img2->sy);
-			img2 = imgtmp;
-		} else {
-			sx = img2->sx;
-			sy = img2->sy;
-			imgtmp = gdImageCreateTrueColor(sx, sy);
-			gdImageCopyResampled(imgtmp, img1, 0, 0, 0, 0, sx, sy, img1->sx, img1->sy);
-			img1 = imgtmp;
-		}
-	} else {
-		sx = img1->sx;
-		sy = img1->sy;
-	}
-
-	npixwrong = 0;
-	for (y = 0; y != sy; y++) {
-		for (x = 0; x != sx; x++) {
-			if (!ImgPixelCompareFuzzy(img1->tpixels[y][x], img2->tpixels[y][x])) {
-				npixwrong++;
-				if (npixwrong >= MAX_PIXELDIFF) {
-					match = 0;
-					break;
-				}
-			}
-		}
-	}
-
-	if (imgtmp)
-		gdImageDestroy(imgtmp);
-	return match;
-}
-
-
-int ImgCompareExact(gdImagePtr img1, gdImagePtr img2) {
-	int y, sx, sy;
-
-	sx = img1->sx;
-	sy = img1->sy;
-	if (sx != img2->sx || sy != img2->sy)
-		return 0;
-
-	for (y = 0; y != sy; y++) {
-		if (memcmp(img1->tpixels[y], img2->tpixels[y], sx * sizeof(img1->tpixels[y][0])))
-			return 0;
-	}
-
-	return 1;
-}
-
-
-int ImgGetAbsColorDiff(gdImagePtr img1, gdImagePtr img2, gdImagePtr imgresult) {
-	int p1, p2;
-	int x, y;
-	int dr, dg, db;
-	int tr, tg, tb;
-
-	tr = tg = tb = 0;
-
-	for (y = 0; y != THUMB_CY; y++) {
-		for (x = 0; x != THUMB_CX; x++) {
-			p1 = img1->tpixels[y][x];
-			p2 = img2->tpixels[y][x];
-			
-			dr = abs(gdTrueColorGetRed(p1)   - gdTrueColorGetRed(p2));
-			dg = abs(gdTrueColorGetGreen(p1) - gdTrueColorGetGreen(p2));
-			db = abs(gdTrueColorGetBlue(p1)  - gdTrueColorGetBlue(p2));
-			
-			tr += dr;
-			tg += dg;
-			tb += db;
-
-			imgresult->tpixels[y][x] = (dr << 16) | (dg << 8) | (db << 0);
-		}
-	}
-	tr /= THUMB_NPIXELS;
-	tg /= THUMB_NPIXELS;
-	tb /= THUMB_NPIXELS;
-
-	return (tr << 16) | (tg << 8) | (tb << 0);
-}
-
-
-#if 0
-#define floor2(x) ((int)(x))
-
-void gdImageCopyResampled(gdImagePtr dst, gdImagePtr src,
-						  int dstX, int dstY, int srcX, int srcY, 
-						  int dstW, int dstH, int srcW, int srcH) {
-	int x, y;
-	double sy1, sy2, sx1, sx2;
-
-	for (y = dstY; y < dstY + dstH; y++) {
-		sy1 = ((double)y       - (double)dstY) * (double)srcH / (double)dstH;
-		sy2 = ((double)(y + 1) - (double)dstY) * (double)srcH / (double)dstH;
-
-		for (x = dstX; x < dstX + dstW; x++) {
-			double sx, sy;
-			double spixels = 0;
-			double red = 0.0, green = 0.0, blue = 0.0, alpha = 0.0;
-
-			sx1 = ((double)x       - (double)dstX) * (double)srcW / (double)dstW;
-			sx2 = ((double)(x + 1) - (double)dstX) * (double)srcW / (double)dstW;
-
-			sy = sy1;
-			do {
-				double yportion;
-
-				if (floor2(sy) == floor2(sy1)) {
-					yportion = 1.0 - (sy - floor2(sy));
-					if (yportion > sy2 - sy1)
-						yportion = sy2 - sy1;
-					sy = floor2(sy);
-				} else if (sy == floor2(sy2)) {
-					yportion = sy2 - floor2(sy2);
-				} else {
-					yportion = 1.0;
-				}
-
-				sx = sx1;
-				do {
-					double xportion;
-					double pcontribution;
-					int p;
-
-					if (floor2(sx) == floor2(sx1)) {
-						xportion = 1.0 - (sx - floor2(sx));
-						if (xportion > sx2 - sx1)
-							xportion = sx2 - sx1;
-						sx = floor2 (sx);
-					} else if (sx == floor2(sx2)) {
-						xportion = sx2 - floor2(sx2);
-					} else {
-						xportion = 1.0;
-					}
-					pcontribution = xportion * yportion;
-
-					p = gdImageGetTrueColorPixel(src, (int)sx + srcX, (int)sy + srcY);
-
-					red   += gdTrueColorGetRed (p) * pcontribution;
-					green += gdTrueColorGetGreen (p) * pcontribution;
-					blue  += gdTrueColorGetBlue (p) * pcontribution;
-					spixels += xportion * yportion;
-
-					sx += 1.0;
-				} while (sx < sx2);
-				sy += 1.0;
-			} while (sy < sy2);
-
-			if (spixels != 0.0) {
-				red   /= spixels;
-				green /= spixels;
-				blue  /= spixels;
-			}
-
-			if (red > 255.0)
-				red = 255.0;
-			if (green > 255.0)
-				green = 255.0;
-			if (blue > 255.0)
-				blue = 255.0;
-
-			gdImageSetPixel(dst, x, y, gdTrueColorAlpha((int)red, (int)green, (int)blue, 0));
-		}
-	}
-}
-#endif
-
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * img.c - 
+ *    Routines to load, save, compare and verify images using libgd.
+ */
+
+#include "main.h"
+#include "stats.h"
+#include "mmfile.h"
+#include "hashtable.h"
+#include "img.h"
+
+#ifdef IMG_USE_SSE
+#	include <xmmintrin.h>
+#endif
+
+#ifdef IMG_USE_LIBJPEG
+#	include <setjmp.h>
+#	include <jpeglib.h>
+
+typedef struct _jpgerrmgr {
+	struct jpeg_error_mgr pub;
+	jmp_buf jmpbuf;
+} JPGERRMGR, *LPJPGERRMGR;
+
+void _ImgJpegErrorExit(j_common_ptr cinfo);
+gdImagePtr _ImgLoadJpegScaled(const char *filename, void *data,
+							  unsigned int len, int mincx, int mincy);
+#endif
+
+unsigned char *_ImgReadFile(const char *filename, unsigned int *filelen);
+int _ImgProbeJpeg(FILE *file, unsigned char *buf, unsigned int len, LPIMGINFO info);
+inline int ImgPixelCompareFuzzy(int p1, int p2);
+
+const char *img_fmt_strs[] = {
+	"unknown",
+	"jpeg",
+	"png",
+	"gif",
+	"bmp"
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+gdImagePtr ImgLoadGd(const char *filename, unsigned int *filesize) {
+	return ImgLoadGdScaled(filename, filesize, 0, 0, NULL);
+}
+
+
+/*
+ * mincx and mincy give the smallest size the caller intends to shrink the image down
+ * to; formats that can decode directly at a reduced size will stay at or above it.
+ * Pass 0 for both to always get the image at full size.  If hash is given, it receives
+ * the IMG_HASH_LEN word content hash of the file, taken from the same buffer.
+ */
+gdImagePtr ImgLoadGdScaled(const char *filename, unsigned int *filesize,
+						   int mincx, int mincy, uint32_t *hash) {
+	FMAPINFO fmi;
+	gdImagePtr img;
+	unsigned char *data;
+	unsigned int filelen;
+	uint16_t sig16;
+	uint32_t sig32;
+	int mapped;
+	PROF_DECL(t);
+
+	if (!filename)
+		return NULL;
+
+	img = NULL;
+	PROF_BEGIN(t);
+
+	mapped = MMFileOpenRead(filename, &fmi);
+	if (mapped) {
+		data    = fmi.addr;
+		filelen = fmi.maplen;
+	} else {
+		data = _ImgReadFile(filename, &filelen);
+		if (!data)
+			return NULL;
+	}
+
+	if (filesize)
+		*filesize = filelen;
+	if (hash)
+		HtMurmur3Hash128(data, filelen, IMG_HASH_SEED, hash);
+
+	if (filelen < 4)
+		goto done;
+
+	sig16 = LE16(UAR16(data));
+	sig32 = LE32(UAR32(data));
+
+	if (sig16 == 0xD8FF) {
+#ifdef IMG_USE_LIBJPEG
+		if (mincx && mincy)
+			img = _ImgLoadJpegScaled(filename, data, filelen, mincx, mincy);
+		if (!img)
+#endif
+			img = gdImageCreateFromJpegPtr(filelen, data);
+	} else if (sig32 == 'GNP\x89') {
+		img = gdImageCreateFromPngPtr(filelen, data);
+	} else if (sig32 == '8FIG') {
+		img = gdImageCreateFromGifPtr(filelen, data);
+	} else if (sig16 == 'MB') {
+		img = gdImageCreateFromBmpPtr(filelen, data);
+	} else {
+		fprintf(stderr, "WARNING: %s is an unsupported image format\n", filename);
+	}
+
+done:
+	if (mapped)
+		MMFileClose(&fmi);
+	else
+		free(data);
+	PROF_END(t, STAT_DECODE, filelen);
+	return img;
+}
+
+
+int ImgHashFile(const char *filename, uint32_t *hash, unsigned int *filesize) {
+	FMAPINFO fmi;
+	unsigned char *data;
+	unsigned int filelen;
+
+	if (!filename || !hash)
+		return 0;
+
+	if (MMFileOpenRead(filename, &fmi)) {
+		HtMurmur3Hash128(fmi.addr, fmi.maplen, IMG_HASH_SEED, hash);
+		filelen = fmi.maplen;
+		MMFileClose(&fmi);
+	} else {
+		data = _ImgReadFile(filename, &filelen);
+		if (!data)
+			return 0;
+		HtMurmur3Hash128(data, filelen, IMG_HASH_SEED, hash);
+		free(data);
+	}
+
+	if (filesize)
+		*filesize = filelen;
+
+	return 1;
+}
+
+
+/*
+ * Fallback for files that can't be mapped, e.g. empty files or ones on
+ * filesystems without mmap support.
+ */
+unsigned char *_ImgReadFile(const char *filename, unsigned int *filelen) {
+	unsigned char *data;
+	FILE *file;
+	long len;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return NULL;
+
+	data = NULL;
+
+	if (fseek(file, 0, SEEK_END) || (len = ftell(file)) < 0)
+		goto done;
+	rewind(file);
+
+	data = malloc(len ? len : 1);
+	if (!data)
+		goto done;
+
+	if (len && !fread(data, len, 1, file)) {
+		free(data);
+		data = NULL;
+		goto done;
+	}
+
+	*filelen = len;
+
+done:
+	fclose(file);
+	return data;
+}
+
+
+#ifdef IMG_USE_LIBJPEG
+
+void _ImgJpegErrorExit(j_common_ptr cinfo) {
+	LPJPGERRMGR jerr = (LPJPGERRMGR)cinfo->err;
+
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(jerr->jmpbuf, 1);
+}
+
+
+/*
+ * Decodes at the largest of the 1/8, 1/4 and 1/2 DCT scales that keeps the image
+ * at least IMG_JPEG_SCALE_MARGIN times mincx by mincy, so big photos never get
+ * expanded to full size only to be resampled down to a thumbnail, while the
+ * resampling still has enough source pixels to average over.  Returns NULL for
+ * anything it won't handle (e.g. CMYK, which gd knows how to invert), leaving the
+ * caller to fall back to gd.
+ */
+gdImagePtr _ImgLoadJpegScaled(const char *filename, void *data,
+							  unsigned int len, int mincx, int mincy) {
+	struct jpeg_decompress_struct cinfo;
+	JPGERRMGR jerr;
+	gdImagePtr volatile img;
+	unsigned char *volatile row;
+	unsigned char *p;
+	unsigned int denom, x, y, mincxs, mincys;
+	int *tpixels;
+
+	img = NULL;
+	row = NULL;
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = _ImgJpegErrorExit;
+	if (setjmp(jerr.jmpbuf)) {
+		fprintf(stderr, "WARNING: libjpeg failed to decode %s\n", filename);
+		jpeg_destroy_decompress(&cinfo);
+		if (row)
+			free(row);
+		if (img)
+			gdImageDestroy(img);
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, data, len);
+	jpeg_read_header(&cinfo, TRUE);
+
+	if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+
+	mincxs = mincx * IMG_JPEG_SCALE_MARGIN;
+	mincys = mincy * IMG_JPEG_SCALE_MARGIN;
+	for (denom = 8; denom != 1; denom >>= 1) {
+		if ((cinfo.image_width + denom - 1) / denom >= mincxs &&
+			(cinfo.image_height + denom - 1) / denom >= mincys)
+			break;
+	}
+
+	cinfo.scale_num       = 1;
+	cinfo.scale_denom     = denom;
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.dct_method      = JDCT_ISLOW;
+	jpeg_start_decompress(&cinfo);
+
+	img = gdImageCreateTrueColor(cinfo.output_width, cinfo.output_height);
+	row = malloc(cinfo.output_width * 3);
+	if (!img || !row)
+		longjmp(jerr.jmpbuf, 1);
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		y = cinfo.output_scanline;
+		p = row;
+		jpeg_read_scanlines(&cinfo, (JSAMPARRAY)&p, 1);
+
+		tpixels = img->tpixels[y];
+		for (x = 0; x != cinfo.output_width; x++, p += 3)
+			tpixels[x] = gdTrueColor(p[0], p[1], p[2]);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	free(row);
+
+	return img;
+}
+
+#endif
+
+
+int ImgSavePng(const char *filename, gdImagePtr im) {
+	FILE *out;
+	int size;
+	char *data;
+	PROF_DECL(t);
+
+	out = fopen(filename, "wb");
+	if (!out)
+		return 0;
+
+	PROF_BEGIN(t);
+	data = (char *)gdImagePngPtr(im, &size);
+	PROF_END(t, STAT_PNG_ENCODE, data ? size : 0);
+	if (!data) {
+		fclose(out);
+		return 0;
+	}
+
+	fwrite(data, 1, size, out);
+
+	fclose(out);
+	gdFree(data);
+	return 1;
+}
+
+
+int ImgIsImageFile(const char *filename) {
+	const char *ext;
+
+	ext = strrchr(filename, '.');
+	if (!ext)
+		return 0;
+
+	switch (LE32(UAR32(ext))) {
+		case 'gpj.': //.jpg
+		case 'gnp.': //.png
+		case 'fig.': //.gif
+		case 'epj.': //.jpeg
+		case 'pmb.': //.bmp
+		case 'bid.': //.dib
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Reads only as much of the file as it takes to find the dimensions, which for
+ * everything but JPEG is a fixed spot in the first few dozen bytes.
+ */
+int ImgProbe(const char *filename, LPIMGINFO info) {
+	unsigned char buf[IMG_PROBE_BUFLEN];
+	unsigned int len, hdrsize;
+	int32_t height;
+	long filelen;
+	FILE *file;
+
+	if (!filename || !info)
+		return 0;
+
+	memset(info, 0, sizeof(IMGINFO));
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return 0;
+
+	if (fseek(file, 0, SEEK_END) || (filelen = ftell(file)) < 0)
+		goto done;
+	rewind(file);
+	info->filesize = filelen;
+
+	len = fread(buf, 1, sizeof(buf), file);
+
+	if (len >= 4 && buf[0] == 0xFF && buf[1] == 0xD8) {
+		info->format = IMG_FMT_JPEG;
+		_ImgProbeJpeg(file, buf, len, info);
+	} else if (len >= 24 && !memcmp(buf, "\x89PNG\r\n\x1a\n", 8) &&
+		!memcmp(buf + 12, "IHDR", 4)) {
+		info->format = IMG_FMT_PNG;
+		info->width  = BE32(UAR32(buf + 16));
+		info->height = BE32(UAR32(buf + 20));
+	} else if (len >= 10 && (!memcmp(buf, "GIF87a", 6) || !memcmp(buf, "GIF89a", 6))) {
+		info->format = IMG_FMT_GIF;
+		info->width  = LE16(UAR16(buf + 6));
+		info->height = LE16(UAR16(buf + 8));
+	} else if (len >= 26 && buf[0] == 'B' && buf[1] == 'M') {
+		info->format = IMG_FMT_BMP;
+		hdrsize = LE32(UAR32(buf + 14));
+		if (hdrsize == 12) { //OS/2 BITMAPCOREHEADER
+			info->width  = LE16(UAR16(buf + 18));
+			info->height = LE16(UAR16(buf + 20));
+		} else {
+			info->width = LE32(UAR32(buf + 18));
+			height = (int32_t)LE32(UAR32(buf + 22));
+			info->height = height < 0 ? -height : height; //negative if top-down
+		}
+	}
+
+done:
+	fclose(file);
+	return info->format != IMG_FMT_UNKNOWN && info->width && info->height;
+}
+
+
+/*
+ * Walks the marker segments up to the first SOFn.  EXIF data ahead of it can run
+ * well past the first buffer, so segments not buffered are seeked to and read.
+ */
+int _ImgProbeJpeg(FILE *file, unsigned char *buf, unsigned int len, LPIMGINFO info) {
+	unsigned int pos, base, seglen;
+	unsigned char *p, marker;
+
+	base = 0;
+	pos  = 2;
+	for (;;) {
+		if (pos + 9 > base + len) {
+			if (fseek(file, pos, SEEK_SET))
+				return 0;
+			base = pos;
+			len  = fread(buf, 1, IMG_PROBE_BUFLEN, file);
+			if (len < 4)
+				return 0;
+		}
+
+		p = buf + (pos - base);
+		if (p[0] != 0xFF)
+			return 0;
+
+		marker = p[1];
+		if (marker == 0xFF) { //fill byte
+			pos++;
+			continue;
+		}
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) { //no length
+			pos += 2;
+			continue;
+		}
+		if (marker == 0xD9 || marker == 0xDA) //EOI or SOS before any frame header
+			return 0;
+
+		if (marker >= 0xC0 && marker <= 0xCF &&
+			marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			if (pos + 9 > base + len)
+				return 0;
+			info->height = BE16(UAR16(p + 5));
+			info->width  = BE16(UAR16(p + 7));
+			return 1;
+		}
+
+		seglen = BE16(UAR16(p + 2));
+		if (seglen < 2)
+			return 0;
+		pos += 2 + seglen;
+	}
+}
+
+
+/*
+ * Stores the indices of the aspects[] within MAX_RATIODIFF of aspect in indices,
+ * returning how many there were.  Aspects are height / width as from ImgAspect(),
+ * where 0 means unknown and is always kept.
+ */
+int ImgAspectFilter(float aspect, const float *aspects, unsigned int *indices, int n) {
+	int i, nkept;
+	float diff;
+#ifdef IMG_USE_SSE
+	__m128 q, a, d, maxdiff, zero, signbit;
+	int mask;
+#endif
+
+	nkept = 0;
+	i     = 0;
+
+	if (aspect == 0.f) {
+		for (; i != n; i++)
+			indices[nkept++] = i;
+		return nkept;
+	}
+
+#ifdef IMG_USE_SSE
+	q       = _mm_set1_ps(aspect);
+	maxdiff = _mm_set1_ps((float)MAX_RATIODIFF);
+	zero    = _mm_setzero_ps();
+	signbit = _mm_set1_ps(-0.f);
+
+	for (; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(aspects + i);
+		d = _mm_andnot_ps(signbit, _mm_sub_ps(a, q));
+		mask = _mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(d, maxdiff), _mm_cmpeq_ps(a, zero)));
+
+		if (mask & 1)
+			indices[nkept++] = i;
+		if (mask & 2)
+			indices[nkept++] = i + 1;
+		if (mask & 4)
+			indices[nkept++] = i + 2;
+		if (mask & 8)
+			indices[nkept++] = i + 3;
+	}
+#endif
+
+	for (; i != n; i++) {
+		diff = aspects[i] - aspect;
+		if (aspects[i] == 0.f || (diff < MAX_RATIODIFF && diff > -MAX_RATIODIFF))
+			indices[nkept++] = i;
+	}
+
+	return nkept;
+}
+
+
+//scales all of src to fill dst
+void ImgResample(gdImagePtr dst, gdImagePtr src) {
+	PROF_DECL(t);
+
+	PROF_BEGIN(t);
+	gdImageCopyResampled(dst, src, 0, 0, 0, 0, dst->sx, dst->sy, src->sx, src->sy);
+	PROF_END(t, STAT_RESAMPLE, 1);
+}
+
+
+int ImgCompareFuzzy(gdImagePtr img1, gdImagePtr img2) {
+	int x, y, sx, sy, npixwrong, match;
+	gdImagePtr imgtmp;
+	PROF_DECL(t);
+	
+	match  = 1;
+	imgtmp = NULL;
+	PROF_BEGIN(t);
+
+	if (img1->sx != img2->sx || img1->sy != img2->sy) {
+		if (!ImgAspectMatch(img1->sx, img1->sy, img2->sx, img2->sy)) {
+			PROF_COUNT(aspectrejects);
+			match = 0;
+			goto end;
+		}
+
+		if (img1->sx * img1->sy < img2->sx * img2->sy) {
+			sx = img1->sx;
+			sy = img1->sy;
+			imgtmp = gdImageCreateTrueColor(sx, sy);
+			ImgResample(imgtmp, img2);
+			img2 = imgtmp;
+		} else {
+			sx = img2->sx;
+			sy = img2->sy;
+			imgtmp = gdImageCreateTrueColor(sx, sy);
+			ImgResample(imgtmp, img1);
+			img1 = imgtmp;
+		}
+	} else {
+		sx = img1->sx;
+		sy = img1->sy;
+	}
+
+	npixwrong = 0;
+	for (y = 0; y != sy; y++) {
+		for (x = 0; x != sx; x++) {
+			if (!ImgPixelCompareFuzzy(img1->tpixels[y][x], img2->tpixels[y][x])) {
+				npixwrong++;
+				if (npixwrong >= MAX_PIXELDIFF) {
+					PROF_COUNT(earlyexits);
+					match = 0;
+					goto end;
+				}
+			}
+		}
+	}
+
+end:
+	if (imgtmp)
+		gdImageDestroy(imgtmp);
+	PROF_END(t, STAT_COMPARE, 1);
+	return match;
+}
+
+
+int ImgCompareExact(gdImagePtr img1, gdImagePtr img2) {
+	int y, sx, sy;
+
+	sx = img1->sx;
+	sy = img1->sy;
+	if (sx != img2->sx || sy != img2->sy)
+		return 0;
+
+	for (y = 0; y != sy; y++) {
+		if (memcmp(img1->tpixels[y], img2->tpixels[y], sx * sizeof(img1->tpixels[y][0])))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+int ImgGetAbsColorDiff(gdImagePtr img1, gdImagePtr img2, gdImagePtr imgresult) {
+	int p1, p2;
+	int x, y;
+	int dr, dg, db;
+	int tr, tg, tb;
+
+	tr = tg = tb = 0;
+
+	for (y = 0; y != THUMB_CY; y++) {
+		for (x = 0; x != THUMB_CX; x++) {
+			p1 = img1->tpixels[y][x];
+			p2 = img2->tpixels[y][x];
+			
+			dr = abs(gdTrueColorGetRed(p1)   - gdTrueColorGetRed(p2));
+			dg = abs(gdTrueColorGetGreen(p1) - gdTrueColorGetGreen(p2));
+			db = abs(gdTrueColorGetBlue(p1)  - gdTrueColorGetBlue(p2));
+			
+			tr += dr;
+			tg += dg;
+			tb += db;
+
+			imgresult->tpixels[y][x] = (dr << 16) | (dg << 8) | (db << 0);
+		}
+	}
+	tr /= THUMB_NPIXELS;
+	tg /= THUMB_NPIXELS;
+	tb /= THUMB_NPIXELS;
+
+	return (tr << 16) | (tg << 8) | (tb << 0);
+}
+
+
+#if 0
+#define floor2(x) ((int)(x))
+
+void gdImageCopyResampled(gdImagePtr dst, gdImagePtr src,
+						  int dstX, int dstY, int srcX, int srcY, 
+						  int dstW, int dstH, int srcW, int srcH) {
+	int x, y;
+	double sy1, sy2, sx1, sx2;
+
+	for (y = dstY; y < dstY + dstH; y++) {
+		sy1 = ((double)y       - (double)dstY) * (double)srcH / (double)dstH;
+		sy2 = ((double)(y + 1) - (double)dstY) * (double)srcH / (double)dstH;
+
+		for (x = dstX; x < dstX + dstW; x++) {
+			double sx, sy;
+			double spixels = 0;
+			double red = 0.0, green = 0.0, blue = 0.0, alpha = 0.0;
+
+			sx1 = ((double)x       - (double)dstX) * (double)srcW / (double)dstW;
+			sx2 = ((double)(x + 1) - (double)dstX) * (double)srcW / (double)dstW;
+
+			sy = sy1;
+			do {
+				double yportion;
+
+				if (floor2(sy) == floor2(sy1)) {
+					yportion = 1.0 - (sy - floor2(sy));
+					if (yportion > sy2 - sy1)
+						yportion = sy2 - sy1;
+					sy = floor2(sy);
+				} else if (sy == floor2(sy2)) {
+					yportion = sy2 - floor2(sy2);
+				} else {
+					yportion = 1.0;
+				}
+
+				sx = sx1;
+				do {
+					double xportion;
+					double pcontribution;
+					int p;
+
+					if (floor2(sx) == floor2(sx1)) {
+						xportion = 1.0 - (sx - floor2(sx));
+						if (xportion > sx2 - sx1)
+							xportion = sx2 - sx1;
+						sx = floor2 (sx);
+					} else if (sx == floor2(sx2)) {
+						xportion = sx2 - floor2(sx2);
+					} else {
+						xportion = 1.0;
+					}
+					pcontribution = xportion * yportion;
+
+					p = gdImageGetTrueColorPixel(src, (int)sx + srcX, (int)sy + srcY);
+
+					red   += gdTrueColorGetRed (p) * pcontribution;
+					green += gdTrueColorGetGreen (p) * pcontribution;
+					blue  += gdTrueColorGetBlue (p) * pcontribution;
+					spixels += xportion * yportion;
+
+					sx += 1.0;
+				} while (sx < sx2);
+				sy += 1.0;
+			} while (sy < sy2);
+
+			if (spixels != 0.0) {
+				red   /= spixels;
+				green /= spixels;
+				blue  /= spixels;
+			}
+
+			if (red > 255.0)
+				red = 255.0;
+			if (green > 255.0)
+				green = 255.0;
+			if (blue > 255.0)
+				blue = 255.0;
+
+			gdImageSetPixel(dst, x, y, gdTrueColorAlpha((int)red, (int)green, (int)blue, 0));
+		}
+	}
+}
+#endif
+
@@ -1,59 +1,110 @@
-/*-
- * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#ifndef IMG_HEADER
-#define IMG_HEADER
-
-///////////////////////// Compile-time configuration //////////////////////////
-#define MAX_PIXELDIFF 20
-#define MAX_COLORDIFF 16
-#define MAX_RATIODIFF 0.25
-///////////////////////////////////////////////////////////////////////////////
-
-gdImagePtr ImgLoadGd(const char *filename, unsigned int *filesize);
-int ImgSavePng(const char *filename, gdImagePtr im);
-int ImgIsImageFile(const char *filename);
-int ImgCompareFuzzy(gdImagePtr img1, gdImagePtr img2);
-int ImgCompareExact(gdImagePtr img1, gdImagePtr img2);
-int ImgGetAbsColorDiff(gdImagePtr img1, gdImagePtr img2, gdImagePtr imgresult);
-
-static inline int ImgPixelCompareFuzzy(int p1, int p2) {
-	int cdiff;
-
-	cdiff = gdTrueColorGetRed(p1) - gdTrueColorGetRed(p2);
-	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
-		return 0;
-	
-	cdiff = gdTrueColorGetGreen(p1) - gdTrueColorGetGreen(p2);
-	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
-		return 0;
-
-	cdiff = gdTrueColorGetBlue(p1) - gdTrueColorGetBlue(p2);
-	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
-		return 0;
-
-	return 1;
-}
-
-#endif //IMG_HEADER
-
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IMG_HEADER
+#define IMG_HEADER
+
+///////////////////////// Compile-time configuration //////////////////////////
+#define MAX_PIXELDIFF 20
+#define MAX_COLORDIFF 16
+#define MAX_RATIODIFF 0.25
+#define IMG_PROBE_BUFLEN 4096 //bytes read at a time while looking for image dimensions
+#define IMG_HASH_SEED 0x696D6763 //changing this invalidates every stored content hash
+
+#ifndef _WIN32
+#	define IMG_USE_LIBJPEG //decode JPEGs to be shrunk with libjpeg's DCT scaling
+#endif
+#define IMG_JPEG_SCALE_MARGIN 4 //DCT-scaled JPEGs stay at least this many times the target size
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#	define IMG_USE_SSE
+#endif
+///////////////////////////////////////////////////////////////////////////////
+
+#define IMG_FMT_UNKNOWN 0
+#define IMG_FMT_JPEG    1
+#define IMG_FMT_PNG     2
+#define IMG_FMT_GIF     3
+#define IMG_FMT_BMP     4
+
+#define IMG_HASH_LEN 4 //32 bit words in a file content hash
+
+typedef struct _imginfo {
+	unsigned int width;
+	unsigned int height;
+	unsigned int format;
+	unsigned int filesize;
+} IMGINFO, *LPIMGINFO;
+
+extern const char *img_fmt_strs[];
+
+gdImagePtr ImgLoadGd(const char *filename, unsigned int *filesize);
+gdImagePtr ImgLoadGdScaled(const char *filename, unsigned int *filesize,
+						   int mincx, int mincy, uint32_t *hash);
+int ImgHashFile(const char *filename, uint32_t *hash, unsigned int *filesize);
+int ImgSavePng(const char *filename, gdImagePtr im);
+int ImgIsImageFile(const char *filename);
+int ImgProbe(const char *filename, LPIMGINFO info);
+int ImgAspectFilter(float aspect, const float *aspects, unsigned int *indices, int n);
+void ImgResample(gdImagePtr dst, gdImagePtr src);
+int ImgCompareFuzzy(gdImagePtr img1, gdImagePtr img2);
+int ImgCompareExact(gdImagePtr img1, gdImagePtr img2);
+int ImgGetAbsColorDiff(gdImagePtr img1, gdImagePtr img2, gdImagePtr imgresult);
+
+//dimensions of 0 mean unknown, which can't rule anything out
+static inline float ImgAspect(unsigned int cx, unsigned int cy) {
+	return (cx && cy) ? (float)cy / (float)cx : 0.f;
+}
+
+
+static inline int ImgAspectMatch(unsigned int cx1, unsigned int cy1,
+								 unsigned int cx2, unsigned int cy2) {
+	float aspect_diff;
+
+	if (!cx1 || !cy1 || !cx2 || !cy2)
+		return 1;
+
+	aspect_diff = ((float)cy1 / (float)cx1) - ((float)cy2 / (float)cx2);
+	return aspect_diff < MAX_RATIODIFF && aspect_diff > -MAX_RATIODIFF;
+}
+
+static inline int ImgPixelCompareFuzzy(int p1, int p2) {
+	int cdiff;
+
+	cdiff = gdTrueColorGetRed(p1) - gdTrueColorGetRed(p2);
+	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
+		return 0;
+	
+	cdiff = gdTrueColorGetGreen(p1) - gdTrueColorGetGreen(p2);
+	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
+		return 0;
+
+	cdiff = gdTrueColorGetBlue(p1) - gdTrueColorGetBlue(p2);
+	if (cdiff >= MAX_COLORDIFF || cdiff <= -MAX_COLORDIFF)
+		return 0;
+
+	return 1;
+}
+
+#endif //IMG_HEADER
+
@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * lru.c - 
+ *    Routines for a bounded cache of items keyed by 32 bit integer, which evicts
+ *    the least recently used item to make room for a new one.
+ */
+
+#include "main.h"
+#include "hashtable.h"
+#include "lru.h"
+
+void _LruUnlink(LPLRU lru, LPLRUNODE node);
+void _LruPushFront(LPLRU lru, LPLRUNODE node);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+//freeproc is called on the values evicted, removed or left at destruction, if not NULL
+LPLRU LruInit(unsigned int maxitems, void (*freeproc)(void *)) {
+	unsigned int tablelen;
+	LPLRU lru;
+
+	if (!maxitems)
+		return NULL;
+
+	for (tablelen = 16; tablelen < maxitems && tablelen < 0x80000000; tablelen <<= 1);
+
+	lru = malloc(sizeof(LRU));
+	if (!lru)
+		return NULL;
+	memset(lru, 0, sizeof(LRU));
+
+	lru->ht = HtInit(tablelen, sizeof(uint32_t), HT_HASH_DEFAULT, LRU_HT_SLOTS);
+	if (!lru->ht) {
+		free(lru);
+		return NULL;
+	}
+	lru->maxitems = maxitems;
+	lru->freeproc = freeproc;
+
+	return lru;
+}
+
+
+void LruDestroy(LPLRU lru) {
+	LruClear(lru);
+	HtDestroy(lru->ht);
+	free(lru);
+}
+
+
+//the value returned stays valid until the next LruInsert, LruRemove or LruClear
+void *LruGet(LPLRU lru, uint32_t key) {
+	LPLRUNODE node;
+
+	node = HtGetItem(lru->ht, &key);
+	if (!node) {
+		lru->misses++;
+		return NULL;
+	}
+	lru->hits++;
+
+	if (node != lru->head) {
+		_LruUnlink(lru, node);
+		_LruPushFront(lru, node);
+	}
+	return node->value;
+}
+
+
+//the cache takes ownership of value; the key mustn't be in it already
+void LruInsert(LPLRU lru, uint32_t key, void *value) {
+	LPLRUNODE node;
+
+	if (lru->nitems == lru->maxitems) {
+		node = lru->tail;
+		_LruUnlink(lru, node);
+		HtUnassociateItem(lru->ht, &node->key);
+		lru->nitems--;
+		lru->evictions++;
+		if (lru->freeproc)
+			lru->freeproc(node->value);
+	} else {
+		node = malloc(sizeof(LRUNODE));
+		if (!node) {
+			if (lru->freeproc)
+				lru->freeproc(value);
+			return;
+		}
+	}
+
+	node->key   = key;
+	node->value = value;
+	HtInsertItem(lru->ht, &node->key, node);
+	_LruPushFront(lru, node);
+	lru->nitems++;
+}
+
+
+int LruRemove(LPLRU lru, uint32_t key) {
+	LPLRUNODE node;
+
+	node = HtUnassociateItem(lru->ht, &key);
+	if (!node)
+		return 0;
+
+	_LruUnlink(lru, node);
+	lru->nitems--;
+	if (lru->freeproc)
+		lru->freeproc(node->value);
+	free(node);
+	return 1;
+}
+
+
+//empties the cache, leaving its counters alone
+void LruClear(LPLRU lru) {
+	LPLRUNODE node, next;
+
+	for (node = lru->head; node; node = next) {
+		next = node->next;
+		if (lru->freeproc)
+			lru->freeproc(node->value);
+		free(node);
+	}
+	HtResetTable(lru->ht);
+
+	lru->head   = NULL;
+	lru->tail   = NULL;
+	lru->nitems = 0;
+}
+
+
+void _LruUnlink(LPLRU lru, LPLRUNODE node) {
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		lru->head = node->next;
+
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		lru->tail = node->prev;
+}
+
+
+void _LruPushFront(LPLRU lru, LPLRUNODE node) {
+	node->prev = NULL;
+	node->next = lru->head;
+	if (lru->head)
+		lru->head->prev = node;
+	else
+		lru->tail = node;
+	lru->head = node;
+}
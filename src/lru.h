@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LRU_HEADER
+#define LRU_HEADER
+
+/////////// Compile-time configuration ////////////
+#define LRU_HT_SLOTS 2
+///////////////////////////////////////////////////
+
+#include "hashtable.h"
+
+typedef struct _lrunode {
+	uint32_t key; //first, so the hash table finds nodes by it
+	void *value;
+	struct _lrunode *prev;
+	struct _lrunode *next;
+} LRUNODE, *LPLRUNODE;
+
+typedef struct _lru {
+	LPHT ht;
+	LPLRUNODE head; //most recently used
+	LPLRUNODE tail; //next to be evicted
+	unsigned int nitems;
+	unsigned int maxitems;
+	void (*freeproc)(void *);
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} LRU, *LPLRU;
+
+LPLRU LruInit(unsigned int maxitems, void (*freeproc)(void *));
+void LruDestroy(LPLRU lru);
+void *LruGet(LPLRU lru, uint32_t key);
+void LruInsert(LPLRU lru, uint32_t key, void *value);
+int LruRemove(LPLRU lru, uint32_t key);
+void LruClear(LPLRU lru);
+
+#endif //LRU_HEADER
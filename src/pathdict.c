@@ -0,0 +1,360 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * pathdict.c - 
+ *    Table of the directories under a cache's root, so entries can store a small
+ *    directory id and their own file name instead of a whole relative path
+ */
+
+#include "main.h"
+#include "arena.h"
+#include "hashtable.h"
+#include "pathdict.h"
+
+int _PdInit(LPPATHDICT pd, const char *filename);
+int _PdLoad(LPPATHDICT pd);
+void _PdReset(LPPATHDICT pd);
+uint32_t _PdInsert(LPPATHDICT pd, uint32_t parent, const char *name, unsigned int namelen);
+int _PdRehash(LPPATHDICT pd, unsigned int nslots);
+unsigned int _PdParentLen(const char *dir, unsigned int len);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+LPPATHDICT PdOpen(const char *filename, int readonly) {
+	LPPATHDICT pd;
+	PDHEADER header;
+
+	pd = malloc(sizeof(PATHDICT));
+	if (!pd)
+		return NULL;
+	memset(pd, 0, sizeof(PATHDICT));
+
+	pd->arena = ArenaInit();
+	if (!pd->arena)
+		goto fail;
+
+	_PdReset(pd);
+	if (!pd->paths)
+		goto fail;
+
+	pd->file = fopen(filename, readonly ? "rb" : "rb+");
+	if (pd->file) {
+		if (fread(&header, sizeof(PDHEADER), 1, pd->file) == 1 &&
+			header.signature == 'TMBD' && header.version == PD_VERSION) {
+			if (_PdLoad(pd))
+				return pd;
+			fprintf(stderr, "WARNING: directory table %s is damaged%s\n",
+				filename, readonly ? "" : ", reinitializing");
+		} else {
+			printf("directory table %s is stale%s\n",
+				filename, readonly ? "" : ", reinitializing");
+		}
+
+		//a reader leaves the table for the next update to rebuild
+		if (readonly)
+			goto fail;
+
+		fclose(pd->file);
+		pd->file = NULL;
+		_PdReset(pd);
+		if (!pd->paths)
+			goto fail;
+	} else if (errno != ENOENT || readonly) {
+		if (errno != ENOENT)
+			perror(readonly ? "fopen rb" : "fopen rb+");
+		goto fail;
+	}
+
+	if (!_PdInit(pd, filename))
+		goto fail;
+
+	return pd;
+
+fail:
+	PdClose(pd);
+	return NULL;
+}
+
+
+void PdClose(LPPATHDICT pd) {
+	if (!pd)
+		return;
+
+	if (pd->file)
+		fclose(pd->file);
+	if (pd->arena)
+		ArenaDestroy(pd->arena);
+	free(pd->paths);
+	free(pd->pathlens);
+	free(pd->slots);
+	free(pd);
+}
+
+
+int _PdInit(LPPATHDICT pd, const char *filename) {
+	PDHEADER header;
+
+	pd->file = fopen(filename, "wb+");
+	if (!pd->file) {
+		perror("fopen wb+");
+		return 0;
+	}
+
+	header.signature = 'TMBD';
+	header.version   = PD_VERSION;
+	if (fwrite(&header, sizeof(PDHEADER), 1, pd->file) != 1 || fflush(pd->file)) {
+		fprintf(stderr, "ERROR: failed to write directory table %s\n", filename);
+		return 0;
+	}
+
+	pd->isnew = 1;
+	return 1;
+}
+
+
+//a record cut short by an interrupted write fails the whole table
+int _PdLoad(LPPATHDICT pd) {
+	char name[MAX_PATH];
+	uint32_t parent;
+	uint16_t namelen;
+
+	while (fread(&parent, sizeof(parent), 1, pd->file) == 1) {
+		if (fread(&namelen, sizeof(namelen), 1, pd->file) != 1 ||
+			!namelen || namelen >= sizeof(name) || parent > pd->ndirs ||
+			fread(name, 1, namelen, pd->file) != namelen)
+			return 0;
+
+		if (_PdInsert(pd, parent, name, namelen) == PD_NOTFOUND)
+			return 0;
+	}
+
+	return !ferror(pd->file);
+}
+
+
+//leaves only PD_ROOT; paths is left NULL if memory runs out
+void _PdReset(LPPATHDICT pd) {
+	ArenaReset(pd->arena);
+
+	free(pd->paths);
+	free(pd->pathlens);
+	free(pd->slots);
+
+	pd->ndirs    = 0;
+	pd->maxdirs  = PD_INITIAL_SLOTS / 2;
+	pd->nslots   = PD_INITIAL_SLOTS;
+	pd->paths    = malloc(pd->maxdirs * sizeof(char *));
+	pd->pathlens = malloc(pd->maxdirs * sizeof(unsigned int));
+	pd->slots    = malloc(pd->nslots * sizeof(uint32_t));
+	if (!pd->paths || !pd->pathlens || !pd->slots) {
+		free(pd->paths);
+		free(pd->pathlens);
+		free(pd->slots);
+		pd->paths    = NULL;
+		pd->pathlens = NULL;
+		pd->slots    = NULL;
+		return;
+	}
+
+	memset(pd->slots, 0xFF, pd->nslots * sizeof(uint32_t));
+	pd->paths[PD_ROOT]    = "";
+	pd->pathlens[PD_ROOT] = 0;
+}
+
+
+uint32_t PdLookup(LPPATHDICT pd, const char *dir, unsigned int len) {
+	uint32_t i, id, mask;
+
+	if (!len)
+		return PD_ROOT;
+
+	mask = pd->nslots - 1;
+	for (i = HtDefaultHash(dir, len) & mask; ; i = (i + 1) & mask) {
+		id = pd->slots[i];
+		if (id == PD_NOTFOUND)
+			return PD_NOTFOUND;
+		if (pd->pathlens[id] == len && !memcmp(pd->paths[id], dir, len))
+			return id;
+	}
+}
+
+
+uint32_t PdAdd(LPPATHDICT pd, const char *dir, unsigned int len) {
+	unsigned int parentlen;
+	uint32_t id, parent;
+	uint16_t namelen;
+
+	id = PdLookup(pd, dir, len);
+	if (id != PD_NOTFOUND)
+		return id;
+
+	if (dir[len - 1] != PATH_SEPARATOR)
+		return PD_NOTFOUND;
+
+	parentlen = _PdParentLen(dir, len);
+	parent    = PdAdd(pd, dir, parentlen);
+	if (parent == PD_NOTFOUND)
+		return PD_NOTFOUND;
+
+	namelen = (uint16_t)(len - parentlen - 1);
+	if (!namelen)
+		return PD_NOTFOUND;
+
+	//a record _PdInsert would refuse must never reach the file, or every later
+	//load of the table would fail on it
+	if (pd->pathlens[parent] + namelen + 1 >= MAX_PATH)
+		return PD_NOTFOUND;
+
+	if (fseek(pd->file, 0, SEEK_END))
+		return PD_NOTFOUND;
+	fwrite(&parent, sizeof(parent), 1, pd->file);
+	fwrite(&namelen, sizeof(namelen), 1, pd->file);
+	fwrite(dir + parentlen, 1, namelen, pd->file);
+	if (fflush(pd->file) || ferror(pd->file)) {
+		fprintf(stderr, "ERROR: failed to write directory table\n");
+		return PD_NOTFOUND;
+	}
+
+	return _PdInsert(pd, parent, dir + parentlen, namelen);
+}
+
+
+const char *PdGetPath(LPPATHDICT pd, uint32_t id, unsigned int *len) {
+	if (id > pd->ndirs)
+		return NULL;
+
+	if (len)
+		*len = pd->pathlens[id];
+	return pd->paths[id];
+}
+
+
+unsigned int PdSplit(const char *path) {
+	const char *sep;
+
+	sep = strrchr(path, PATH_SEPARATOR);
+	return sep ? (unsigned int)(sep - path + 1) : 0;
+}
+
+
+int PdJoin(LPPATHDICT pd, uint32_t id, const char *name, unsigned int namelen,
+		   char *buf, size_t buflen) {
+	const char *dir;
+	unsigned int dirlen;
+
+	dir = PdGetPath(pd, id, &dirlen);
+	if (!dir || dirlen + namelen + 1 > buflen)
+		return 0;
+
+	memcpy(buf, dir, dirlen);
+	memcpy(buf + dirlen, name, namelen);
+	buf[dirlen + namelen] = '\0';
+
+	return 1;
+}
+
+
+uint32_t _PdInsert(LPPATHDICT pd, uint32_t parent, const char *name, unsigned int namelen) {
+	unsigned int len, maxdirs;
+	uint32_t id, i, mask;
+	char *path, **paths;
+	unsigned int *pathlens;
+
+	len = pd->pathlens[parent] + namelen + 1;
+	if (len >= MAX_PATH)
+		return PD_NOTFOUND;
+
+	if (pd->ndirs + 1 == pd->maxdirs) {
+		maxdirs  = pd->maxdirs * 2;
+		paths    = realloc(pd->paths, maxdirs * sizeof(char *));
+		if (!paths)
+			return PD_NOTFOUND;
+		pd->paths = paths;
+		pathlens = realloc(pd->pathlens, maxdirs * sizeof(unsigned int));
+		if (!pathlens)
+			return PD_NOTFOUND;
+		pd->pathlens = pathlens;
+		pd->maxdirs  = maxdirs;
+
+		//the table is kept at most half full
+		if (!_PdRehash(pd, pd->nslots * 2))
+			return PD_NOTFOUND;
+	}
+
+	path = ArenaAlloc(pd->arena, len + 1);
+	if (!path)
+		return PD_NOTFOUND;
+	memcpy(path, pd->paths[parent], pd->pathlens[parent]);
+	memcpy(path + pd->pathlens[parent], name, namelen);
+	path[len - 1] = PATH_SEPARATOR;
+	path[len]     = '\0';
+
+	id = ++pd->ndirs;
+	pd->paths[id]    = path;
+	pd->pathlens[id] = len;
+
+	mask = pd->nslots - 1;
+	for (i = HtDefaultHash(path, len) & mask; pd->slots[i] != PD_NOTFOUND; i = (i + 1) & mask);
+	pd->slots[i] = id;
+
+	return id;
+}
+
+
+int _PdRehash(LPPATHDICT pd, unsigned int nslots) {
+	uint32_t *slots, id, i, mask;
+
+	slots = malloc(nslots * sizeof(uint32_t));
+	if (!slots)
+		return 0;
+	memset(slots, 0xFF, nslots * sizeof(uint32_t));
+
+	mask = nslots - 1;
+	for (id = 1; id <= pd->ndirs; id++) {
+		for (i = HtDefaultHash(pd->paths[id], pd->pathlens[id]) & mask;
+			slots[i] != PD_NOTFOUND; i = (i + 1) & mask);
+		slots[i] = id;
+	}
+
+	free(pd->slots);
+	pd->slots  = slots;
+	pd->nslots = nslots;
+
+	return 1;
+}
+
+
+//length of the parent of dir, which ends in a separator, including its own separator
+unsigned int _PdParentLen(const char *dir, unsigned int len) {
+	unsigned int i;
+
+	for (i = len - 1; i; i--) {
+		if (dir[i - 1] == PATH_SEPARATOR)
+			return i;
+	}
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PATHDICT_HEADER
+#define PATHDICT_HEADER
+
+/////////// Compile-time configuration ////////////
+#define PD_INITIAL_SLOTS 256 //Must be a power of 2
+///////////////////////////////////////////////////
+
+#include "arena.h"
+
+#define PD_ROOT     0
+#define PD_NOTFOUND 0xFFFFFFFF
+
+/*
+ *	Path Dictionary File format:
+ *
+ *	[UINT32] 'TMBD' signature
+ *	[UINT32] format version
+ *	For each directory:
+ *	    [UINT32] id of the parent directory, PD_ROOT for a top level directory
+ *	    [UINT16] length of the directory's own name
+ *	    [CHAR []] name, not terminated
+ *
+ *	Directories are numbered from 1 in the order they appear; a parent always comes
+ *	before its children.  PD_ROOT is the directory the paths are relative to and has
+ *	no record of its own.
+ */
+
+#define PD_VERSION 1
+
+typedef struct _pdheader {
+	uint32_t signature;
+	uint32_t version;
+} PDHEADER, *LPPDHEADER;
+
+typedef struct _pathdict {
+	FILE *file;
+	LPARENA arena;
+	char **paths;
+	unsigned int *pathlens;
+	unsigned int ndirs;
+	unsigned int maxdirs;
+	uint32_t *slots;
+	unsigned int nslots;
+	int isnew;
+} PATHDICT, *LPPATHDICT;
+
+
+LPPATHDICT PdOpen(const char *filename, int readonly);
+/*
+ * Routine Description:
+ *    This routine opens a directory table and reads all of its directories into
+ *    memory.  For writing, the table is created if it does not exist yet, and if
+ *    the file was not a directory table or was written by another version, it is
+ *    started over empty; either way isnew is set so the caller knows ids it has
+ *    stored elsewhere are meaningless.  For reading, a missing, stale or damaged
+ *    table is left untouched and the open fails.
+ *
+ * Arguments:
+ *    filename	filename of the table to open
+ *    readonly	nonzero if the table is only going to be read
+ *
+ * Return Value:
+ *    A pointer to a PATHDICT structure passed to all subsequent operations (success),
+ *    or NULL (failure).
+ */
+
+void PdClose(LPPATHDICT pd);
+/*
+ * Routine Description:
+ *    This routine closes a directory table.  After this operation, pd is no longer valid.
+ *
+ * Arguments:
+ *    pd		table to close
+ *
+ * Return Value:
+ *    (none)
+ */
+
+uint32_t PdLookup(LPPATHDICT pd, const char *dir, unsigned int len);
+/*
+ * Routine Description:
+ *    This routine finds the id of a directory.
+ *
+ * Arguments:
+ *    pd		table to search
+ *    dir		relative path of the directory, ending in PATH_SEPARATOR; need not
+ *              be terminated
+ *    len		length of dir, or 0 for PD_ROOT
+ *
+ * Return Value:
+ *    The id of dir, or PD_NOTFOUND if it isn't in the table.
+ */
+
+uint32_t PdAdd(LPPATHDICT pd, const char *dir, unsigned int len);
+/*
+ * Routine Description:
+ *    This routine finds the id of a directory, adding it and any of its parents
+ *    missing from the table.  New directories are written out immediately.
+ *
+ * Arguments:
+ *    pd		table to add to
+ *    dir		relative path of the directory, as for PdLookup
+ *    len		length of dir
+ *
+ * Return Value:
+ *    The id of dir (success), or PD_NOTFOUND (failure).
+ */
+
+const char *PdGetPath(LPPATHDICT pd, uint32_t id, unsigned int *len);
+/*
+ * Routine Description:
+ *    This routine retrieves the relative path of a directory, ending in
+ *    PATH_SEPARATOR, or "" for PD_ROOT.
+ *
+ * Arguments:
+ *    pd		table to search
+ *    id		id of the directory
+ *    len		(OUT, optional) length of the path
+ *
+ * Return Value:
+ *    The path, good until pd is closed, or NULL if there is no such directory.
+ */
+
+unsigned int PdSplit(const char *path);
+/*
+ * Routine Description:
+ *    This routine splits a relative file path into directory and file name.
+ *
+ * Arguments:
+ *    path		path to split
+ *
+ * Return Value:
+ *    The length of the directory part, including its trailing PATH_SEPARATOR.  The
+ *    file name starts at that position.
+ */
+
+int PdJoin(LPPATHDICT pd, uint32_t id, const char *name, unsigned int namelen,
+		   char *buf, size_t buflen);
+/*
+ * Routine Description:
+ *    This routine rebuilds the relative path of a file from its directory and name.
+ *
+ * Arguments:
+ *    pd		table the directory id belongs to
+ *    id		id of the file's directory
+ *    name		file name
+ *    namelen	length of name
+ *    buf		buffer receiving the terminated path
+ *    buflen	size of buf
+ *
+ * Return Value:
+ *    1 (success) or 0 (no such directory, or buf too small)
+ */
+
+#endif //PATHDICT_HEADER
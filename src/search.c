@@ -0,0 +1,265 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * search.c - 
+ *    Looks for one image in the thumb caches of several directories at once
+ */
+
+#include "main.h"
+#include "stats.h"
+#include "vector.h"
+#include "mmfile.h"
+#include "bptree.h"
+#include "hashdb.h"
+#include "pathdict.h"
+#include "img.h"
+#include "hist.h"
+#include "lru.h"
+#include "thumb.h"
+#include "shard.h"
+#include "search.h"
+
+THREADPROC(_SearchWorker, arg);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * The image is decoded once up front and the decoded query shared read-only between
+ * the workers, each of which takes the next unsearched cache, or shard of one, and
+ * matches against it.  The caches are only read, never brought up to date first, and
+ * their hash indexes are left alone, so matches come from the key range search alone.
+ * Matches are printed once every cache is done, grouped by directory in the order given.
+ */
+int SearchCachesPerform(const char *filename, char **dirs, int ndirs) {
+	THREAD threads[SEARCH_MAX_THREADS];
+	LPSEARCHTARGET targets;
+	THUMBQUERY query;
+	SEARCHCTX ctx;
+	int i, j, k, nworkers, nstarted, nmatched, ntargets, *nshards;
+
+	if (!ndirs) {
+		fprintf(stderr, "ERROR: no directories to search\n");
+		return 0;
+	}
+
+	if (!ThumbQueryInit(&query, filename)) {
+		fprintf(stderr, "ERROR: %s is not a recognized image\n", filename);
+		return 0;
+	}
+	if (!ThumbQueryDecode(&query)) {
+		fprintf(stderr, "ERROR: couldn't create thumbnail of %s\n", filename);
+		return 0;
+	}
+
+	nshards  = alloca(ndirs * sizeof(int));
+	ntargets = 0;
+	for (i = 0; i != ndirs; i++) {
+		nshards[i] = _SearchCountShards(dirs[i]);
+		ntargets  += nshards[i] ? nshards[i] : 1;
+	}
+
+	targets = calloc(ntargets, sizeof(SEARCHTARGET));
+	if (!targets) {
+		perror("calloc");
+		ThumbQueryFree(&query);
+		return 0;
+	}
+	for (i = k = 0; i != ndirs; i++) {
+		j = 0;
+		do {
+			targets[k].dir   = dirs[i];
+			targets[k].shard = nshards[i] ? j : -1;
+			k++;
+		} while (++j < nshards[i]);
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.query    = &query;
+	ctx.targets  = targets;
+	ctx.ntargets = ntargets;
+	MutexInit(&ctx.lock);
+
+	nworkers = nthreads ? nthreads : GetNumberOfProcessors();
+	if (nworkers > ntargets)
+		nworkers = ntargets;
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > SEARCH_MAX_THREADS)
+		nworkers = SEARCH_MAX_THREADS;
+
+	for (nstarted = 0; nstarted != nworkers; nstarted++) {
+		if (!ThreadCreate(&threads[nstarted], _SearchWorker, &ctx)) {
+			fprintf(stderr, "WARNING: only started %d of %d worker threads\n",
+				nstarted, nworkers);
+			break;
+		}
+	}
+	if (!nstarted)
+		fprintf(stderr, "ERROR: failed to start any worker threads\n");
+
+	for (i = 0; i != nstarted; i++)
+		ThreadJoin(threads[i]);
+
+	nmatched = 0;
+	for (i = 0; i != ntargets; i++) {
+		for (j = 0; j < targets[i].nmatches; j++) {
+			printf("%s\n", targets[i].matches[j]);
+			free(targets[i].matches[j]);
+			nmatched++;
+		}
+	}
+
+	if (verbose)
+		printf("Searched %d caches, %d matches\n", ntargets, nmatched);
+
+	MutexDestroy(&ctx.lock);
+	free(targets);
+	ThumbQueryFree(&query);
+
+	return nstarted != 0;
+}
+
+
+THREADPROC(_SearchWorker, arg) {
+	LPSEARCHCTX ctx = arg;
+	int i;
+
+	while (1) {
+		MutexLock(&ctx->lock);
+		i = ctx->next < ctx->ntargets ? ctx->next++ : -1;
+		MutexUnlock(&ctx->lock);
+
+		if (i == -1)
+			break;
+		_SearchCache(ctx, &ctx->targets[i]);
+	}
+
+	PROF_THREAD_END();
+	return 0;
+}
+
+
+void _SearchCache(LPSEARCHCTX ctx, LPSEARCHTARGET target) {
+	LPTCENTRY dupents[SEARCH_MAX_MATCHES];
+	unsigned int dupoffs[SEARCH_MAX_MATCHES];
+	char path[MAX_PATH], relfn[MAX_PATH];
+	THUMBCACHE cache;
+	int i, ndups, exists;
+
+	target->nmatches = -1;
+
+	if (target->shard == -1) {
+		if (!ThumbCacheInit(&cache, target->dir))
+			return;
+	} else {
+		if (!ShardCacheInit(&cache, target->dir, target->shard))
+			return;
+	}
+
+	cache.readonly = 1;
+
+	exists = _SearchCacheExists(&cache);
+	if (exists != 1) {
+		fprintf(stderr, "WARNING: %s thumb cache in %s, skipping\n",
+			exists ? "out of date" : "no", target->dir);
+		return;
+	}
+
+	//burst mode keeps the matched entries valid until the cache is closed
+	if (!ThumbCacheBurstReadBegin(&cache, 0)) {
+		fprintf(stderr, "WARNING: couldn't map thumb cache in %s, skipping\n", target->dir);
+		return;
+	}
+
+	//the query isn't an entry of any of these caches, so nothing to exclude
+	ndups = ThumbQueryMatches(&cache, ctx->query, 0, dupents, dupoffs, ARRAYLEN(dupents));
+	if (ndups == -1)
+		fprintf(stderr, "WARNING: failed to search thumb cache in %s\n", target->dir);
+
+	target->nmatches = 0;
+	for (i = 0; i < ndups; i++) {
+		if (!ThumbCacheEntryPath(&cache, dupents[i], relfn, sizeof(relfn)))
+			continue;
+		if (!_ThumbCachePath(path, sizeof(path), target->dir, relfn)) {
+			fprintf(stderr, "WARNING: path to %s in %s too long, dropping\n",
+				relfn, target->dir);
+			continue;
+		}
+		target->matches[target->nmatches] = strdup(path);
+		if (target->matches[target->nmatches])
+			target->nmatches++;
+	}
+
+	ThumbCacheClose(&cache);
+}
+
+
+//returns 0 for a directory with a single cache, or one whose manifest can't be read
+int _SearchCountShards(const char *dir) {
+	SHARDHEADER header;
+	char path[MAX_PATH];
+
+	if (!_ThumbCachePath(path, sizeof(path), dir, shard_manifest_fn))
+		return 0;
+	if (ShardReadManifest(path, &header) != 1)
+		return 0;
+
+	return header.nshards;
+}
+
+
+/*
+ * Opening a missing cache would create an empty one, which a search shouldn't do.
+ * Returns -1 for a cache written by another version, which can't be read until the
+ * directory is next updated.
+ */
+int _SearchCacheExists(LPTHUMBCACHE cache) {
+	TCHEADER tch;
+	FILE *file;
+	int status;
+
+	file = fopen(cache->cache_fn, "rb");
+	if (!file)
+		return 0;
+	status = fread(&tch, sizeof(TCHEADER), 1, file) == 1 && tch.signature == 'TMBC';
+	fclose(file);
+	if (!status)
+		return 0;
+	if (tch.version != TC_VERSION)
+		return -1;
+
+	file = fopen(cache->btree_fn, "rb");
+	if (!file)
+		return 0;
+	fclose(file);
+
+	file = fopen(cache->dirs_fn, "rb");
+	if (!file)
+		return 0;
+	fclose(file);
+
+	return 1;
+}
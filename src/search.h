@@ -0,0 +1,54 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCH_HEADER
+#define SEARCH_HEADER
+
+/////////// Compile-time configuration ////////////
+#define SEARCH_MAX_THREADS 64
+#define SEARCH_MAX_MATCHES 32 //per cache searched
+///////////////////////////////////////////////////
+
+typedef struct _searchtarget {
+	const char *dir;
+	int shard; //-1 if the directory's cache isn't sharded
+	int nmatches; //-1 if the cache couldn't be searched
+	char *matches[SEARCH_MAX_MATCHES];
+} SEARCHTARGET, *LPSEARCHTARGET;
+
+typedef struct _searchctx {
+	LPTHUMBQUERY query;
+	LPSEARCHTARGET targets;
+	int ntargets;
+	int next;
+	MUTEX lock;
+} SEARCHCTX, *LPSEARCHCTX;
+
+int SearchCachesPerform(const char *filename, char **dirs, int ndirs);
+
+int _SearchCountShards(const char *dir);
+
+void _SearchCache(LPSEARCHCTX ctx, LPSEARCHTARGET target);
+int _SearchCacheExists(LPTHUMBCACHE cache);
+
+#endif //SEARCH_HEADER
@@ -0,0 +1,542 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * shard.c - 
+ *    Splits a directory's thumb cache into independent shards that are updated
+ *    and searched in parallel
+ */
+
+#include "main.h"
+#include "stats.h"
+#include "vector.h"
+#include "hashtable.h"
+#include "mmfile.h"
+#include "bptree.h"
+#include "hashdb.h"
+#include "pathdict.h"
+#include "img.h"
+#include "hist.h"
+#include "lru.h"
+#include "thumb.h"
+#include "shard.h"
+
+char shard_manifest_fn[256] = "thumbshards.db";
+SHARDSET thumbshards;
+
+THREADPROC(_ShardWorker, arg);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * Sets up the cache of dir, or of the working directory if dir is NULL.  If dir has
+ * a shard manifest, the cache is sharded as it says; otherwise, it is split into
+ * nshards from here on if nshards is more than 1, and left as a single cache if not.
+ */
+int ShardSetOpen(LPSHARDSET set, const char *dir, unsigned int nshards) {
+	unsigned int i;
+	int status;
+
+	memset(set, 0, sizeof(SHARDSET));
+
+	if (!_ThumbCachePath(set->manifest_fn, sizeof(set->manifest_fn), dir, shard_manifest_fn)) {
+		fprintf(stderr, "ERROR: path to shard manifest in %s too long\n", dir);
+		return 0;
+	}
+
+	status = ShardReadManifest(set->manifest_fn, &set->header);
+	if (status == -1)
+		return 0;
+
+	if (status) {
+		if (nshards && nshards != set->header.nshards) {
+			fprintf(stderr, "WARNING: cache is already split into %u shards, "
+				"ignoring request for %u\n", set->header.nshards, nshards);
+		}
+		set->sharded = 1;
+	} else if (nshards > 1) {
+		if (nshards > SHARD_MAX_SHARDS) {
+			fprintf(stderr, "ERROR: too many shards (> %d)\n", SHARD_MAX_SHARDS);
+			return 0;
+		}
+
+		set->header.signature  = 'TMBS';
+		set->header.version    = SHARD_VERSION;
+		set->header.nshards    = nshards;
+		set->header.scheme     = SHARD_SCHEME_PATHHASH;
+		set->header.lastupdate = 0;
+		if (!_ShardWriteManifest(set))
+			return 0;
+
+		set->sharded = 1;
+	}
+
+	set->ncaches = set->sharded ? set->header.nshards : 1;
+	set->caches  = calloc(set->ncaches, sizeof(THUMBCACHE));
+	if (!set->caches) {
+		perror("calloc");
+		return 0;
+	}
+
+	for (i = 0; i != set->ncaches; i++) {
+		status = set->sharded ? ShardCacheInit(&set->caches[i], dir, i) :
+			ThumbCacheInit(&set->caches[i], dir);
+		if (!status) {
+			ShardSetClose(set);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+void ShardSetClose(LPSHARDSET set) {
+	unsigned int i;
+
+	if (!set->caches)
+		return;
+
+	for (i = 0; i != set->ncaches; i++)
+		ThumbCacheClose(&set->caches[i]);
+
+	free(set->caches);
+	set->caches  = NULL;
+	set->ncaches = 0;
+}
+
+
+int ShardCacheInit(LPTHUMBCACHE cache, const char *dir, unsigned int shard) {
+	if (!ThumbCacheInit(cache, dir))
+		return 0;
+
+	if (!_ShardFileName(cache->btree_fn, sizeof(cache->btree_fn), shard)   ||
+		!_ShardFileName(cache->cache_fn, sizeof(cache->cache_fn), shard)   ||
+		!_ShardFileName(cache->names_fn, sizeof(cache->names_fn), shard)   ||
+		!_ShardFileName(cache->hashes_fn, sizeof(cache->hashes_fn), shard) ||
+		!_ShardFileName(cache->pixels_fn, sizeof(cache->pixels_fn), shard) ||
+		!_ShardFileName(cache->dirs_fn, sizeof(cache->dirs_fn), shard)) {
+		fprintf(stderr, "ERROR: path to thumb cache shard %u too long\n", shard);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+//returns 0 if there is no manifest, -1 if there is one but it can't be used
+int ShardReadManifest(const char *filename, LPSHARDHEADER header) {
+	FILE *file;
+	int status;
+
+	file = fopen(filename, "rb");
+	if (!file) {
+		if (errno == ENOENT)
+			return 0;
+		perror("fopen rb");
+		return -1;
+	}
+
+	status = fread(header, sizeof(SHARDHEADER), 1, file) == 1;
+	fclose(file);
+
+	if (!status || header->signature != 'TMBS') {
+		fprintf(stderr, "ERROR: shard manifest signature does not match\n");
+		return -1;
+	}
+	if (header->version != SHARD_VERSION ||
+		header->scheme != SHARD_SCHEME_PATHHASH) {
+		fprintf(stderr, "ERROR: unsupported shard manifest version\n");
+		return -1;
+	}
+	if (!header->nshards || header->nshards > SHARD_MAX_SHARDS) {
+		fprintf(stderr, "ERROR: shard manifest has invalid shard count %u\n",
+			header->nshards);
+		return -1;
+	}
+
+	return 1;
+}
+
+
+/*
+ * Every file's place is fixed by its path, so the directory is scanned once and
+ * each shard then brings itself up to date with its share of the files.
+ */
+int ShardSetUpdate(LPSHARDSET set) {
+	time_t dirlastmod;
+	unsigned int i;
+	int nadded;
+
+	if (!set->sharded)
+		return ThumbCacheUpdate(&set->caches[0]);
+
+	if (verbose)
+		printf(" - Updating %u thumb cache shards\n", set->ncaches);
+
+	dirlastmod = GetLastWriteTime(".");
+	if (set->header.lastupdate >= dirlastmod && _ShardCachesCurrent(set)) {
+		if (set->header.lastupdate > dirlastmod) {
+			fprintf(stderr, "WARNING: shard manifest recorded last "
+				"mtime > directory last mtime\n");
+		}
+		if (verbose)
+			printf("Cache is up-to-date.\n");
+		return 1;
+	}
+
+	set->pending = calloc(set->ncaches, sizeof(LPVECTOR));
+	if (!set->pending) {
+		perror("calloc");
+		return 0;
+	}
+
+	ThumbScanDir("", _ShardCollect, set);
+	_ShardDispatch(set->ncaches, _ShardUpdate, set);
+
+	free(set->pending);
+	set->pending = NULL;
+
+	nadded = 0;
+	for (i = 0; i != set->ncaches; i++)
+		nadded += set->caches[i].nadded;
+	printf("Added %d entries successfully.\n", nadded);
+
+	set->header.lastupdate = dirlastmod;
+	return _ShardWriteManifest(set);
+}
+
+
+int ShardSetFlush(LPSHARDSET set) {
+	unsigned int i;
+
+	for (i = 0; i != set->ncaches; i++)
+		ThumbCacheFlush(&set->caches[i]);
+
+	if (set->sharded && remove(set->manifest_fn) == -1)
+		perror("remove shard_manifest_fn");
+
+	return 1;
+}
+
+
+void ShardSetEnumerate(LPSHARDSET set, int level) {
+	unsigned int i;
+
+	for (i = 0; i != set->ncaches; i++) {
+		if (set->sharded)
+			printf("Shard %u:\n", i);
+		ThumbCacheEnumerate(&set->caches[i], level);
+	}
+}
+
+
+int ShardSetBurstReadBegin(LPSHARDSET set) {
+	unsigned int i;
+
+	for (i = 0; i != set->ncaches; i++) {
+		if (!ThumbCacheBurstReadBegin(&set->caches[i], 0)) {
+			ShardSetBurstReadEnd(set);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+void ShardSetBurstReadEnd(LPSHARDSET set) {
+	unsigned int i;
+
+	for (i = 0; i != set->ncaches; i++)
+		ThumbCacheBurstReadEnd(&set->caches[i]);
+}
+
+
+/*
+ * Like ThumbFindMatches, but over every shard at once.  dupcaches[i] receives the
+ * shard dupents[i] came from, which dupoffs[i] is an offset into.  Matches are
+ * ordered by shard.
+ */
+int ShardFindMatches(LPSHARDSET set, const char *filename, LPTCENTRY *dupents,
+					 LPTHUMBCACHE *dupcaches, unsigned int *dupoffs, unsigned int nmaxdups) {
+	THUMBQUERY query;
+	SHARDFIND find;
+	LPTHUMBCACHE cache;
+	LPTCENTRY ptcent;
+	unsigned int i;
+	int j, ndups;
+
+	if (!set->sharded) {
+		ndups = ThumbFindMatches(&set->caches[0], filename, dupents, dupoffs, nmaxdups);
+		for (j = 0; j < ndups; j++)
+			dupcaches[j] = &set->caches[0];
+		return ndups;
+	}
+
+	if (!ThumbQueryInit(&query, filename)) {
+		fprintf(stderr, "WARNING: %s is not a recognized image, skipping\n", filename);
+		return 0;
+	}
+
+	find.set        = set;
+	find.query      = &query;
+	find.selfshard  = _ShardOf(set, filename);
+	find.selfoffset = ThumbQueryFindSelf(&set->caches[find.selfshard], &query);
+	find.nmaxdups   = nmaxdups;
+
+	//the shards share the query, so it must be complete before any of them sees it
+	if (!ThumbQueryDecode(&query)) {
+		fprintf(stderr, "ERROR: couldn't create thumbnail of %s\n", filename);
+		return -1;
+	}
+
+	find.dupents = alloca(set->ncaches * nmaxdups * sizeof(LPTCENTRY));
+	find.dupoffs = alloca(set->ncaches * nmaxdups * sizeof(unsigned int));
+	find.ndups   = alloca(set->ncaches * sizeof(int));
+
+	_ShardDispatch(set->ncaches, _ShardFind, &find);
+
+	ndups = 0;
+	for (i = 0; i != set->ncaches; i++) {
+		cache = &set->caches[i];
+		for (j = 0; j < find.ndups[i]; j++) {
+			ptcent = find.dupents[i * nmaxdups + j];
+			if (ndups == (int)nmaxdups) {
+				fprintf(stderr, "WARNING: too many matches (>= %d), "
+					"dropping others\n", nmaxdups);
+				if (!cache->burstmode)
+					free(ptcent);
+				continue;
+			}
+			dupents[ndups]   = ptcent;
+			dupcaches[ndups] = cache;
+			dupoffs[ndups]   = find.dupoffs[i * nmaxdups + j];
+			ndups++;
+		}
+	}
+
+	ThumbQueryFree(&query);
+	return ndups;
+}
+
+
+//the high bits of the hash, since the filename index already spreads on the low ones
+unsigned int _ShardOf(LPSHARDSET set, const char *filename) {
+	uint32_t hash;
+
+	hash = HtDefaultHash(filename, strlen(filename));
+	return (unsigned int)(((uint64_t)hash * set->ncaches) >> 32);
+}
+
+
+//turns e.g. thumbcache.db into thumbcache.3.db, in place
+int _ShardFileName(char *filename, size_t len, unsigned int shard) {
+	char suffix[16], *base, *ext;
+	size_t fnlen, sufflen;
+
+	base = strrchr(filename, PATH_SEPARATOR);
+	base = base ? base + 1 : filename;
+	ext  = strrchr(base, '.');
+
+	fnlen = strlen(filename);
+	if (!ext)
+		ext = filename + fnlen;
+
+	sufflen = snprintf(suffix, sizeof(suffix), ".%u", shard);
+	if (fnlen + sufflen >= len)
+		return 0;
+
+	memmove(ext + sufflen, ext, fnlen - (ext - filename) + 1);
+	memcpy(ext, suffix, sufflen);
+
+	return 1;
+}
+
+
+int _ShardWriteManifest(LPSHARDSET set) {
+	FILE *file;
+	int status;
+
+	file = fopen(set->manifest_fn, "wb");
+	if (!file) {
+		perror("fopen wb");
+		return 0;
+	}
+
+	status = fwrite(&set->header, sizeof(SHARDHEADER), 1, file) == 1;
+	if (fclose(file) == EOF)
+		status = 0;
+
+	if (!status)
+		fprintf(stderr, "ERROR: failed to write shard manifest\n");
+	return status;
+}
+
+
+/*
+ * An unchanged directory needs no scan unless a shard was written by another version
+ * of the cache format, which only a scan can rebuild.
+ */
+int _ShardCachesCurrent(LPSHARDSET set) {
+	TCHEADER tch;
+	unsigned int i;
+	int status;
+	FILE *file;
+
+	for (i = 0; i != set->ncaches; i++) {
+		file = fopen(set->caches[i].cache_fn, "rb");
+		if (!file)
+			return 0;
+		status = fread(&tch, sizeof(TCHEADER), 1, file) == 1 && tch.version == TC_VERSION;
+		fclose(file);
+		if (!status)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+void _ShardCollect(void *arg, const char *relfn, time_t mtime) {
+	LPSHARDSET set = arg;
+	LPSHARDFILE file;
+	unsigned int shard;
+	size_t len;
+
+	len  = strlen(relfn);
+	file = malloc(sizeof(SHARDFILE) + len + 1);
+	if (!file) {
+		perror("malloc");
+		return;
+	}
+	file->mtime = mtime;
+	memcpy(file->filename, relfn, len + 1);
+
+	shard = _ShardOf(set, relfn);
+	set->pending[shard] = VectorAdd(set->pending[shard], file);
+}
+
+
+void _ShardUpdate(void *arg, unsigned int shard) {
+	LPSHARDSET set = arg;
+	LPTHUMBCACHE cache;
+	LPSHARDFILE file;
+	LPVECTOR files;
+	TCHEADER tch;
+	unsigned int i;
+	FILE *tc;
+
+	cache = &set->caches[shard];
+	files = set->pending[shard];
+
+	//opened even with nothing to add, so every shard has all of its files
+	tc = _ThumbCacheOpenData(cache, &tch);
+	if (tc) {
+		if (!cache->bpt)
+			cache->bpt = BptOpen(cache->btree_fn);
+		if (cache->bpt && _ThumbCacheNamesOpen(cache)) {
+			for (i = 0; files && i != files->numelem; i++) {
+				file = files->elem[i];
+				_ThumbCacheUpdateFile(cache, tc, file->filename, file->mtime);
+			}
+		}
+		ThumbCacheCommit(cache, tc);
+		fclose(tc);
+	}
+
+	VectorDelete(files);
+	set->pending[shard] = NULL;
+}
+
+
+void _ShardFind(void *arg, unsigned int shard) {
+	LPSHARDFIND find = arg;
+
+	find->ndups[shard] = ThumbQueryMatches(&find->set->caches[shard], find->query,
+		shard == find->selfshard ? find->selfoffset : 0,
+		find->dupents + shard * find->nmaxdups,
+		find->dupoffs + shard * find->nmaxdups, find->nmaxdups);
+}
+
+
+/*
+ * Runs proc once for each shard, spread over as many threads as allowed.  Each
+ * shard is only ever handled by one thread, so proc needs no locking of its own.
+ */
+void _ShardDispatch(unsigned int nshards, LPSHARDPROC proc, void *arg) {
+	THREAD threads[SHARD_MAX_SHARDS];
+	SHARDDISPATCH dispatch;
+	int i, nworkers, nstarted;
+
+	nworkers = nthreads ? nthreads : GetNumberOfProcessors();
+	if (nworkers > (int)nshards)
+		nworkers = nshards;
+
+	if (nworkers <= 1) {
+		for (i = 0; i != (int)nshards; i++)
+			proc(arg, i);
+		return;
+	}
+
+	dispatch.proc    = proc;
+	dispatch.arg     = arg;
+	dispatch.nshards = nshards;
+	dispatch.next    = 0;
+	MutexInit(&dispatch.lock);
+
+	//this thread is one of the workers
+	for (nstarted = 0; nstarted != nworkers - 1; nstarted++) {
+		if (!ThreadCreate(&threads[nstarted], _ShardWorker, &dispatch))
+			break;
+	}
+	_ShardWorker(&dispatch);
+
+	for (i = 0; i != nstarted; i++)
+		ThreadJoin(threads[i]);
+
+	MutexDestroy(&dispatch.lock);
+}
+
+
+THREADPROC(_ShardWorker, arg) {
+	LPSHARDDISPATCH dispatch = arg;
+	unsigned int shard;
+
+	while (1) {
+		MutexLock(&dispatch->lock);
+		shard = dispatch->next;
+		if (shard != dispatch->nshards)
+			dispatch->next++;
+		MutexUnlock(&dispatch->lock);
+
+		if (shard == dispatch->nshards)
+			break;
+		dispatch->proc(dispatch->arg, shard);
+	}
+
+	PROF_THREAD_END();
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHARD_HEADER
+#define SHARD_HEADER
+
+/////////// Compile-time configuration ////////////
+#define SHARD_MAX_SHARDS 256
+///////////////////////////////////////////////////
+
+/*
+ * Shard Manifest File Format:
+ *
+ * [UINT32] 'TMBS' signature
+ * [UINT32] format version
+ * [UINT32] number of shards
+ * [UINT32] how entries are assigned to shards, one of SHARD_SCHEME_*
+ * [time_t] timestamp of directory's recorded last update
+ *
+ * Shard n keeps a complete set of cache files of its own, named like the unsharded
+ * ones with n inserted before the extension, e.g. thumbcache.3.db.
+ */
+
+#define SHARD_VERSION 1
+
+#define SHARD_SCHEME_PATHHASH 0
+
+typedef struct _shardheader {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nshards;
+	uint32_t scheme;
+	time_t lastupdate;
+} SHARDHEADER, *LPSHARDHEADER;
+
+typedef struct _shardset {
+	char manifest_fn[256];
+	SHARDHEADER header;
+	int sharded; //if not, caches[0] is the directory's ordinary cache
+	unsigned int ncaches;
+	LPTHUMBCACHE caches;
+	LPVECTOR *pending; //files found by an update, by shard, until each shard is updated
+} SHARDSET, *LPSHARDSET;
+
+typedef struct _shardfile {
+	time_t mtime;
+	char filename[0];
+} SHARDFILE, *LPSHARDFILE;
+
+typedef struct _shardfind {
+	LPSHARDSET set;
+	LPTHUMBQUERY query;
+	unsigned int selfshard;
+	unsigned int selfoffset;
+	unsigned int nmaxdups;
+	LPTCENTRY *dupents; //nmaxdups for each shard
+	unsigned int *dupoffs;
+	int *ndups;
+} SHARDFIND, *LPSHARDFIND;
+
+typedef void (*LPSHARDPROC)(void *arg, unsigned int shard);
+
+typedef struct _sharddispatch {
+	LPSHARDPROC proc;
+	void *arg;
+	unsigned int nshards;
+	unsigned int next;
+	MUTEX lock;
+} SHARDDISPATCH, *LPSHARDDISPATCH;
+
+extern char shard_manifest_fn[256];
+extern SHARDSET thumbshards;
+
+int ShardSetOpen(LPSHARDSET set, const char *dir, unsigned int nshards);
+void ShardSetClose(LPSHARDSET set);
+int ShardCacheInit(LPTHUMBCACHE cache, const char *dir, unsigned int shard);
+int ShardReadManifest(const char *dir, LPSHARDHEADER header);
+
+int ShardSetUpdate(LPSHARDSET set);
+int ShardSetFlush(LPSHARDSET set);
+void ShardSetEnumerate(LPSHARDSET set, int level);
+int ShardSetBurstReadBegin(LPSHARDSET set);
+void ShardSetBurstReadEnd(LPSHARDSET set);
+int ShardFindMatches(LPSHARDSET set, const char *filename, LPTCENTRY *dupents,
+					 LPTHUMBCACHE *dupcaches, unsigned int *dupoffs, unsigned int nmaxdups);
+
+unsigned int _ShardOf(LPSHARDSET set, const char *filename);
+int _ShardFileName(char *filename, size_t len, unsigned int shard);
+int _ShardWriteManifest(LPSHARDSET set);
+int _ShardCachesCurrent(LPSHARDSET set);
+void _ShardCollect(void *arg, const char *relfn, time_t mtime);
+void _ShardUpdate(void *arg, unsigned int shard);
+void _ShardFind(void *arg, unsigned int shard);
+void _ShardDispatch(unsigned int nshards, LPSHARDPROC proc, void *arg);
+
+#endif //SHARD_HEADER
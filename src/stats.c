@@ -0,0 +1,432 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * stats.c - 
+ *    Per-stage call counts and monotonic-clock timings, reported on exit
+ */
+
+#include "main.h"
+#include "stats.h"
+
+STATCOUNTER stat_counters[NSTATS];
+QUERYSTATS query_stats;
+
+const char *stat_names[NSTATS] = {
+	"decode",
+	"resample",
+	"png_encode",
+	"bpt_insert",
+	"bpt_search",
+	"cache_get",
+	"compare",
+	"rename",
+	"dir_scan",
+	"cache_write"
+};
+
+int stats_stderr;
+FILE *stats_json;
+uint64_t stats_start;
+
+FILE *stats_trace;
+MUTEX trace_lock;
+LPTRACEBUF trace_bufs;
+int trace_nthreads;
+uint64_t trace_nwritten;
+THREADLOCAL LPTRACEBUF trace_buf;
+
+void _StatsExit();
+LPTRACEBUF _StatsTraceBufNew();
+void _StatsTraceFlush(LPTRACEBUF buf);
+int _StatsBucket(int n);
+void _StatsBucketName(int bucket, char *buf, size_t len);
+void _StatsReportQueries(FILE *file);
+void _StatsDumpHistogram(FILE *file, const char *name, const uint64_t *hist, int last);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * Starts the clock for the run and has the report printed to stderr with print, and
+ * the counters dumped to jsonfn if given, when the program exits.  With tracefn, every
+ * timed stage is also written there as an event of the thread that ran it, in the
+ * Chrome trace format that chrome://tracing and Perfetto open.  The files are created
+ * right away, so relative names are relative to the starting directory.
+ */
+int StatsInit(int print, const char *jsonfn, const char *tracefn) {
+#ifdef ENABLE_STATS
+	if (jsonfn) {
+		stats_json = fopen(jsonfn, "w");
+		if (!stats_json) {
+			perror("fopen");
+			return 0;
+		}
+	}
+
+	if (tracefn) {
+		stats_trace = fopen(tracefn, "w");
+		if (!stats_trace) {
+			perror("fopen");
+			return 0;
+		}
+		fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", stats_trace);
+		MutexInit(&trace_lock);
+
+		//so the main thread is always tid 0
+		if (!_StatsTraceBufNew())
+			return 0;
+	}
+
+	stats_stderr = print;
+	stats_start = StatsNow();
+	if (atexit(_StatsExit)) {
+		fprintf(stderr, "ERROR: failed to register stats report\n");
+		return 0;
+	}
+#else
+	fprintf(stderr, "WARNING: built without ENABLE_STATS, no stats are kept\n");
+#endif
+
+	return 1;
+}
+
+
+uint64_t StatsNow() {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 +
+		(uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+void StatsEnd(LPPROFTIMER timer, int stage, uint64_t nitems) {
+	uint64_t now;
+
+	now = StatsNow();
+	StatsRecord(stage, now - timer->start - timer->paused, nitems);
+	if (stats_trace)
+		StatsTrace(stage, timer->start, now - timer->start);
+}
+
+
+//stages run on the worker threads too, so the counters are only ever added to atomically
+void StatsRecord(int stage, uint64_t ns, uint64_t nitems) {
+	LPSTATCOUNTER counter = &stat_counters[stage];
+
+	AtomicAdd64(&counter->calls, 1);
+	AtomicAdd64(&counter->items, nitems);
+	AtomicAdd64(&counter->ns, ns);
+}
+
+
+void StatsRecordQuery(LPQUERYSAMPLE sample) {
+	AtomicAdd64(&query_stats.queries, 1);
+	AtomicAdd64(&query_stats.identical, sample->identical);
+	AtomicAdd64(&query_stats.candidates, sample->candidates);
+	AtomicAdd64(&query_stats.live, sample->live);
+	AtomicAdd64(&query_stats.shaped, sample->shaped);
+	AtomicAdd64(&query_stats.decoded, sample->decoded);
+	AtomicAdd64(&query_stats.compared, sample->compared);
+	AtomicAdd64(&query_stats.matches, sample->matches);
+
+	AtomicAdd64(&query_stats.candhist[_StatsBucket(sample->candidates)], 1);
+	AtomicAdd64(&query_stats.decodehist[_StatsBucket(sample->decoded)], 1);
+	AtomicAdd64(&query_stats.matchhist[_StatsBucket(sample->matches)], 1);
+}
+
+
+void StatsTrace(int stage, uint64_t start, uint64_t duration) {
+	LPTRACEEVENT event;
+	LPTRACEBUF buf;
+
+	buf = trace_buf;
+	if (!buf) {
+		buf = _StatsTraceBufNew();
+		if (!buf)
+			return;
+	}
+	if (buf->nevents == STATS_TRACE_BUF_EVENTS)
+		_StatsTraceFlush(buf);
+
+	event = &buf->events[buf->nevents++];
+	event->start    = start;
+	event->duration = duration;
+	event->stage    = stage;
+}
+
+
+void StatsReport(FILE *file) {
+	uint64_t elapsed;
+	int i;
+
+	elapsed = StatsNow() - stats_start;
+
+	fprintf(file, "%-12s %10s %12s %12s %12s %8s\n",
+		"stage", "calls", "items", "total ms", "us/call", "% run");
+	for (i = 0; i != NSTATS; i++) {
+		fprintf(file, "%-12s %10llu %12llu %12.3f %12.3f %8.2f\n", stat_names[i],
+			(unsigned long long)stat_counters[i].calls,
+			(unsigned long long)stat_counters[i].items,
+			stat_counters[i].ns / 1e6,
+			stat_counters[i].calls ? stat_counters[i].ns / 1e3 / stat_counters[i].calls : 0.0,
+			elapsed ? stat_counters[i].ns * 100.0 / elapsed : 0.0);
+	}
+	fprintf(file, "run: %.3f ms; time on worker threads can add up to more than this\n",
+		elapsed / 1e6);
+
+	if (query_stats.queries)
+		_StatsReportQueries(file);
+}
+
+
+void StatsDumpJson(FILE *file) {
+	int i;
+
+	fprintf(file, "{\n\t\"run_ns\": %llu,\n\t\"stages\": {\n",
+		(unsigned long long)(StatsNow() - stats_start));
+
+	for (i = 0; i != NSTATS; i++) {
+		fprintf(file, "\t\t\"%s\": {\"calls\": %llu, \"items\": %llu, \"ns\": %llu}%s\n",
+			stat_names[i], (unsigned long long)stat_counters[i].calls,
+			(unsigned long long)stat_counters[i].items,
+			(unsigned long long)stat_counters[i].ns, i + 1 != NSTATS ? "," : "");
+	}
+
+	fprintf(file, "\t},\n\t\"queries\": {\"queries\": %llu, \"identical\": %llu, "
+		"\"candidates\": %llu, \"live\": %llu, \"shaped\": %llu, \"decoded\": %llu, "
+		"\"compared\": %llu, \"matches\": %llu, \"aspect_rejects\": %llu, "
+		"\"early_exits\": %llu, \"thumb_hits\": %llu, \"thumb_misses\": %llu,\n",
+		(unsigned long long)query_stats.queries, (unsigned long long)query_stats.identical,
+		(unsigned long long)query_stats.candidates, (unsigned long long)query_stats.live,
+		(unsigned long long)query_stats.shaped, (unsigned long long)query_stats.decoded,
+		(unsigned long long)query_stats.compared, (unsigned long long)query_stats.matches,
+		(unsigned long long)query_stats.aspectrejects,
+		(unsigned long long)query_stats.earlyexits,
+		(unsigned long long)query_stats.thumbhits,
+		(unsigned long long)query_stats.thumbmisses);
+
+	//bucket i > 0 holds sizes from 2^(i - 1) up to 2^i - 1
+	_StatsDumpHistogram(file, "candidates_hist", query_stats.candhist, 0);
+	_StatsDumpHistogram(file, "decoded_hist", query_stats.decodehist, 0);
+	_StatsDumpHistogram(file, "matches_hist", query_stats.matchhist, 1);
+
+	fprintf(file, "\t}\n}\n");
+}
+
+
+void _StatsDumpHistogram(FILE *file, const char *name, const uint64_t *hist, int last) {
+	int i;
+
+	fprintf(file, "\t\t\"%s\": [", name);
+	for (i = 0; i != STATS_NBUCKETS; i++)
+		fprintf(file, "%llu%s", (unsigned long long)hist[i], i + 1 != STATS_NBUCKETS ? ", " : "");
+	fprintf(file, "]%s\n", last ? "" : ",");
+}
+
+
+void _StatsReportQueries(FILE *file) {
+	uint64_t nqueries;
+	char range[32];
+	int i;
+
+	nqueries = query_stats.queries;
+
+	fprintf(file, "\nqueries: %llu, %llu matches found by hash\n",
+		(unsigned long long)query_stats.queries, (unsigned long long)query_stats.identical);
+	if (!nqueries)
+		return;
+
+	fprintf(file, "per query: %.1f candidates, %.1f live, %.1f shaped, "
+		"%.1f decoded, %.1f compared, %.2f matches\n",
+		(double)query_stats.candidates / nqueries, (double)query_stats.live / nqueries,
+		(double)query_stats.shaped / nqueries, (double)query_stats.decoded / nqueries,
+		(double)query_stats.compared / nqueries, (double)query_stats.matches / nqueries);
+	fprintf(file, "comparisons: %llu, %.2f%% matched, %llu turned down on shape, "
+		"%llu cut short at MAX_PIXELDIFF\n",
+		(unsigned long long)query_stats.compared,
+		query_stats.compared ? query_stats.matches * 100.0 / query_stats.compared : 0.0,
+		(unsigned long long)query_stats.aspectrejects,
+		(unsigned long long)query_stats.earlyexits);
+	if (query_stats.thumbhits + query_stats.thumbmisses) {
+		fprintf(file, "decoded thumbs: %llu reused, %llu decoded, %.2f%% hit rate\n",
+			(unsigned long long)query_stats.thumbhits,
+			(unsigned long long)query_stats.thumbmisses,
+			query_stats.thumbhits * 100.0 / (query_stats.thumbhits + query_stats.thumbmisses));
+	}
+
+	fprintf(file, "%-12s %12s %12s %12s\n", "per query", "candidates", "decoded", "matches");
+	for (i = 0; i != STATS_NBUCKETS; i++) {
+		if (!query_stats.candhist[i] && !query_stats.decodehist[i] && !query_stats.matchhist[i])
+			continue;
+		_StatsBucketName(i, range, sizeof(range));
+		fprintf(file, "%-12s %12llu %12llu %12llu\n", range,
+			(unsigned long long)query_stats.candhist[i],
+			(unsigned long long)query_stats.decodehist[i],
+			(unsigned long long)query_stats.matchhist[i]);
+	}
+}
+
+
+int _StatsBucket(int n) {
+	int bucket;
+
+	for (bucket = 0; n > 0 && bucket != STATS_NBUCKETS - 1; bucket++)
+		n >>= 1;
+
+	return bucket;
+}
+
+
+void _StatsBucketName(int bucket, char *buf, size_t len) {
+	if (bucket < 2)
+		snprintf(buf, len, "%d", bucket);
+	else if (bucket == STATS_NBUCKETS - 1)
+		snprintf(buf, len, "%d+", 1 << (bucket - 1));
+	else
+		snprintf(buf, len, "%d-%d", 1 << (bucket - 1), (1 << bucket) - 1);
+}
+
+
+/*
+ * Gives the calling thread a buffer left by a thread that has exited, or else a new
+ * one under the next tid.  Threads are started per batch of work, so reusing them
+ * keeps both the memory and the rows of the timeline down to the most threads that
+ * ever ran at once.
+ */
+LPTRACEBUF _StatsTraceBufNew() {
+	LPTRACEBUF buf;
+
+	MutexLock(&trace_lock);
+	for (buf = trace_bufs; buf && buf->inuse; buf = buf->next);
+	if (buf) {
+		buf->inuse = 1;
+		MutexUnlock(&trace_lock);
+		trace_buf = buf;
+		return buf;
+	}
+	MutexUnlock(&trace_lock);
+
+	buf = malloc(sizeof(TRACEBUF));
+	if (!buf)
+		return NULL;
+	buf->inuse   = 1;
+	buf->nevents = 0;
+
+	MutexLock(&trace_lock);
+	buf->tid   = trace_nthreads++;
+	buf->next  = trace_bufs;
+	trace_bufs = buf;
+
+	fprintf(stats_trace, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+		"\"tid\": %d, \"args\": {\"name\": \"%s %d\"}}", trace_nwritten ? ",\n" : "",
+		buf->tid, buf->tid ? "worker" : "main", buf->tid);
+	trace_nwritten++;
+	MutexUnlock(&trace_lock);
+
+	trace_buf = buf;
+	return buf;
+}
+
+
+//the main thread, which also takes part in dispatching work, keeps its buffer
+void StatsThreadEnd() {
+	LPTRACEBUF buf;
+
+	buf = trace_buf;
+	if (!buf || !buf->tid)
+		return;
+
+	_StatsTraceFlush(buf);
+
+	MutexLock(&trace_lock);
+	buf->inuse = 0;
+	MutexUnlock(&trace_lock);
+
+	trace_buf = NULL;
+}
+
+
+//timestamps are in us from the start of the run, as the format wants
+void _StatsTraceFlush(LPTRACEBUF buf) {
+	LPTRACEEVENT event;
+	int i;
+
+	MutexLock(&trace_lock);
+	for (i = 0; i != buf->nevents; i++) {
+		event = &buf->events[i];
+		fprintf(stats_trace, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+			"\"ts\": %.3f, \"dur\": %.3f}", trace_nwritten ? ",\n" : "",
+			stat_names[event->stage], buf->tid,
+			(event->start - stats_start) / 1e3, event->duration / 1e3);
+		trace_nwritten++;
+	}
+	MutexUnlock(&trace_lock);
+
+	buf->nevents = 0;
+}
+
+
+//the worker threads are all joined by now, so their buffers can be emptied here
+void _StatsExit() {
+	LPTRACEBUF buf;
+
+	if (stats_stderr)
+		StatsReport(stderr);
+
+	if (stats_json) {
+		StatsDumpJson(stats_json);
+		if (fclose(stats_json) == EOF)
+			perror("fclose");
+		stats_json = NULL;
+	}
+
+	if (stats_trace) {
+		while (trace_bufs) {
+			buf = trace_bufs;
+			_StatsTraceFlush(buf);
+			trace_bufs = buf->next;
+			free(buf);
+		}
+		trace_buf = NULL;
+
+		fputs("\n]}\n", stats_trace);
+		if (fclose(stats_trace) == EOF)
+			perror("fclose");
+		stats_trace = NULL;
+		MutexDestroy(&trace_lock);
+	}
+}
@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATS_HEADER
+#define STATS_HEADER
+
+/////////// Compile-time configuration ////////////
+//#define ENABLE_STATS //or build with `make stats`
+#define STATS_TRACE_BUF_EVENTS 4096 //trace events each thread holds before writing them out
+///////////////////////////////////////////////////
+
+#define STAT_DECODE      0 //ImgLoadGdScaled, items are bytes read
+#define STAT_RESAMPLE    1 //gdImageCopyResampled
+#define STAT_PNG_ENCODE  2 //gdImagePngPtr, items are bytes written
+#define STAT_BPT_INSERT  3
+#define STAT_BPT_SEARCH  4 //BptSearchRange, items are keys found
+#define STAT_CACHE_GET   5 //ThumbCacheGet, items are thumbs asked for
+#define STAT_COMPARE     6 //ImgCompareFuzzy, including its own resampling
+#define STAT_RENAME      7
+#define STAT_DIR_SCAN    8 //ThumbScanDir less its visits and subdirectories, items are images
+#define STAT_CACHE_WRITE 9 //entries written and committed to the thumb cache, items are bytes
+#define NSTATS           10
+
+#define STATS_NBUCKETS   18 //per-query sizes by powers of 2: 0, 1, 2-3, 4-7, ... 65536 and up
+
+typedef struct _statcounter {
+	uint64_t calls;
+	uint64_t items;
+	uint64_t ns;
+} STATCOUNTER, *LPSTATCOUNTER;
+
+typedef struct _proftimer {
+	uint64_t start;
+	uint64_t paused;   //total time left out with PROF_PAUSE
+	uint64_t pausedat;
+} PROFTIMER, *LPPROFTIMER;
+
+typedef struct _traceevent {
+	uint64_t start;
+	uint64_t duration;
+	int stage;
+} TRACEEVENT, *LPTRACEEVENT;
+
+//each thread fills its own, so only writing them out takes the lock; a thread that
+//exits hands its buffer, and with it its tid, to the next thread started
+typedef struct _tracebuf {
+	struct _tracebuf *next;
+	int tid;
+	int inuse;
+	int nevents;
+	TRACEEVENT events[STATS_TRACE_BUF_EVENTS];
+} TRACEBUF, *LPTRACEBUF;
+
+//what happened to the candidates of one ThumbQueryMatches
+typedef struct _querysample {
+	int identical;   //matches found by content or pixel hash, counted in matches too
+	int candidates;  //entries in the key window around the query
+	int live;        //of those, not deleted
+	int shaped;      //and with an aspect ratio close enough
+	int decoded;     //thumbs read and decoded from the cache
+	int compared;
+	int matches;
+} QUERYSAMPLE, *LPQUERYSAMPLE;
+
+typedef struct _querystats {
+	uint64_t queries;
+	uint64_t identical;
+	uint64_t candidates;
+	uint64_t live;
+	uint64_t shaped;
+	uint64_t decoded;
+	uint64_t compared;
+	uint64_t matches;
+	uint64_t candhist[STATS_NBUCKETS];
+	uint64_t decodehist[STATS_NBUCKETS];
+	uint64_t matchhist[STATS_NBUCKETS];
+	uint64_t aspectrejects; //ImgCompareFuzzy calls turned down on shape alone
+	uint64_t earlyexits;    //and those cut short at MAX_PIXELDIFF
+	uint64_t thumbhits;     //thumbs found already decoded, see THUMB_LRU_SIZE
+	uint64_t thumbmisses;
+} QUERYSTATS, *LPQUERYSTATS;
+
+/*
+ * PROF_DECL(t) declares a timer and goes last among the locals, PROF_BEGIN(t) starts
+ * it and PROF_END(t, stage, nitems) adds one call to the stage's counter, and an event
+ * to the trace if one is being written.  PROF_PAUSE and PROF_RESUME leave out the time
+ * in between from the counter, such as that of nested stages; the trace event still
+ * spans all of it.  PROF_COUNT(field) counts an event in query_stats, and
+ * PROF_QUERY(sample) adds a finished query.  PROF_THREAD_END() goes last in a worker
+ * thread, so the next thread started reuses its trace buffer.  Without ENABLE_STATS
+ * they all compile to nothing.
+ */
+#ifdef ENABLE_STATS
+#	define PROF_DECL(t) PROFTIMER t
+#	define PROF_BEGIN(t) ((t).start = StatsNow(), (t).paused = 0)
+#	define PROF_PAUSE(t) ((t).pausedat = StatsNow())
+#	define PROF_RESUME(t) ((t).paused += StatsNow() - (t).pausedat)
+#	define PROF_END(t, stage, nitems) StatsEnd(&(t), (stage), (nitems))
+#	define PROF_COUNT(field) AtomicAdd64(&query_stats.field, 1)
+#	define PROF_QUERY(sample) StatsRecordQuery(sample)
+#	define PROF_THREAD_END() StatsThreadEnd()
+#else
+#	define PROF_DECL(t)
+#	define PROF_BEGIN(t) ((void)0)
+#	define PROF_PAUSE(t) ((void)0)
+#	define PROF_RESUME(t) ((void)0)
+#	define PROF_END(t, stage, nitems) ((void)(nitems))
+#	define PROF_COUNT(field) ((void)0)
+#	define PROF_QUERY(sample) ((void)0)
+#	define PROF_THREAD_END() ((void)0)
+#endif
+
+extern STATCOUNTER stat_counters[NSTATS];
+extern const char *stat_names[NSTATS];
+extern QUERYSTATS query_stats;
+
+int StatsInit(int print, const char *jsonfn, const char *tracefn);
+uint64_t StatsNow();
+void StatsEnd(LPPROFTIMER timer, int stage, uint64_t nitems);
+void StatsRecord(int stage, uint64_t ns, uint64_t nitems);
+void StatsTrace(int stage, uint64_t start, uint64_t duration);
+void StatsThreadEnd();
+void StatsRecordQuery(LPQUERYSAMPLE sample);
+void StatsReport(FILE *file);
+void StatsDumpJson(FILE *file);
+
+#endif //STATS_HEADER
@@ -1,231 +1,1818 @@
-/*-
- * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#include "main.h"
-#include "vector.h"
-#include "hashtable.h"
-#include "mmfile.h"
-#include "bptree.h"
-
-#define NITERS 10000
-#define TEST_DATA_FILE "testdata.bin"
-#define TEST_DB_FILE   "test.db"
-
-
-///////////////////////////////////////////////////////////////////////////////
-
-
-#ifdef _WIN32
-
-typedef LARGE_INTEGER TIMEVAL;
-
-
-void TimeGetTimePrecise(TIMEVAL *ptv) {
-	QueryPerformanceCounter(ptv);
-}
-
-
-uint32_t TimeDiffPrecise(TIMEVAL *ptv1) {
-	LARGE_INTEGER freq;
-	TIMEVAL tv2, *ptv2 = &tv2;
-
-	QueryPerfomanceCounter(tv2);
-	QueryPerformanceFrequency(&freq);
-	return (ptv2->QuadPart - ptv1->QuadPart) * 1000000 / pfreq.QuadPart;
-}
-
-#else
-
-typedef struct timeval TIMEVAL;
-
-
-void TimeGetTimePrecise(TIMEVAL *ptv) {
-	gettimeofday(ptv, NULL);
-}
-
-
-uint32_t TimeDiffPrecise(TIMEVAL *ptv1) {
-	TIMEVAL tv2, *ptv2 = &tv2;
-
-	gettimeofday(ptv2, NULL);
-	return ((ptv2->tv_sec - ptv1->tv_sec) * 1000000) +
-			(ptv2->tv_usec - ptv1->tv_usec);
-}
-
-#endif
-
-
-void TestGenerateData() {
-	KVPAIR kvp;
-	FILE *file;
-	int i;
-
-	srand(time(NULL));
-	
-	file = fopen(TEST_DATA_FILE, "wb");
-	if (!file) {
-		fprintf(stderr, "ERROR: TestGenerateData: failed to create test file\n");
-		return;
-	}
-
-	for (i = 0; i != NITERS; i++) {
-		kvp.key = (float)(rand() & 0xFFFFFFF);
-		kvp.val = (unsigned int)(rand() & 0xFFFFFF); 
-		fwrite(&kvp, sizeof(kvp), 1, file);
-	}
-	
-	fclose(file);
-}
-
-
-int KVPCompare(const void *item1, const void *item2) {
-	return (int)(((LPKVPAIR)item2)->key - ((LPKVPAIR)item1)->key);
-}
-
-
-void TestBPTree() {
-	TIMEVAL tv;
-	KVPAIR testset[NITERS], kvp;
-	LPKVPAIR matches;
-	LPBPTREE bpt;
-	float key;
-	unsigned int val;
-	int i, result, nparts, rcount, entriesleft;
-	FILE *file;
-
-	file = fopen(TEST_DATA_FILE, "rb");
-	if (!file) {
-		fprintf(stderr, "ERROR: TestBPTree: failed to open test file\n");
-		return;
-	}
-	if (!fread(testset, sizeof(testset), 1, file)) {
-		fprintf(stderr, "ERROR: TestBPTree: failed to read from test file\n");
-		return;
-	}
-	fclose(file);
-	
-	bpt = BptOpen(TEST_DB_FILE);
-	if (!bpt) {
-		fprintf(stderr, "test: failed to open tree\n");
-		return;
-	}
-	
-	///////////////////////////////////////////////////////////////////////////  INSERTION
-	TimeGetTimePrecise(&tv);
-	for (i = 0; i != NITERS; i++) {
-		key = testset[i].key;
-		val = testset[i].val;
-		if (!BptInsert(bpt, key, val)) {
-			fprintf(stderr, "test: insert failed (%f, %d)\n", key, val);
-			return;
-		}
-	}
-	printf("inserted %d items, %dus\n", NITERS, TimeDiffPrecise(&tv));
-	///////////////////////////////////////////////////////////////////////////
-
-	/////////////////////////////////////////////////////////////////////////// SEARCH
-	TimeGetTimePrecise(&tv);
-	for (i = 0; i != NITERS; i++) {
-		key = testset[i].key;
-		result = BptSearch(bpt, key, &val);
-		if (!result) {
-			fprintf(stderr, "test: item not found (%f)\n", key);
-			return;
-		}
-		if (result == BT_ERROR) {
-			fprintf(stderr, "test: search failed (%f)\n", key);
-			return;
-		}
-		if (val != testset[i].val) {
-			fprintf(stderr, "test: search returned invalid result "
-				"(%f, expected: %d, actual: %d)\n", key, testset[i].val, val);
-			return;
-		}
-	}
-	printf("searched for %d items, %dus\n", NITERS, TimeDiffPrecise(&tv));
-	///////////////////////////////////////////////////////////////////////////
-
-	qsort(testset, NITERS, sizeof(testset[0]), KVPCompare);
-	printf(" min item: %f, max item: %f\n", testset[0].key, testset[NITERS - 1].key);
-	
-	BptGetMin(bpt, &kvp);
-	if (kvp.key != testset[0].key) {
-		fprintf(stderr, "test: invalid minimum key\n");
-		return;
-	}
-
-	BptGetMax(bpt, &kvp);
-	if (kvp.key != testset[NITERS - 1].key) {
-		fprintf(stderr, "test: invalid maximum key\n");
-		return;
-	}
-
-	/////////////////////////////////////////////////////////////////////////// SEARCH RANGE
-	TimeGetTimePrecise(&tv);
-
-	i = nparts = 0;
-	entriesleft = NITERS;
-	printf("checking ranges of size: ");
-	while (entriesleft) {
-		int j;
-
-		rcount = (rand() & 0x1F) + 1;
-		if (rcount > entriesleft)
-			rcount = entriesleft;
-		printf("%d ", rcount);
-
-		result = BptSearchRange(bpt, testset[i].key, testset[i + rcount].key, &matches);
-		if (!result) {
-			fprintf(stderr, "test: range search returned no items\n");
-			return;
-		}
-		if (result == BT_ERROR) {
-			fprintf(stderr, "test: range search failed\n");
-			return;
-		}
-		if (result != rcount) {
-			fprintf(stderr, "test: range search returned invalid number "
-				"of items (expected: %d, actual: %d\n", rcount, result);
-			return;
-		}
-		for (j = 0; j != result; j++) {
-			if (matches[j].key != testset[i].key ||
-				matches[j].val != testset[i].val) {
-				fprintf(stderr, "test: range search returned invalid item "
-					"(expected: %f %d, returned: %f %d)\n",
-					testset[i].key, testset[i].val, matches[j].key, matches[j].val);
-				return;
-			}
-			i++;
-		}
-
-		free(matches);
-		entriesleft -= rcount;
-		nparts++;
-	}
-	putchar('\n');
-
-	printf("range searched for %d items (%d calls), %dus\n", NITERS, nparts, TimeDiffPrecise(&tv));
-	///////////////////////////////////////////////////////////////////////////
-}
-
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "main.h"
+#include "vector.h"
+#include "hashtable.h"
+#include "mmfile.h"
+#include "bptree.h"
+#include "hashdb.h"
+#include "pathdict.h"
+#include "img.h"
+#include "hist.h"
+#include "lru.h"
+#include "thumb.h"
+#include "shard.h"
+#include "dedup.h"
+
+#ifdef _WIN32
+#	include <fcntl.h>
+#	define NULL_DEVICE "NUL"
+#else
+#	define NULL_DEVICE "/dev/null"
+#endif
+
+#define NITERS 10000
+#define TEST_DATA_FILE "testdata.bin"
+#define TEST_DB_FILE   "test.db"
+#define TEST_DIRS_FILE "testdirs.db"
+#define TEST_HASH_FILE "testhash.db"
+#define TEST_NDIRS     64
+#define TEST_LRU_ITEMS 64
+
+#define BENCH_DIR         "imgcmp-bench.tmp"
+#define BENCH_DB_FILE     "bench.db"
+#define BENCH_TREE_DIR    "tree"
+#define BENCH_DEDUP_DIR   "dedup"
+#define BENCH_NKEYS       NITERS
+#define BENCH_RANGE_LEN   32
+#define BENCH_NIMAGE_OPS  1000 //thumb-sized operations per repetition
+#define BENCH_NIMAGES     128  //images in the synthetic trees
+#define BENCH_NSUBDIRS    8
+#define BENCH_REPS        21
+#define BENCH_WARMUP      3
+
+#define CORPUS_TRUTH_FILE "truth.txt"
+#define CORPUS_NIMAGES    10000
+#define CORPUS_DUP_PCT    30   //originals that get near-duplicates, in percent
+#define CORPUS_MAX_DUPS   3    //near-duplicates per original, at most
+#define CORPUS_CX         640  //largest original; each is 50-100% of this per side
+#define CORPUS_CY         480
+#define CORPUS_PER_DIR    1000 //images per subdirectory, on average
+#define CORPUS_SEED       1
+#define CORPUS_MAX_MATCHES 32
+
+#define VARIANT_ORIGINAL  0
+#define VARIANT_COPY      1 //byte-for-byte copy
+#define VARIANT_REENCODE  2 //JPEG quality 30-70
+#define VARIANT_RESIZE    3 //50-90% per side
+#define VARIANT_RECOLOR   4 //every channel shifted by up to +-10
+#define VARIANT_CROP      5 //2-8% off every edge
+#define NVARIANTS         6
+
+typedef struct _bench {
+	const char *name;
+	unsigned int nops;     //operations timed by each repetition
+	int (*setup)(void);    //once, before the warmup; may be NULL
+	int (*prep)(void);     //before every repetition, untimed; may be NULL
+	int (*run)(void);
+	void (*teardown)(void);
+} BENCH, *LPBENCH;
+
+typedef struct _benchresult {
+	LPBENCH bench;
+	uint64_t min;
+	uint64_t median;
+	uint64_t p99;
+	uint64_t mean;
+} BENCHRESULT, *LPBENCHRESULT;
+
+typedef struct _corpusopts {
+	unsigned int nimages;
+	unsigned int duppct;
+	unsigned int cx;
+	unsigned int cy;
+	unsigned int perdir;
+	uint32_t seed;
+} CORPUSOPTS, *LPCORPUSOPTS;
+
+typedef struct _corpusfile {
+	char *relfn;
+	unsigned int group;
+	int variant;
+} CORPUSFILE, *LPCORPUSFILE;
+
+int BenchMain(int argc, char *argv[]);
+int _BenchRun(LPBENCH bench, int nreps, int nwarmup, LPBENCHRESULT result);
+int _BenchCompareSamples(const void *item1, const void *item2);
+void _BenchPrintJson(FILE *file, LPBENCHRESULT results, int nresults, int nreps, int nwarmup);
+int _BenchMute();
+void _BenchUnmute(int saved);
+int _BenchRemoveTree(const char *dir);
+int _BenchMakeTree(const char *dir, int nimages, int withdups);
+gdImagePtr _BenchMakeImage(uint32_t seed, int cx, int cy);
+uint32_t _BenchRand(uint32_t *state);
+int CorpusGenerate(const char *dir, LPCORPUSOPTS opts);
+int CorpusEvaluate(const char *dir, const char *jsonfn);
+gdImagePtr _CorpusMakeVariant(gdImagePtr im, int variant, uint32_t *rng, int *quality);
+int _CorpusCompareFiles(const void *item1, const void *item2);
+int _CorpusWriteJpeg(gdImagePtr im, const char *path, int quality);
+LPCORPUSFILE _CorpusReadTruth(unsigned int *nfiles, unsigned int *ngroups);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifdef _WIN32
+
+typedef LARGE_INTEGER TIMEVAL;
+
+
+void TimeGetTimePrecise(TIMEVAL *ptv) {
+	QueryPerformanceCounter(ptv);
+}
+
+
+uint64_t TimeDiffPreciseNs(TIMEVAL *ptv1) {
+	LARGE_INTEGER freq;
+	TIMEVAL tv2, *ptv2 = &tv2;
+
+	QueryPerformanceCounter(ptv2);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)((double)(ptv2->QuadPart - ptv1->QuadPart) * 1e9 / (double)freq.QuadPart);
+}
+
+#else
+
+typedef struct timespec TIMEVAL;
+
+
+void TimeGetTimePrecise(TIMEVAL *ptv) {
+	clock_gettime(CLOCK_MONOTONIC, ptv);
+}
+
+
+uint64_t TimeDiffPreciseNs(TIMEVAL *ptv1) {
+	TIMEVAL tv2, *ptv2 = &tv2;
+
+	clock_gettime(CLOCK_MONOTONIC, ptv2);
+	return ((uint64_t)(ptv2->tv_sec - ptv1->tv_sec) * 1000000000) +
+			(ptv2->tv_nsec - ptv1->tv_nsec);
+}
+
+#endif
+
+
+uint32_t TimeDiffPrecise(TIMEVAL *ptv1) {
+	return (uint32_t)(TimeDiffPreciseNs(ptv1) / 1000);
+}
+
+
+void TestGenerateData() {
+	KVPAIR testset[NITERS], kvp;
+	FILE *file;
+	int i, j;
+
+	srand(time(NULL));
+	
+	file = fopen(TEST_DATA_FILE, "wb");
+	if (!file) {
+		fprintf(stderr, "ERROR: TestGenerateData: failed to create test file\n");
+		return;
+	}
+
+	//keys must be unique and exactly representable as floats (< 2^24),
+	//so give each its own bucket and then shuffle them
+	for (i = 0; i != NITERS; i++) {
+		testset[i].key = (float)((i << 10) | (rand() & 0x3FF));
+		testset[i].val = (unsigned int)(rand() & 0xFFFFFF); 
+	}
+	for (i = NITERS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		kvp        = testset[i];
+		testset[i] = testset[j];
+		testset[j] = kvp;
+	}
+
+	fwrite(testset, sizeof(testset), 1, file);
+	
+	fclose(file);
+}
+
+
+int KVPCompare(const void *item1, const void *item2) {
+	KEYTYPE key1 = ((LPKVPAIR)item1)->key, key2 = ((LPKVPAIR)item2)->key;
+
+	return (key1 > key2) - (key1 < key2);
+}
+
+
+void TestBPTree() {
+	TIMEVAL tv;
+	KVPAIR testset[NITERS], kvp, batch[7];
+	LPKVPAIR matches;
+	BTCURSOR cursor;
+	LPBPTREE bpt;
+	float key;
+	unsigned int val;
+	int i, result, nparts, rcount, entriesleft;
+	FILE *file;
+
+	file = fopen(TEST_DATA_FILE, "rb");
+	if (!file) {
+		fprintf(stderr, "ERROR: TestBPTree: failed to open test file\n");
+		return;
+	}
+	if (!fread(testset, sizeof(testset), 1, file)) {
+		fprintf(stderr, "ERROR: TestBPTree: failed to read from test file\n");
+		return;
+	}
+	fclose(file);
+	
+	bpt = BptOpen(TEST_DB_FILE);
+	if (!bpt) {
+		fprintf(stderr, "test: failed to open tree\n");
+		return;
+	}
+	
+	///////////////////////////////////////////////////////////////////////////  INSERTION
+	TimeGetTimePrecise(&tv);
+	for (i = 0; i != NITERS; i++) {
+		key = testset[i].key;
+		val = testset[i].val;
+		if (!BptInsert(bpt, key, val)) {
+			fprintf(stderr, "test: insert failed (%f, %d)\n", key, val);
+			return;
+		}
+	}
+	printf("inserted %d items, %dus\n", NITERS, TimeDiffPrecise(&tv));
+	///////////////////////////////////////////////////////////////////////////
+
+	/////////////////////////////////////////////////////////////////////////// SEARCH
+	TimeGetTimePrecise(&tv);
+	for (i = 0; i != NITERS; i++) {
+		key = testset[i].key;
+		result = BptSearch(bpt, key, &val);
+		if (!result) {
+			fprintf(stderr, "test: item not found (%f)\n", key);
+			return;
+		}
+		if (result == BT_ERROR) {
+			fprintf(stderr, "test: search failed (%f)\n", key);
+			return;
+		}
+		if (val != testset[i].val) {
+			fprintf(stderr, "test: search returned invalid result "
+				"(%f, expected: %d, actual: %d)\n", key, testset[i].val, val);
+			return;
+		}
+	}
+	printf("searched for %d items, %dus\n", NITERS, TimeDiffPrecise(&tv));
+	///////////////////////////////////////////////////////////////////////////
+
+	qsort(testset, NITERS, sizeof(testset[0]), KVPCompare);
+	printf(" min item: %f, max item: %f\n", testset[0].key, testset[NITERS - 1].key);
+	
+	BptGetMin(bpt, &kvp);
+	if (kvp.key != testset[0].key) {
+		fprintf(stderr, "test: invalid minimum key\n");
+		return;
+	}
+
+	BptGetMax(bpt, &kvp);
+	if (kvp.key != testset[NITERS - 1].key) {
+		fprintf(stderr, "test: invalid maximum key\n");
+		return;
+	}
+
+	/////////////////////////////////////////////////////////////////////////// SEARCH RANGE
+	TimeGetTimePrecise(&tv);
+
+	i = nparts = 0;
+	entriesleft = NITERS;
+	printf("checking ranges of size: ");
+	while (entriesleft) {
+		int j;
+
+		rcount = (rand() & 0x1F) + 1;
+		if (rcount > entriesleft)
+			rcount = entriesleft;
+		printf("%d ", rcount);
+
+		result = BptSearchRange(bpt, testset[i].key, testset[i + rcount - 1].key, &matches);
+		if (!result) {
+			fprintf(stderr, "test: range search returned no items\n");
+			return;
+		}
+		if (result == BT_ERROR) {
+			fprintf(stderr, "test: range search failed\n");
+			return;
+		}
+		if (result != rcount) {
+			fprintf(stderr, "test: range search returned invalid number "
+				"of items (expected: %d, actual: %d\n", rcount, result);
+			return;
+		}
+		for (j = 0; j != result; j++) {
+			if (matches[j].key != testset[i].key ||
+				matches[j].val != testset[i].val) {
+				fprintf(stderr, "test: range search returned invalid item "
+					"(expected: %f %d, returned: %f %d)\n",
+					testset[i].key, testset[i].val, matches[j].key, matches[j].val);
+				return;
+			}
+			i++;
+		}
+
+		free(matches);
+		entriesleft -= rcount;
+		nparts++;
+	}
+	putchar('\n');
+
+	printf("range searched for %d items (%d calls), %dus\n", NITERS, nparts, TimeDiffPrecise(&tv));
+
+	result = BptSearchRange(bpt, testset[NITERS - 1].key + 1, testset[NITERS - 1].key + 2, &matches);
+	if (result != BT_NOTFOUND) {
+		fprintf(stderr, "test: range search past the last key returned %d\n", result);
+		return;
+	}
+	///////////////////////////////////////////////////////////////////////////
+
+	/////////////////////////////////////////////////////////////////////////// CURSOR
+	TimeGetTimePrecise(&tv);
+
+	BptCursorFirst(bpt, &cursor);
+	for (i = 0; BptCursorNext(&cursor, &kvp); i++) {
+		if (i == NITERS || kvp.key != testset[i].key || kvp.val != testset[i].val) {
+			fprintf(stderr, "test: cursor walk returned invalid item %d (%f %d)\n",
+				i, kvp.key, kvp.val);
+			return;
+		}
+	}
+	if (i != NITERS) {
+		fprintf(stderr, "test: cursor walk stopped after %d items\n", i);
+		return;
+	}
+
+	BptCursorLast(bpt, &cursor);
+	for (i = NITERS; BptCursorPrev(&cursor, &kvp); ) {
+		i--;
+		if (i < 0 || kvp.key != testset[i].key) {
+			fprintf(stderr, "test: backward cursor walk returned invalid item %d\n", i);
+			return;
+		}
+	}
+	if (i != 0) {
+		fprintf(stderr, "test: backward cursor walk stopped %d items short\n", i);
+		return;
+	}
+
+	//stream ranges through a small buffer, starting between and on keys
+	for (i = 0; i < NITERS - 64; i += 61) {
+		int j, n, ntotal;
+
+		rcount = (rand() & 0x3F) + 1;
+		BptCursorSeek(bpt, &cursor, (i & 1) ? testset[i].key :
+			(testset[i - !!i].key + testset[i].key) / 2);
+		ntotal = 0;
+		while ((n = BptCursorFetchRange(&cursor, testset[i + rcount - 1].key,
+				batch, ARRAYLEN(batch))) > 0) {
+			for (j = 0; j != n; j++) {
+				if (batch[j].key != testset[i + ntotal + j].key) {
+					fprintf(stderr, "test: cursor range returned invalid item "
+						"(expected: %f, returned: %f)\n",
+						testset[i + ntotal + j].key, batch[j].key);
+					return;
+				}
+			}
+			ntotal += n;
+		}
+		if (ntotal != rcount) {
+			fprintf(stderr, "test: cursor range returned %d items, expected %d\n",
+				ntotal, rcount);
+			return;
+		}
+		if (!BptCursorNext(&cursor, &kvp) || kvp.key != testset[i + rcount].key) {
+			fprintf(stderr, "test: cursor range left the cursor in the wrong place\n");
+			return;
+		}
+	}
+
+	BptCursorSeek(bpt, &cursor, testset[NITERS - 1].key + 1);
+	if (BptCursorNext(&cursor, &kvp) ||
+		!BptCursorPrev(&cursor, &kvp) || kvp.key != testset[NITERS - 1].key) {
+		fprintf(stderr, "test: cursor seek past the last key\n");
+		return;
+	}
+
+	result = BptEnumerate(bpt, &matches);
+	if (result != NITERS || memcmp(matches, testset, sizeof(testset))) {
+		fprintf(stderr, "test: enumeration returned %d items, or the wrong ones\n", result);
+		return;
+	}
+	free(matches);
+
+	printf("walked and streamed %d items with cursors, %dus\n", NITERS, TimeDiffPrecise(&tv));
+	///////////////////////////////////////////////////////////////////////////
+
+	/////////////////////////////////////////////////////////////////////////// REMOVAL
+	TimeGetTimePrecise(&tv);
+	for (i = 0; i < NITERS; i += 2) {
+		if (BptRemoveItem(bpt, testset[i].key, testset[i].val + 1) != BT_NOTFOUND) {
+			fprintf(stderr, "test: removed item with wrong value (%f)\n", testset[i].key);
+			return;
+		}
+		if (BptRemoveItem(bpt, testset[i].key, testset[i].val) != 1) {
+			fprintf(stderr, "test: failed to remove item (%f)\n", testset[i].key);
+			return;
+		}
+	}
+	for (i = 0; i != NITERS; i++) {
+		result = BptSearch(bpt, testset[i].key, &val);
+		if (result != ((i & 1) ? 1 : BT_NOTFOUND)) {
+			fprintf(stderr, "test: search after removal returned %d (%f)\n",
+				result, testset[i].key);
+			return;
+		}
+	}
+	printf("removed %d items, %dus\n", NITERS / 2, TimeDiffPrecise(&tv));
+
+	//empty out a run of whole leaves, then range search across them
+	for (i = NITERS / 4 + 1; i < NITERS / 2; i += 2) {
+		if (BptRemoveItem(bpt, testset[i].key, testset[i].val) != 1) {
+			fprintf(stderr, "test: failed to remove item (%f)\n", testset[i].key);
+			return;
+		}
+	}
+	result = BptSearchRange(bpt, testset[NITERS / 4 - 1].key,
+		testset[NITERS / 2 + 1].key, &matches);
+	if (result != 2) {
+		fprintf(stderr, "test: range search over empty leaves returned %d\n", result);
+		return;
+	}
+	if (matches[0].key != testset[NITERS / 4 - 1].key ||
+		matches[1].key != testset[NITERS / 2 + 1].key) {
+		fprintf(stderr, "test: range search over empty leaves returned wrong items\n");
+		return;
+	}
+	free(matches);
+
+	BptCursorSeek(bpt, &cursor, testset[NITERS / 4].key);
+	if (BptCursorFetch(&cursor, batch, 2) != 2 || batch[0].key != testset[NITERS / 2 + 1].key ||
+		!BptCursorPrev(&cursor, NULL) || !BptCursorPrev(&cursor, NULL) ||
+		!BptCursorPrev(&cursor, &kvp) || kvp.key != testset[NITERS / 4 - 1].key) {
+		fprintf(stderr, "test: cursor over empty leaves returned wrong items\n");
+		return;
+	}
+	///////////////////////////////////////////////////////////////////////////
+
+	BptClose(bpt);
+	remove(TEST_DB_FILE);
+}
+
+
+void TestPathDict() {
+	char dirs[TEST_NDIRS][32], longdir[MAX_PATH + 32], path[MAX_PATH];
+	uint32_t ids[TEST_NDIRS], hash, val, nfound;
+	unsigned int i, len, iter;
+	LPPATHDICT pd;
+	LPHASHDB hdb;
+	FILE *file;
+
+	remove(TEST_DIRS_FILE);
+	remove(TEST_HASH_FILE);
+
+	/////////////////////////////////////////////////////////////////////////// DIRECTORY TABLE
+	if ((pd = PdOpen(TEST_DIRS_FILE, 1))) {
+		fprintf(stderr, "test: opened a missing directory table read-only\n");
+		return;
+	}
+	pd = PdOpen(TEST_DIRS_FILE, 0);
+	if (!pd || !pd->isnew) {
+		fprintf(stderr, "test: failed to create directory table\n");
+		return;
+	}
+
+	//directory i is nested in directory (i - 1) / 4, and the deepest are added first
+	//so that their parents are added along the way
+	sprintf(dirs[0], "a%c", PATH_SEPARATOR);
+	for (i = 1; i != TEST_NDIRS; i++)
+		sprintf(dirs[i], "%sd%u%c", dirs[(i - 1) / 4], i, PATH_SEPARATOR);
+	for (i = TEST_NDIRS; i--; ) {
+		ids[i] = PdAdd(pd, dirs[i], strlen(dirs[i]));
+		if (ids[i] == PD_NOTFOUND || ids[i] == PD_ROOT) {
+			fprintf(stderr, "test: failed to add directory %s\n", dirs[i]);
+			return;
+		}
+	}
+	if (pd->ndirs != TEST_NDIRS) {
+		fprintf(stderr, "test: directory table has %u directories, expected %d\n",
+			pd->ndirs, TEST_NDIRS);
+		return;
+	}
+	if (PdLookup(pd, "", 0) != PD_ROOT || PdAdd(pd, "a", 1) != PD_NOTFOUND) {
+		fprintf(stderr, "test: bad lookup of the root or of a path without a separator\n");
+		return;
+	}
+
+	//a directory too long to join with any name must not reach the file
+	sprintf(longdir, "%s", dirs[1]);
+	len = strlen(longdir);
+	memset(longdir + len, 'x', MAX_PATH);
+	longdir[len + MAX_PATH]     = PATH_SEPARATOR;
+	longdir[len + MAX_PATH + 1] = '\0';
+	if (PdAdd(pd, longdir, len + MAX_PATH + 1) != PD_NOTFOUND) {
+		fprintf(stderr, "test: added a directory longer than MAX_PATH\n");
+		return;
+	}
+
+	sprintf(path, "%sx.png", dirs[TEST_NDIRS - 1]);
+	len = PdSplit(path);
+	if (len != strlen(dirs[TEST_NDIRS - 1]) || PdLookup(pd, path, len) != ids[TEST_NDIRS - 1]) {
+		fprintf(stderr, "test: failed to split %s\n", path);
+		return;
+	}
+	PdClose(pd);
+
+	//reading back must find every directory at the id it was given
+	pd = PdOpen(TEST_DIRS_FILE, 1);
+	if (!pd || pd->isnew || pd->ndirs != TEST_NDIRS) {
+		fprintf(stderr, "test: failed to reopen directory table\n");
+		return;
+	}
+	for (i = 0; i != TEST_NDIRS; i++) {
+		len = strlen(dirs[i]);
+		if (PdLookup(pd, dirs[i], len) != ids[i] ||
+			!PdJoin(pd, ids[i], "x.png", 5, path, sizeof(path)) ||
+			strncmp(path, dirs[i], len) || strcmp(path + len, "x.png")) {
+			fprintf(stderr, "test: directory %s not reloaded as %u\n", dirs[i], ids[i]);
+			return;
+		}
+	}
+	if (PdJoin(pd, ids[TEST_NDIRS - 1], "x.png", 5, path, strlen(dirs[TEST_NDIRS - 1]) + 5) ||
+		PdGetPath(pd, TEST_NDIRS + 1, NULL)) {
+		fprintf(stderr, "test: joined past the end of a buffer or the table\n");
+		return;
+	}
+	PdClose(pd);
+
+	//a damaged table is left alone by a reader and started over by a writer
+	file = fopen(TEST_DIRS_FILE, "rb+");
+	if (!file) {
+		perror("fopen rb+");
+		return;
+	}
+	fwrite("XXXX", 4, 1, file);
+	fclose(file);
+	if ((pd = PdOpen(TEST_DIRS_FILE, 1))) {
+		fprintf(stderr, "test: opened a damaged directory table read-only\n");
+		return;
+	}
+	pd = PdOpen(TEST_DIRS_FILE, 0);
+	if (!pd || !pd->isnew || pd->ndirs) {
+		fprintf(stderr, "test: damaged directory table was not started over\n");
+		return;
+	}
+	PdClose(pd);
+	remove(TEST_DIRS_FILE);
+
+	printf("directory table passed, %d directories\n", TEST_NDIRS);
+	///////////////////////////////////////////////////////////////////////////
+
+	/////////////////////////////////////////////////////////////////////////// HASH INDEX
+	hdb = HdbOpen(TEST_HASH_FILE);
+	if (!hdb || !hdb->isnew) {
+		fprintf(stderr, "test: failed to create hash index\n");
+		return;
+	}
+
+	//every hash gets two values, enough of them to grow the table several times
+	for (i = 0; i != NITERS; i++) {
+		if (!HdbInsert(hdb, i / 2, i + 1)) {
+			fprintf(stderr, "test: failed to insert hash %u\n", i / 2);
+			return;
+		}
+	}
+	if (hdb->header->nslots <= HDB_INITIAL_SLOTS || hdb->header->nused != NITERS) {
+		fprintf(stderr, "test: hash index has %u of %u slots used after %d inserts\n",
+			hdb->header->nused, hdb->header->nslots, NITERS);
+		return;
+	}
+
+	for (hash = 0; hash != NITERS / 2; hash += 2) {
+		if (!HdbRemove(hdb, hash, hash * 2 + 1) || HdbRemove(hdb, hash, hash * 2 + 1)) {
+			fprintf(stderr, "test: failed to remove hash %u once\n", hash);
+			return;
+		}
+	}
+	hdb->header->stamp = NITERS;
+	HdbClose(hdb);
+
+	hdb = HdbOpen(TEST_HASH_FILE);
+	if (!hdb || hdb->isnew || hdb->header->stamp != NITERS) {
+		fprintf(stderr, "test: failed to reopen hash index\n");
+		return;
+	}
+	for (hash = 0; hash != NITERS / 2; hash++) {
+		iter   = 0;
+		nfound = 0;
+		while ((val = HdbLookup(hdb, hash, &iter)) != HDB_EMPTY) {
+			if (val == hash * 2 + 2 || (val == hash * 2 + 1 && (hash & 1))) {
+				nfound++;
+			} else {
+				fprintf(stderr, "test: hash %u returned wrong value %u\n", hash, val);
+				return;
+			}
+		}
+		if (nfound != ((hash & 1) ? 2 : 1)) {
+			fprintf(stderr, "test: hash %u returned %u values\n", hash, nfound);
+			return;
+		}
+	}
+
+	HdbClear(hdb);
+	iter = 0;
+	if (hdb->header->nused || HdbLookup(hdb, 1, &iter) != HDB_EMPTY) {
+		fprintf(stderr, "test: hash index not empty after clear\n");
+		return;
+	}
+	HdbClose(hdb);
+	remove(TEST_HASH_FILE);
+
+	printf("hash index passed, %d items\n", NITERS);
+	///////////////////////////////////////////////////////////////////////////
+}
+
+
+int lru_nfreed;
+
+void _TestLruFree(void *value) {
+	lru_nfreed++;
+	free(value);
+}
+
+
+void TestLru() {
+	unsigned int *value;
+	uint32_t key, next;
+	LPLRU lru;
+
+	if (LruInit(0, NULL)) {
+		fprintf(stderr, "test: created an LRU cache that can hold nothing\n");
+		return;
+	}
+	lru = LruInit(TEST_LRU_ITEMS, _TestLruFree);
+	if (!lru) {
+		fprintf(stderr, "test: failed to create LRU cache\n");
+		return;
+	}
+
+	//fill it, then use the even keys so the odd ones are the least recently used
+	for (key = 0; key != TEST_LRU_ITEMS; key++) {
+		value  = malloc(sizeof(unsigned int));
+		*value = key;
+		LruInsert(lru, key, value);
+	}
+	for (key = 0; key != TEST_LRU_ITEMS; key += 2) {
+		value = LruGet(lru, key);
+		if (!value || *value != key) {
+			fprintf(stderr, "test: LRU cache lost key %u\n", key);
+			return;
+		}
+	}
+
+	//each insert past capacity evicts an odd key, oldest first, and then the even ones
+	for (key = TEST_LRU_ITEMS; key != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2; key++) {
+		value  = malloc(sizeof(unsigned int));
+		*value = key;
+		LruInsert(lru, key, value);
+
+		next = (key + 1 != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2) ?
+			(key - TEST_LRU_ITEMS) * 2 + 3 : 0;
+		if (lru->tail->key != next) {
+			fprintf(stderr, "test: LRU cache would evict %u next after inserting %u\n",
+				lru->tail->key, key);
+			return;
+		}
+	}
+	if (lru->nitems != TEST_LRU_ITEMS || lru->evictions != TEST_LRU_ITEMS / 2 ||
+		lru_nfreed != TEST_LRU_ITEMS / 2) {
+		fprintf(stderr, "test: LRU cache holds %u items after %u evictions\n",
+			lru->nitems, (unsigned int)lru->evictions);
+		return;
+	}
+	for (key = 0; key != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2; key++) {
+		value = LruGet(lru, key);
+		if (!value != (key < TEST_LRU_ITEMS && (key & 1)) || (value && *value != key)) {
+			fprintf(stderr, "test: LRU cache evicted the wrong item for key %u\n", key);
+			return;
+		}
+	}
+	if (lru->head->key != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2 - 1 || lru->tail->key != 0) {
+		fprintf(stderr, "test: LRU cache lookups didn't reorder the items\n");
+		return;
+	}
+
+	//removing the head, the tail and one in between keeps the list linked
+	if (!LruRemove(lru, lru->head->key) || !LruRemove(lru, 0) || !LruRemove(lru, 4) ||
+		LruRemove(lru, 4) || LruRemove(lru, 1)) {
+		fprintf(stderr, "test: LRU cache removed the wrong items\n");
+		return;
+	}
+	if (lru->nitems != TEST_LRU_ITEMS - 3 || lru_nfreed != TEST_LRU_ITEMS / 2 + 3 ||
+		lru->tail->key != 2 || lru->head->key != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2 - 2 ||
+		LruGet(lru, 4)) {
+		fprintf(stderr, "test: LRU cache is out of order after removal\n");
+		return;
+	}
+
+	LruClear(lru);
+	if (lru->nitems || lru->head || lru->tail || LruGet(lru, 2) ||
+		lru_nfreed != TEST_LRU_ITEMS + TEST_LRU_ITEMS / 2) {
+		fprintf(stderr, "test: LRU cache not empty after clear\n");
+		return;
+	}
+	LruDestroy(lru);
+
+	printf("LRU cache passed, %d items\n", TEST_LRU_ITEMS);
+}
+
+
+
+#ifdef RUN_BENCHMARKS
+
+/////////// Benchmarks ////////////
+
+KVPAIR bench_keys[BENCH_NKEYS];
+char bench_strs[BENCH_NKEYS][16];
+LPBPTREE bench_bpt;
+LPHT bench_ht;
+gdImagePtr bench_thumbs[2];
+void *bench_png;
+int bench_pnglen;
+THUMBCACHE bench_cache;
+
+
+int _BenchKeysSetup() {
+	KVPAIR kvp;
+	int i, j;
+
+	srand(1);
+	for (i = 0; i != BENCH_NKEYS; i++) {
+		bench_keys[i].key = (float)((i << 10) | (rand() & 0x3FF));
+		bench_keys[i].val = (unsigned int)(rand() & 0xFFFFFF);
+		sprintf(bench_strs[i], "key%08x", rand() ^ (i << 16));
+	}
+	for (i = BENCH_NKEYS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		kvp           = bench_keys[i];
+		bench_keys[i] = bench_keys[j];
+		bench_keys[j] = kvp;
+	}
+
+	return 1;
+}
+
+
+void _BenchTreeClose() {
+	if (bench_bpt) {
+		BptClose(bench_bpt);
+		bench_bpt = NULL;
+	}
+	remove(BENCH_DB_FILE);
+}
+
+
+int _BenchTreePrep() {
+	_BenchTreeClose();
+	bench_bpt = BptOpen(BENCH_DB_FILE);
+	return bench_bpt != NULL;
+}
+
+
+int _BenchTreeInsert() {
+	int i;
+
+	for (i = 0; i != BENCH_NKEYS; i++) {
+		if (!BptInsert(bench_bpt, bench_keys[i].key, bench_keys[i].val))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+int _BenchTreeSetup() {
+	return _BenchKeysSetup() && _BenchTreePrep() && _BenchTreeInsert();
+}
+
+
+int _BenchTreeSearch() {
+	unsigned int val;
+	int i;
+
+	for (i = 0; i != BENCH_NKEYS; i++) {
+		if (BptSearch(bench_bpt, bench_keys[i].key, &val) != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+int _BenchTreeRange() {
+	LPKVPAIR matches;
+	float key;
+	int i, n;
+
+	//keys are (i << 10) plus noise, so each range spans BENCH_RANGE_LEN of them
+	for (i = 0; i + BENCH_RANGE_LEN <= BENCH_NKEYS; i += BENCH_RANGE_LEN) {
+		key = (float)(i << 10);
+		n = BptSearchRange(bench_bpt, key, key + (float)(BENCH_RANGE_LEN << 10) - 1.f, &matches);
+		if (n != BENCH_RANGE_LEN)
+			return 0;
+		free(matches);
+	}
+
+	return 1;
+}
+
+
+int _BenchHtSetup() {
+	if (!_BenchKeysSetup())
+		return 0;
+
+	bench_ht = HtInit(4096, 0, HT_HASH_DEFAULT, 2);
+	return bench_ht != NULL;
+}
+
+
+//the keys are static, so only the chains are freed
+int _BenchHtPrep() {
+	HtResetTable(bench_ht);
+	return 1;
+}
+
+
+int _BenchHtInsert() {
+	int i;
+
+	for (i = 0; i != BENCH_NKEYS; i++)
+		HtInsertItem(bench_ht, bench_strs[i], bench_strs[i]);
+
+	return 1;
+}
+
+
+int _BenchHtLookupSetup() {
+	return _BenchHtSetup() && _BenchHtInsert();
+}
+
+
+int _BenchHtLookup() {
+	int i;
+
+	for (i = 0; i != BENCH_NKEYS; i++) {
+		if (!HtGetItem(bench_ht, bench_strs[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+void _BenchHtTeardown() {
+	HtResetTable(bench_ht);
+	HtDestroy(bench_ht);
+	bench_ht = NULL;
+}
+
+
+int _BenchThumbSetup() {
+	gdImagePtr im;
+	int i;
+
+	im = _BenchMakeImage(1, 320, 240);
+	if (!im)
+		return 0;
+
+	//two thumbs of the same picture, the second with a small corner painted over
+	for (i = 0; i != 2; i++) {
+		bench_thumbs[i] = gdImageCreateTrueColor(THUMB_CX, THUMB_CY);
+		if (!bench_thumbs[i])
+			return 0;
+		gdImageCopyResampled(bench_thumbs[i], im, 0, 0, 0, 0, THUMB_CX, THUMB_CY, 320, 240);
+	}
+	gdImageDestroy(im);
+	gdImageFilledRectangle(bench_thumbs[1], 0, 0, 1, 1, gdTrueColor(255, 255, 255));
+
+	bench_png = gdImagePngPtr(bench_thumbs[0], &bench_pnglen);
+	return bench_png != NULL;
+}
+
+
+void _BenchThumbTeardown() {
+	gdImageDestroy(bench_thumbs[0]);
+	gdImageDestroy(bench_thumbs[1]);
+	gdFree(bench_png);
+}
+
+
+int _BenchCalcKey() {
+	float key = 0.f;
+	int i;
+
+	for (i = 0; i != BENCH_NIMAGE_OPS; i++)
+		key += _ThumbCalcKey(bench_thumbs[i & 1]->tpixels);
+
+	return key > 0.f;
+}
+
+
+int _BenchCompareFuzzy() {
+	int i;
+
+	for (i = 0; i != BENCH_NIMAGE_OPS; i++) {
+		if (!ImgCompareFuzzy(bench_thumbs[0], bench_thumbs[1]))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+//into an image kept between calls, as ThumbCacheGet decodes candidates
+int _BenchPngDecode() {
+	int i;
+
+	for (i = 0; i != BENCH_NIMAGE_OPS; i++) {
+		if (!_ThumbDecodePng(bench_pnglen, bench_png, bench_thumbs[1]))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+//the cache is built once here as well, which leaves files for every prep to flush
+int _BenchUpdateSetup() {
+	if (!_BenchMakeTree(BENCH_TREE_DIR, BENCH_NIMAGES, 0) || chdir(BENCH_TREE_DIR) == -1)
+		return 0;
+
+	scan_recursive = 1;
+	return ThumbCacheInit(&bench_cache, NULL) && ThumbCacheUpdate(&bench_cache);
+}
+
+
+int _BenchUpdatePrep() {
+	bench_cache.nadded = 0;
+	return ThumbCacheFlush(&bench_cache);
+}
+
+
+int _BenchUpdate() {
+	int status;
+
+	status = ThumbCacheUpdate(&bench_cache);
+	ThumbCacheClose(&bench_cache);
+	return status && bench_cache.nadded == BENCH_NIMAGES;
+}
+
+
+void _BenchUpdateTeardown() {
+	ThumbCacheClose(&bench_cache);
+	if (chdir("..") == -1)
+		perror("chdir");
+	_BenchRemoveTree(BENCH_TREE_DIR);
+}
+
+
+//dedup moves files, so every repetition gets a fresh tree with an up to date cache
+int _BenchDedupPrep() {
+	int status;
+
+	_BenchRemoveTree(BENCH_DEDUP_DIR);
+	if (!_BenchMakeTree(BENCH_DEDUP_DIR, BENCH_NIMAGES, 1) || chdir(BENCH_DEDUP_DIR) == -1)
+		return 0;
+
+	scan_recursive = 1;
+	status = ShardSetOpen(&thumbshards, NULL, 1) && ShardSetUpdate(&thumbshards);
+
+	if (chdir("..") == -1)
+		return 0;
+	return status;
+}
+
+
+int _BenchDedup() {
+	DedupPerform(BENCH_DEDUP_DIR);
+	ShardSetClose(&thumbshards);
+
+	return chdir("..") != -1;
+}
+
+
+void _BenchDedupTeardown() {
+	_BenchRemoveTree(BENCH_DEDUP_DIR);
+}
+
+
+BENCH benches[] = {
+	{"bptree_insert",     BENCH_NKEYS, _BenchKeysSetup, _BenchTreePrep, _BenchTreeInsert, _BenchTreeClose},
+	{"bptree_search",     BENCH_NKEYS, _BenchTreeSetup, NULL, _BenchTreeSearch, _BenchTreeClose},
+	{"bptree_range",      BENCH_NKEYS / BENCH_RANGE_LEN, _BenchTreeSetup, NULL, _BenchTreeRange, _BenchTreeClose},
+	{"ht_insert",         BENCH_NKEYS, _BenchHtSetup, _BenchHtPrep, _BenchHtInsert, _BenchHtTeardown},
+	{"ht_lookup",         BENCH_NKEYS, _BenchHtLookupSetup, NULL, _BenchHtLookup, _BenchHtTeardown},
+	{"thumb_calc_key",    BENCH_NIMAGE_OPS, _BenchThumbSetup, NULL, _BenchCalcKey, _BenchThumbTeardown},
+	{"img_compare_fuzzy", BENCH_NIMAGE_OPS, _BenchThumbSetup, NULL, _BenchCompareFuzzy, _BenchThumbTeardown},
+	{"thumb_png_decode",  BENCH_NIMAGE_OPS, _BenchThumbSetup, NULL, _BenchPngDecode, _BenchThumbTeardown},
+	{"thumbcache_update", BENCH_NIMAGES, _BenchUpdateSetup, _BenchUpdatePrep, _BenchUpdate, _BenchUpdateTeardown},
+	{"dedup",             BENCH_NIMAGES, NULL, _BenchDedupPrep, _BenchDedup, _BenchDedupTeardown}
+};
+
+
+/*
+ * imgcmp-bench [-n repetitions] [-w warmup] [-j file.json] [name...]
+ * Runs every benchmark, or those whose names contain one of the names given, in a
+ * scratch directory under the working directory.  Times are per repetition, in ns.
+ *
+ * imgcmp-bench -g dir [-N images] [-d dup%] [-s WxH] [-p images/dir] [-r seed]
+ * imgcmp-bench -e dir [-j file.json]
+ * Generates a synthetic corpus with known near-duplicates, or measures the
+ * throughput and precision/recall of matching on one.
+ */
+int BenchMain(int argc, char *argv[]) {
+	BENCHRESULT results[ARRAYLEN(benches)];
+	CORPUSOPTS opts = {CORPUS_NIMAGES, CORPUS_DUP_PCT, CORPUS_CX, CORPUS_CY,
+		CORPUS_PER_DIR, CORPUS_SEED};
+	const char *jsonfn = NULL, *gendir = NULL, *evaldir = NULL;
+	int nreps = BENCH_REPS, nwarmup = BENCH_WARMUP;
+	int i, j, nresults, nfilters, selected, status;
+	FILE *file;
+
+	nfilters = 0;
+	for (i = 1; i != argc; i++) {
+		if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 != argc) {
+			switch (argv[i][1]) {
+				case 'n':
+					nreps = atoi(argv[++i]);
+					continue;
+				case 'w':
+					nwarmup = atoi(argv[++i]);
+					continue;
+				case 'j':
+					jsonfn = argv[++i];
+					continue;
+				case 'g':
+					gendir = argv[++i];
+					continue;
+				case 'e':
+					evaldir = argv[++i];
+					continue;
+				case 'N':
+					opts.nimages = atoi(argv[++i]);
+					continue;
+				case 'd':
+					opts.duppct = atoi(argv[++i]);
+					continue;
+				case 's':
+					if (sscanf(argv[++i], "%ux%u", &opts.cx, &opts.cy) != 2)
+						break;
+					continue;
+				case 'p':
+					opts.perdir = atoi(argv[++i]);
+					continue;
+				case 'r':
+					opts.seed = strtoul(argv[++i], NULL, 0);
+					continue;
+			}
+		}
+		if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-n repetitions] [-w warmup] "
+				"[-j file.json] [name...]\n"
+				"       %s -g dir [-N images] [-d dup%%] [-s WxH] "
+				"[-p images/dir] [-r seed]\n"
+				"       %s -e dir [-j file.json]\n", argv[0], argv[0], argv[0]);
+			return 1;
+		}
+		argv[++nfilters] = argv[i];
+	}
+	if (nreps < 1)
+		nreps = 1;
+	if (nwarmup < 0)
+		nwarmup = 0;
+
+	if (gendir)
+		return !CorpusGenerate(gendir, &opts);
+	if (evaldir)
+		return !CorpusEvaluate(evaldir, jsonfn);
+
+	if (createdir(BENCH_DIR) == -1 && errno != EEXIST) {
+		perror("mkdir");
+		return 1;
+	}
+	if (chdir(BENCH_DIR) == -1) {
+		perror("chdir");
+		return 1;
+	}
+
+	printf("%-20s %8s %14s %14s %14s %12s\n", "benchmark", "ops",
+		"median ns", "p99 ns", "min ns", "ns/op");
+
+	status   = 0;
+	nresults = 0;
+	for (i = 0; i != ARRAYLEN(benches); i++) {
+		selected = !nfilters;
+		for (j = 1; j <= nfilters && !selected; j++)
+			selected = strstr(benches[i].name, argv[j]) != NULL;
+		if (!selected)
+			continue;
+
+		if (!_BenchRun(&benches[i], nreps, nwarmup, &results[nresults])) {
+			fprintf(stderr, "ERROR: benchmark %s failed\n", benches[i].name);
+			status = 1;
+			continue;
+		}
+
+		printf("%-20s %8u %14llu %14llu %14llu %12.1f\n", benches[i].name, benches[i].nops,
+			(unsigned long long)results[nresults].median,
+			(unsigned long long)results[nresults].p99,
+			(unsigned long long)results[nresults].min,
+			(double)results[nresults].median / benches[i].nops);
+		fflush(stdout);
+		nresults++;
+	}
+
+	if (chdir("..") == -1)
+		perror("chdir");
+	_BenchRemoveTree(BENCH_DIR);
+
+	if (jsonfn) {
+		file = fopen(jsonfn, "w");
+		if (!file) {
+			perror("fopen");
+			return 1;
+		}
+		_BenchPrintJson(file, results, nresults, nreps, nwarmup);
+		fclose(file);
+	}
+
+	return status;
+}
+
+
+int _BenchCompareSamples(const void *item1, const void *item2) {
+	uint64_t a = *(uint64_t *)item1, b = *(uint64_t *)item2;
+
+	return (a > b) - (a < b);
+}
+
+
+//whatever the code under test prints is thrown away, so only the results are shown
+int _BenchRun(LPBENCH bench, int nreps, int nwarmup, LPBENCHRESULT result) {
+	uint64_t *samples, total;
+	TIMEVAL tv;
+	int i, saved, status;
+
+	samples = malloc(nreps * sizeof(uint64_t));
+	if (!samples)
+		return 0;
+
+	saved  = _BenchMute();
+	status = !bench->setup || bench->setup();
+
+	for (i = -nwarmup; status && i < nreps; i++) {
+		if (bench->prep && !bench->prep()) {
+			status = 0;
+			break;
+		}
+
+		TimeGetTimePrecise(&tv);
+		status = bench->run();
+		if (i >= 0)
+			samples[i] = TimeDiffPreciseNs(&tv);
+	}
+
+	if (bench->teardown)
+		bench->teardown();
+	_BenchUnmute(saved);
+
+	if (status) {
+		qsort(samples, nreps, sizeof(uint64_t), _BenchCompareSamples);
+
+		total = 0;
+		for (i = 0; i != nreps; i++)
+			total += samples[i];
+
+		result->bench  = bench;
+		result->min    = samples[0];
+		result->median = samples[nreps / 2];
+		result->p99    = samples[(nreps * 99 + 99) / 100 - 1];
+		result->mean   = total / nreps;
+	}
+
+	free(samples);
+	return status;
+}
+
+
+void _BenchPrintJson(FILE *file, LPBENCHRESULT results, int nresults, int nreps, int nwarmup) {
+	int i;
+
+	fprintf(file, "{\n\t\"repetitions\": %d,\n\t\"warmup\": %d,\n\t\"benchmarks\": [\n",
+		nreps, nwarmup);
+
+	for (i = 0; i != nresults; i++) {
+		fprintf(file, "\t\t{\"name\": \"%s\", \"ops\": %u, \"min_ns\": %llu, "
+			"\"median_ns\": %llu, \"p99_ns\": %llu, \"mean_ns\": %llu, "
+			"\"median_ns_per_op\": %.1f}%s\n",
+			results[i].bench->name, results[i].bench->nops,
+			(unsigned long long)results[i].min, (unsigned long long)results[i].median,
+			(unsigned long long)results[i].p99, (unsigned long long)results[i].mean,
+			(double)results[i].median / results[i].bench->nops,
+			i + 1 != nresults ? "," : "");
+	}
+
+	fprintf(file, "\t]\n}\n");
+}
+
+
+int _BenchMute() {
+	int saved, null;
+
+	fflush(stdout);
+	saved = dup(fileno(stdout));
+	null  = open(NULL_DEVICE, O_WRONLY);
+	if (null != -1) {
+		dup2(null, fileno(stdout));
+		close(null);
+	}
+
+	return saved;
+}
+
+
+void _BenchUnmute(int saved) {
+	if (saved == -1)
+		return;
+
+	fflush(stdout);
+	dup2(saved, fileno(stdout));
+	close(saved);
+}
+
+
+/*
+ * A tree of nimages JPEGs spread over BENCH_NSUBDIRS subdirectories.  With withdups,
+ * every fourth image gets a byte-for-byte copy and every fourth after that a
+ * re-encode at a lower quality, for the deduplicator to find.
+ */
+int _BenchMakeTree(const char *dir, int nimages, int withdups) {
+	char path[MAX_PATH];
+	gdImagePtr im;
+	FILE *file;
+	int i, j, ncopies;
+
+	if (createdir(dir) == -1 && errno != EEXIST)
+		return 0;
+	for (i = 0; i != BENCH_NSUBDIRS; i++) {
+		snprintf(path, sizeof(path), "%s%cd%d", dir, PATH_SEPARATOR, i);
+		if (createdir(path) == -1 && errno != EEXIST)
+			return 0;
+	}
+
+	for (i = 0; i != nimages; i++) {
+		im = _BenchMakeImage(i + 2, 320, 240);
+		if (!im)
+			return 0;
+
+		ncopies = withdups && (i & 3) == 0 ? 2 : 1;
+		for (j = 0; j != ncopies + (withdups && (i & 3) == 1); j++) {
+			snprintf(path, sizeof(path), "%s%cd%d%cimg%d_%d.jpg", dir, PATH_SEPARATOR,
+				(i + j) % BENCH_NSUBDIRS, PATH_SEPARATOR, i, j);
+			file = fopen(path, "wb");
+			if (!file) {
+				gdImageDestroy(im);
+				return 0;
+			}
+			gdImageJpeg(im, file, j == ncopies ? 70 : 90);
+			fclose(file);
+		}
+		gdImageDestroy(im);
+	}
+
+	return 1;
+}
+
+
+//a few random blocks of color over a random background; the seed picks the picture
+gdImagePtr _BenchMakeImage(uint32_t seed, int cx, int cy) {
+	gdImagePtr im;
+	uint32_t rng;
+	int i, x, y;
+
+	im = gdImageCreateTrueColor(cx, cy);
+	if (!im)
+		return NULL;
+
+	rng = seed * 0x9E3779B9 + 0x7F4A7C15;
+	gdImageFilledRectangle(im, 0, 0, cx - 1, cy - 1,
+		gdTrueColor(_BenchRand(&rng) & 0xFF, _BenchRand(&rng) & 0xFF, _BenchRand(&rng) & 0xFF));
+	for (i = 0; i != 6; i++) {
+		x = _BenchRand(&rng) % cx;
+		y = _BenchRand(&rng) % cy;
+		gdImageFilledRectangle(im, x, y,
+			x + cx / 16 + _BenchRand(&rng) % (cx * 3 / 8),
+			y + cy / 12 + _BenchRand(&rng) % (cy * 3 / 8),
+			gdTrueColor(_BenchRand(&rng) & 0xFF, _BenchRand(&rng) & 0xFF, _BenchRand(&rng) & 0xFF));
+	}
+
+	return im;
+}
+
+
+//xorshift, so the same seed makes the same pictures with any libc
+uint32_t _BenchRand(uint32_t *state) {
+	uint32_t x = *state ? *state : 0x9E3779B9;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+
+int _BenchRemoveTree(const char *dir) {
+	char path[MAX_PATH];
+#ifdef _WIN32
+	HANDLE hFindFile;
+	WIN32_FIND_DATA ffd;
+
+	snprintf(path, sizeof(path), "%s\\*", dir);
+	hFindFile = FindFirstFile(path, &ffd);
+	if (hFindFile != INVALID_HANDLE_VALUE) {
+		do {
+			if (!strcmp(ffd.cFileName, ".") || !strcmp(ffd.cFileName, ".."))
+				continue;
+			snprintf(path, sizeof(path), "%s\\%s", dir, ffd.cFileName);
+			if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				_BenchRemoveTree(path);
+			else
+				DeleteFile(path);
+		} while (FindNextFile(hFindFile, &ffd));
+		FindClose(hFindFile);
+	}
+
+	return RemoveDirectory(dir);
+#else
+	struct dirent *entry;
+	struct stat st;
+	DIR *dirp;
+
+	dirp = opendir(dir);
+	if (!dirp)
+		return 0;
+
+	while ((entry = readdir(dirp))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (lstat(path, &st) == -1)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			_BenchRemoveTree(path);
+		else
+			unlink(path);
+	}
+	closedir(dirp);
+
+	return rmdir(dir) != -1;
+#endif
+}
+
+
+/////////// Synthetic corpus ////////////
+
+const char *corpus_variants[NVARIANTS] = {
+	"original", "copy", "reencode", "resize", "recolor", "crop"
+};
+
+
+/*
+ * Writes opts->nimages JPEGs over subdirectories of dir, in groups of an original
+ * and its near-duplicates, and lists each file's group and kind of variant in
+ * CORPUS_TRUTH_FILE there.  Near-duplicates land in random subdirectories, and
+ * the same options always make the same corpus.
+ */
+int CorpusGenerate(const char *dir, LPCORPUSOPTS opts) {
+	char path[MAX_PATH], relfn[32];
+	gdImagePtr im, varim;
+	FILE *truth;
+	TIMEVAL tv;
+	uint32_t rng;
+	unsigned int i, j, group, ndirs, ndups, subdir, cx, cy;
+	int variant, quality, status;
+
+	if (!opts->nimages || !opts->perdir || opts->cx < 32 || opts->cy < 32) {
+		fprintf(stderr, "ERROR: bad corpus options\n");
+		return 0;
+	}
+
+	ndirs = (opts->nimages + opts->perdir - 1) / opts->perdir;
+	if (createdir(dir) == -1 && errno != EEXIST) {
+		perror("mkdir");
+		return 0;
+	}
+	for (i = 0; i != ndirs; i++) {
+		snprintf(path, sizeof(path), "%s%c%04u", dir, PATH_SEPARATOR, i);
+		if (createdir(path) == -1 && errno != EEXIST) {
+			perror("mkdir");
+			return 0;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEPARATOR, CORPUS_TRUTH_FILE);
+	truth = fopen(path, "w");
+	if (!truth) {
+		perror("fopen");
+		return 0;
+	}
+
+	TimeGetTimePrecise(&tv);
+
+	rng    = opts->seed;
+	status = 1;
+	group  = 0;
+	for (i = 0; status && i != opts->nimages; group++) {
+		cx = opts->cx / 2 + _BenchRand(&rng) % (opts->cx / 2 + 1);
+		cy = opts->cy / 2 + _BenchRand(&rng) % (opts->cy / 2 + 1);
+		im = _BenchMakeImage(_BenchRand(&rng), cx, cy);
+		if (!im) {
+			status = 0;
+			break;
+		}
+
+		ndups = 0;
+		if (_BenchRand(&rng) % 100 < opts->duppct)
+			ndups = 1 + _BenchRand(&rng) % CORPUS_MAX_DUPS;
+
+		for (j = 0; j <= ndups && i != opts->nimages; j++, i++) {
+			variant = j ? 1 + _BenchRand(&rng) % (NVARIANTS - 1) : VARIANT_ORIGINAL;
+			subdir  = j ? _BenchRand(&rng) % ndirs : i / opts->perdir;
+
+			snprintf(relfn, sizeof(relfn), "%04u%cimg%07u.jpg", subdir, PATH_SEPARATOR, i);
+			snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEPARATOR, relfn);
+
+			varim  = _CorpusMakeVariant(im, variant, &rng, &quality);
+			status = varim && _CorpusWriteJpeg(varim, path, quality);
+			if (varim && varim != im)
+				gdImageDestroy(varim);
+			if (!status) {
+				fprintf(stderr, "ERROR: failed to write %s\n", path);
+				break;
+			}
+
+			fprintf(truth, "%u\t%s\t%s\n", group, corpus_variants[variant], relfn);
+		}
+		gdImageDestroy(im);
+	}
+
+	if (fclose(truth) == EOF) {
+		perror("fclose");
+		status = 0;
+	}
+
+	printf("generated %u images in %u groups under %s in %.3f s (%.1f images/s)\n",
+		i, group, dir, TimeDiffPreciseNs(&tv) / 1e9,
+		i / (TimeDiffPreciseNs(&tv) / 1e9));
+	return status;
+}
+
+
+/*
+ * Runs ThumbCacheUpdate on a corpus made by CorpusGenerate, then queries the cache
+ * with every image in it.  Matches are scored against the truth file: a match within
+ * the query's group is a true positive, and every ordered pair of images in the same
+ * group is one that should be found.  Pairs of an original and one of its variants
+ * are also counted by the kind of variant.
+ */
+int CorpusEvaluate(const char *dir, const char *jsonfn) {
+	LPTCENTRY dupents[CORPUS_MAX_MATCHES];
+	unsigned int dupoffs[CORPUS_MAX_MATCHES];
+	unsigned int found[NVARIANTS], pairs[NVARIANTS];
+	unsigned int i, k, nfiles, ngroups, *groupsizes;
+	uint64_t npairs, npredicted, ntruepos, updatens, searchns;
+	char path[MAX_PATH];
+	double precision, recall;
+	CORPUSFILE key;
+	LPCORPUSFILE files, match;
+	THUMBCACHE cache;
+	TIMEVAL tv;
+	FILE *file;
+	int nmatches, nerrors, nadded, saved, status;
+
+	//opened first, since a relative name is meant relative to here
+	status = 0;
+	file   = NULL;
+	if (jsonfn) {
+		file = fopen(jsonfn, "w");
+		if (!file) {
+			perror("fopen");
+			return 0;
+		}
+	}
+
+	if (chdir(dir) == -1) {
+		perror("chdir");
+		goto fail;
+	}
+
+	files = _CorpusReadTruth(&nfiles, &ngroups);
+	if (!files)
+		goto fail;
+
+	groupsizes = calloc(ngroups, sizeof(unsigned int));
+	if (!groupsizes) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		goto end;
+	}
+
+	//sorted by name, for looking up the matches
+	qsort(files, nfiles, sizeof(CORPUSFILE), _CorpusCompareFiles);
+
+	memset(found, 0, sizeof(found));
+	memset(pairs, 0, sizeof(pairs));
+	for (i = 0; i != nfiles; i++) {
+		groupsizes[files[i].group]++;
+		if (files[i].variant != VARIANT_ORIGINAL)
+			pairs[files[i].variant] += 2;
+	}
+	npairs = 0;
+	for (i = 0; i != ngroups; i++)
+		npairs += (uint64_t)groupsizes[i] * (groupsizes[i] - 1);
+
+	scan_recursive = 1;
+	if (!ThumbCacheInit(&cache, NULL))
+		goto end;
+
+	saved = _BenchMute();
+	TimeGetTimePrecise(&tv);
+	status   = ThumbCacheUpdate(&cache);
+	updatens = TimeDiffPreciseNs(&tv);
+	nadded   = cache.nadded;
+	ThumbCacheClose(&cache);
+	_BenchUnmute(saved);
+	if (!status) {
+		fprintf(stderr, "ERROR: failed to update thumb cache\n");
+		goto end;
+	}
+
+	//reopened so the queries see the cache the way a later run would
+	status = 0;
+	if (!ThumbCacheInit(&cache, NULL))
+		goto end;
+	if (!ThumbCacheBurstReadBegin(&cache, 0)) {
+		ThumbCacheClose(&cache);
+		goto end;
+	}
+
+	npredicted = 0;
+	ntruepos   = 0;
+	nerrors    = 0;
+
+	saved = _BenchMute();
+	TimeGetTimePrecise(&tv);
+	for (i = 0; i != nfiles; i++) {
+		nmatches = ThumbFindMatches(&cache, files[i].relfn, dupents, dupoffs, ARRAYLEN(dupents));
+		if (nmatches == -1) {
+			nerrors++;
+			continue;
+		}
+
+		for (k = 0; k != (unsigned int)nmatches; k++) {
+			if (!ThumbCacheEntryPath(&cache, dupents[k], path, sizeof(path)))
+				continue;
+			key.relfn = path;
+			match = bsearch(&key, files, nfiles, sizeof(CORPUSFILE), _CorpusCompareFiles);
+			if (!match || match == &files[i])
+				continue;
+
+			npredicted++;
+			if (match->group != files[i].group)
+				continue;
+
+			ntruepos++;
+			if (files[i].variant == VARIANT_ORIGINAL)
+				found[match->variant]++;
+			else if (match->variant == VARIANT_ORIGINAL)
+				found[files[i].variant]++;
+		}
+	}
+	searchns = TimeDiffPreciseNs(&tv);
+	_BenchUnmute(saved);
+	ThumbCacheClose(&cache);
+
+	precision = npredicted ? (double)ntruepos / npredicted : 1.0;
+	recall    = npairs ? (double)ntruepos / npairs : 1.0;
+
+	printf("corpus:    %u images in %u groups, %llu duplicate pairs\n",
+		nfiles, ngroups, (unsigned long long)npairs);
+	printf("update:    %d added in %.3f s (%.1f images/s)\n",
+		nadded, updatens / 1e9, nadded / (updatens / 1e9));
+	printf("search:    %u queries in %.3f s (%.1f queries/s), %d failed\n",
+		nfiles, searchns / 1e9, nfiles / (searchns / 1e9), nerrors);
+	printf("precision: %.4f (%llu of %llu matches)\n", precision,
+		(unsigned long long)ntruepos, (unsigned long long)npredicted);
+	printf("recall:    %.4f (%llu of %llu pairs)\n", recall,
+		(unsigned long long)ntruepos, (unsigned long long)npairs);
+	for (i = 1; i != NVARIANTS; i++) {
+		printf("  %-9s %.4f (%u of %u)\n", corpus_variants[i],
+			pairs[i] ? (double)found[i] / pairs[i] : 1.0, found[i], pairs[i]);
+	}
+
+	if (file) {
+		fprintf(file, "{\n\t\"images\": %u,\n\t\"groups\": %u,\n\t\"pairs\": %llu,\n"
+			"\t\"added\": %d,\n\t\"update_ns\": %llu,\n\t\"search_ns\": %llu,\n"
+			"\t\"failed_queries\": %d,\n\t\"matches\": %llu,\n\t\"true_positives\": %llu,\n"
+			"\t\"precision\": %.6f,\n\t\"recall\": %.6f,\n\t\"variants\": {\n",
+			nfiles, ngroups, (unsigned long long)npairs, nadded,
+			(unsigned long long)updatens, (unsigned long long)searchns, nerrors,
+			(unsigned long long)npredicted, (unsigned long long)ntruepos, precision, recall);
+		for (i = 1; i != NVARIANTS; i++) {
+			fprintf(file, "\t\t\"%s\": {\"pairs\": %u, \"found\": %u}%s\n",
+				corpus_variants[i], pairs[i], found[i], i + 1 != NVARIANTS ? "," : "");
+		}
+		fprintf(file, "\t}\n}\n");
+	}
+
+	status = 1;
+end:
+	free(groupsizes);
+	for (i = 0; i != nfiles; i++)
+		free(files[i].relfn);
+	free(files);
+fail:
+	if (file && fclose(file) == EOF) {
+		perror("fclose");
+		status = 0;
+	}
+	return status;
+}
+
+
+//returns im itself when the variant only changes how it is saved
+gdImagePtr _CorpusMakeVariant(gdImagePtr im, int variant, uint32_t *rng, int *quality) {
+	gdImagePtr varim;
+	int cx, cy, x, y, dx, dy, dr, dg, db, pct, r, g, b;
+
+	*quality = 90;
+	cx = gdImageSX(im);
+	cy = gdImageSY(im);
+
+	switch (variant) {
+		case VARIANT_ORIGINAL:
+		case VARIANT_COPY:
+			return im;
+		case VARIANT_REENCODE:
+			*quality = 30 + _BenchRand(rng) % 41;
+			return im;
+		case VARIANT_RESIZE:
+			pct   = 50 + _BenchRand(rng) % 41;
+			varim = gdImageCreateTrueColor(cx * pct / 100, cy * pct / 100);
+			if (varim)
+				gdImageCopyResampled(varim, im, 0, 0, 0, 0,
+					gdImageSX(varim), gdImageSY(varim), cx, cy);
+			return varim;
+		case VARIANT_RECOLOR:
+			dr = (int)(_BenchRand(rng) % 21) - 10;
+			dg = (int)(_BenchRand(rng) % 21) - 10;
+			db = (int)(_BenchRand(rng) % 21) - 10;
+			varim = gdImageCreateTrueColor(cx, cy);
+			if (!varim)
+				return NULL;
+			for (y = 0; y != cy; y++) {
+				for (x = 0; x != cx; x++) {
+					r = gdTrueColorGetRed(im->tpixels[y][x]) + dr;
+					g = gdTrueColorGetGreen(im->tpixels[y][x]) + dg;
+					b = gdTrueColorGetBlue(im->tpixels[y][x]) + db;
+					varim->tpixels[y][x] = gdTrueColor(r < 0 ? 0 : (r > 255 ? 255 : r),
+						g < 0 ? 0 : (g > 255 ? 255 : g), b < 0 ? 0 : (b > 255 ? 255 : b));
+				}
+			}
+			return varim;
+		case VARIANT_CROP:
+			dx = cx * (2 + _BenchRand(rng) % 7) / 100;
+			dy = cy * (2 + _BenchRand(rng) % 7) / 100;
+			varim = gdImageCreateTrueColor(cx - 2 * dx, cy - 2 * dy);
+			if (varim)
+				gdImageCopy(varim, im, 0, 0, dx, dy, cx - 2 * dx, cy - 2 * dy);
+			return varim;
+	}
+
+	return NULL;
+}
+
+
+int _CorpusCompareFiles(const void *item1, const void *item2) {
+	return strcmp(((LPCORPUSFILE)item1)->relfn, ((LPCORPUSFILE)item2)->relfn);
+}
+
+
+int _CorpusWriteJpeg(gdImagePtr im, const char *path, int quality) {
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if (!file)
+		return 0;
+
+	gdImageJpeg(im, file, quality);
+	return fclose(file) != EOF;
+}
+
+
+//reads CORPUS_TRUTH_FILE in the current directory, as written by CorpusGenerate
+LPCORPUSFILE _CorpusReadTruth(unsigned int *nfiles, unsigned int *ngroups) {
+	char line[MAX_PATH + 64], varname[16], *relfn, *newline;
+	LPCORPUSFILE files, newfiles;
+	unsigned int maxfiles, group;
+	FILE *file;
+	int variant;
+
+	file = fopen(CORPUS_TRUTH_FILE, "r");
+	if (!file) {
+		perror("fopen");
+		return NULL;
+	}
+
+	*nfiles  = 0;
+	*ngroups = 0;
+	maxfiles = 1024;
+	files = malloc(maxfiles * sizeof(CORPUSFILE));
+	if (!files)
+		goto fail;
+
+	while (fgets(line, sizeof(line), file)) {
+		newline = strpbrk(line, "\r\n");
+		if (newline)
+			*newline = '\0';
+
+		relfn = strchr(line, '\t');
+		relfn = relfn ? strchr(relfn + 1, '\t') : NULL;
+		if (!relfn || sscanf(line, "%u\t%15s", &group, varname) != 2) {
+			fprintf(stderr, "ERROR: malformed line in %s: %s\n", CORPUS_TRUTH_FILE, line);
+			goto fail;
+		}
+		for (variant = 0; variant != NVARIANTS; variant++) {
+			if (!strcmp(varname, corpus_variants[variant]))
+				break;
+		}
+		if (variant == NVARIANTS) {
+			fprintf(stderr, "ERROR: unknown variant %s in %s\n", varname, CORPUS_TRUTH_FILE);
+			goto fail;
+		}
+
+		if (*nfiles == maxfiles) {
+			maxfiles <<= 1;
+			newfiles = realloc(files, maxfiles * sizeof(CORPUSFILE));
+			if (!newfiles)
+				goto fail;
+			files = newfiles;
+		}
+
+		files[*nfiles].relfn = strdup(relfn + 1);
+		if (!files[*nfiles].relfn)
+			goto fail;
+		files[*nfiles].group   = group;
+		files[*nfiles].variant = variant;
+		(*nfiles)++;
+
+		if (group >= *ngroups)
+			*ngroups = group + 1;
+	}
+
+	fclose(file);
+	return files;
+
+fail:
+	if (files) {
+		while (*nfiles)
+			free(files[--*nfiles].relfn);
+		free(files);
+	}
+	fclose(file);
+	return NULL;
+}
+
+#endif //RUN_BENCHMARKS
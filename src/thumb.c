@@ -1,1098 +1,2394 @@
-/*-
- * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-/* 
- * thumb.c - 
- *    Contains routines pertaining to thumbnail cache
- */
-
-#include "main.h"
-#include "mmfile.h"
-#include "bptree.h"
-#include "img.h"
-#include "hashtable.h"
-#include "thumb.h"
-
-LPHT cacheht;
-LPBPTREE thumbbpt;
-char thumb_btree_fn[256] = "thumbindex.db";
-char thumb_cache_fn[256] = "thumbcache.db";
-FMAPINFO cachemap;
-int burstmode;
-int nadded;
-
-
-///////////////////////////////////////////////////////////////////////////////
-
-
-int ThumbCacheBurstReadBegin(int reinit) {
-	if (reinit) {
-		if (!MMFileClose(&cachemap)) {
-			fprintf(stderr, "ERROR: failed to close thumb cache\n");
-			return 0;
-		}
-		burstmode = 0;
-	}
-
-	if (burstmode)
-		return 1;
-
-	if (!MMFileOpen(thumb_cache_fn,	THUMBCACHE_INITIAL_LEN, &cachemap)) {
-		fprintf(stderr, "ERROR: failed to open thumb cache\n");
-		return 0;
-	}
-
-	burstmode = 1;
-
-	return 1;
-}
-
-
-int ThumbCacheBurstReadEnd() {
-	if (burstmode) {
-		if (!MMFileClose(&cachemap)) {
-			fprintf(stderr, "ERROR: failed to close thumb cache\n");
-			return 0;
-		}
-		burstmode = 0;
-	}
-
-	return 1;
-}
-
-
-gdImagePtr ThumbCreate(const char *filename, unsigned int *filesize) {
-	gdImagePtr pic, im;
-
-	pic = ImgLoadGd(filename, filesize);
-	if (!pic)
-		return NULL;
-
-	im = gdImageCreateTrueColor(THUMB_CX, THUMB_CY);
-	gdImageCopyResampled(im, pic, 0, 0, 0, 0, THUMB_CX, THUMB_CY, pic->sx, pic->sy);
-	gdImageDestroy(pic);
-
-	return im;
-}
-
-
-void _ThumbFlatten(int **tpixels, int mask) {
-	int x, y;
-
-	for (y = 0; y != THUMB_CY; y++) {
-		for (x = 0; x != THUMB_CX; x++)
-			tpixels[y][x] &= mask; //~0x00010101;
-	}
-}
-
-
-int ThumbCacheAdd(FILE *tc, const char *filename, time_t mtime) {
-	gdImagePtr thumb = NULL;
-	unsigned int thumbsize, imgsize, offset;
-	void *thumbdata;
-	TCENTRY tcent;
-	int status = 0, closetc = 0;
-
-	if (!filename)
-		return 0;
-
-	if (!tc) {
-		closetc = 1;
-		tc = fopen(thumb_cache_fn, "rb+");
-		if (!tc)
-			goto end;
-
-		if (fseek(tc, 0, SEEK_END))
-			goto end;
-	}
-
-	thumb = ThumbCreate(filename, &imgsize);
-	if (!thumb)
-		goto end;
-
-	thumbdata = gdImagePngPtr(thumb, (int *)&thumbsize);
-	if (!thumbdata)
-		goto end;
-
-	tcent.mtime      = mtime;
-	tcent.thumbfsize = thumbsize;
-	tcent.thumbkey   = _ThumbCalcKey(thumb->tpixels);
-
-	offset = _ThumbCacheWriteEntry(tc, &tcent, filename, thumbdata);
-	if (!offset)
-		goto end;
-
-	status = _ThumbCacheUpdateStructures(filename, &tcent, offset, 0);
-
-end:
-	if (thumb)
-		gdImageDestroy(thumb);
-	if (thumbdata)
-		gdFree(thumbdata);
-	if (tc && closetc)
-		fclose(tc);
-
-	return status;
-}
-
-
-int ThumbCacheReplace(FILE *tc, const char *filename, LPTCRECORD ptcrec, time_t mtime) {
-	void *thumbdata;
-	gdImagePtr thumb = NULL;
-	unsigned int origoffset, offset;
-	uint32_t thumbsize;
-	int status = 0, closetc = 0;
-
-	if (!filename || !ptcrec)
-		return 0;
-
-	if (!thumbbpt) {
-		thumbbpt = BptOpen(thumb_btree_fn);
-		if (!thumbbpt)
-			return 0;
-	}
-
-	if (BptRemove(thumbbpt, ptcrec->ent.thumbkey) <= 0)
-		goto fail;
-
-	thumb = ThumbCreate(filename, NULL);
-	if (!thumb)
-		goto fail;
-
-	thumbdata = gdImagePngPtr(thumb, (int *)&thumbsize);
-	if (!thumbdata)
-		goto fail;
-
-	if (!tc) {
-		closetc = 1;
-		tc = fopen(thumb_cache_fn, "rb+");
-		if (!tc)
-			goto fail;
-	}
-
-	origoffset = ftell(tc);
-	if (thumbsize <= ptcrec->ent.thumbfsize) {
-		if (fseek(tc, ptcrec->offset, SEEK_SET))
-			goto fail;
-	} else {
-		if (fseek(tc, 0, SEEK_END))
-			goto fail;
-		ptcrec->offset = ftell(tc);
-	}
-	ptcrec->ent.mtime      = mtime;
-	ptcrec->ent.thumbfsize = thumbsize;
-	ptcrec->ent.thumbkey   = _ThumbCalcKey(thumb->tpixels);
-
-	offset = _ThumbCacheWriteEntry(tc, &ptcrec->ent, filename, thumbdata);
-	if (!offset)
-		goto fail;
-
-	status = _ThumbCacheUpdateStructures(filename, &ptcrec->ent, offset, 1);
-
-fail:
-	if (tc) {
-		if (closetc)
-			fclose(tc);
-		else
-			fseek(tc, origoffset, SEEK_SET);
-	}
-	if (thumb)
-		gdImageDestroy(thumb);
-	if (thumbdata)
-		gdFree(thumbdata);
-	return status;
-}
-
-
-int ThumbCacheRemove(unsigned int offset) {
-	float thumbkey;
-	char *fn, *filename;
-	int status  = 0;
-	FILE *tc    = NULL;
-	char *fnbuf = NULL;
-
-	if (burstmode) {
-		LPTCENTRY ptcent;
-	
-		ptcent = (LPTCENTRY)((char *)cachemap.addr + offset);
-
-		ptcent->mtime = TC_MTIME_DELETED;
-
-		thumbkey = ptcent->thumbkey;
-		filename = ptcent->filename;
-	} else {
-		TCENTRY entry;
-
-		tc = fopen(thumb_cache_fn, "rb+");
-		if (!tc)
-			return 0;
-
-		if (fseek(tc, offset, SEEK_SET) == -1)
-			goto end;
-		if (!fread(&entry, sizeof(TCENTRY), 1, tc))
-			goto end;
-		fnbuf = malloc(entry.fnlen + 1);
-		if (!fread(fnbuf, entry.fnlen + 1, 1, tc))
-			goto end;
-
-		if (fseek(tc, offset, SEEK_SET) == -1)
-			goto end;
-		entry.mtime = TC_MTIME_DELETED;
-		fwrite(&entry, sizeof(TCENTRY), 1, tc);
-
-		thumbkey = entry.thumbkey;
-		filename = fnbuf;
-	}
-
-	if (!thumbbpt) {
-		thumbbpt = BptOpen(thumb_btree_fn);
-		if (!thumbbpt)
-			goto end;
-	}
-
-	if (!BptRemove(thumbbpt, thumbkey))
-		goto end;
-
-	if (cacheht) {
-		fn = HtUnassociateItem(cacheht, filename);
-		if (!fn)
-			goto end;
-		free(fn - sizeof(TCRECORD));
-	}
-
-	status = 1;
-end:
-	if (fnbuf)
-		free(fnbuf);
-	if (tc)
-		fclose(tc);
-	return status;
-}
-
-
-int ThumbCacheGet(int nitems, unsigned int *offsets,
-				  LPTCENTRY *entries, gdImagePtr *thumbs) {
-	unsigned char *thumbdata, *thumbbuf;
-	LPTCENTRY ptcent;
-	TCENTRY tcent;
-	int i, nsuccess;
-	FILE *file;
-
-	if (!offsets || !entries || !thumbs)
-		return 0;
-
-	nsuccess = 0;
-
-	if (burstmode) {
-		for (i = 0; i != nitems; i++) {
-			ptcent    = (LPTCENTRY)((char *)cachemap.addr + offsets[i]);
-			thumbdata = (unsigned char *)ptcent + sizeof(TCENTRY) + ptcent->fnlen + 1;
-			if (ptcent->thumbfsize >= THUMB_MAX_SIZE) {
-				entries[i] = NULL;
-				thumbs[i]  = NULL;
-				fprintf(stderr, "WARNING: thumb filesize too big, ignoring\n");
-				continue;
-			}
-
-			thumbs[i] = gdImageCreateFromPngPtr(ptcent->thumbfsize, thumbdata);
-			if (!thumbs[i]) {
-				entries[i] = NULL;		
-				continue;
-			}
-
-			entries[i] = ptcent;
-			nsuccess++;
-		}
-	} else {
-		file = fopen(thumb_cache_fn, "rb");
-		if (!file)
-			return 0;
-
-		nsuccess = 0;
-		for (i = 0; i != nitems; i++) {
-			thumbs[i]  = NULL;
-			entries[i] = NULL;
-
-			if (fseek(file, offsets[i], SEEK_SET))
-				continue;
-
-			fread(&tcent, sizeof(TCENTRY), 1, file);
-			if (ferror(file))
-				continue;
-
-			if (tcent.thumbfsize >= THUMB_MAX_SIZE) {
-				fprintf(stderr, "WARNING: thumb filesize too big, ignoring\n");
-				continue;
-			}
-			
-			ptcent = malloc(sizeof(TCENTRY) + tcent.fnlen + 1);
-			memcpy(ptcent, &tcent, sizeof(TCENTRY));
-			fread(ptcent->filename, 1, tcent.fnlen + 1, file);
-			if (ferror(file)) {
-				free(ptcent);			
-				continue;
-			}
-
-			thumbbuf = malloc(tcent.thumbfsize);
-			fread(thumbbuf, tcent.thumbfsize, 1, file);
-			if (ferror(file)) {
-				free(ptcent);
-				free(thumbbuf);
-				continue;
-			}
-
-			thumbs[i] = gdImageCreateFromPngPtr(tcent.thumbfsize, thumbbuf);
-			free(thumbbuf);
-			if (!thumbs[i]) {
-				free(ptcent);		
-				continue;
-			}
-
-			entries[i] = ptcent;
-			nsuccess++;
-		}
-		fclose(file);
-	}
-	return nsuccess;
-}
-
-
-LPTCENTRY ThumbCacheLookup(unsigned int offset) {
-	LPTCENTRY ptcent;
-	TCENTRY entry;
-	FILE *file;
-
-	if (burstmode)
-		return (LPTCENTRY)((char *)cachemap.addr + offset);
-
-	ptcent = NULL;
-
-	file = fopen(thumb_cache_fn, "rb");
-	if (!file)
-		goto end;
-
-	if (fseek(file, offset, SEEK_SET))
-		goto end;
-
-	if (!fread(&entry, sizeof(TCENTRY), 1, file))
-		goto end;
-
-	ptcent = malloc(sizeof(TCENTRY) + entry.fnlen + 1);
-	memcpy(ptcent, &entry, sizeof(TCENTRY));
-	fread(ptcent->filename, entry.fnlen + 1, 1, file);
-	if (ferror(file)) {
-		free(ptcent);
-		ptcent = NULL;
-		goto end;
-	}
-
-end:
-	if (file)
-		fclose(file);
-	return ptcent;
-}
-
-
-void ThumbCacheEnumerate(int level) {
-	LPTCHEADER ptchdr;
-	LPTCENTRY ptcent;
-	unsigned char *thumbdata;
-	unsigned int pos;
-	gdImagePtr thumb;
-	int nentries = 0, ndelentries = 0;
-
-	if (!ThumbCacheBurstReadBegin(0)) {
-		fprintf(stderr, "ERROR: failed to open cache for mapping\n");
-		return;
-	}
-
-	if (level >= TC_DUMP_IMGS) {
-		if (!outpath[0]) {
-			fprintf(stderr, "ERROR: must specify an output path\n");
-			return;
-		}
-		if (createdir(outpath) == -1 && errno != EEXIST) {
-			perror("mkdir");
-			return;
-		}
-		if (chdir(outpath) == -1) {
-			perror("chdir");
-			return;
-		}
-	}
-
-	ptchdr = (LPTCHEADER)cachemap.addr;
-
-	if (level >= TC_DUMP_INFO) {
-		printf("Directory last modified: %s"
-			"Thumb cache entries:\n"
-			"file                      "
-			"thumb key\tthumb len\tlast modified\n",
-			asctime(localtime(&ptchdr->lastupdate)));
-	}
-
-	pos = sizeof(TCHEADER);
-	while (pos < cachemap.maplen) {
-		ptcent = (LPTCENTRY)((char *)cachemap.addr + pos);
-
-		if (ptcent->mtime != TC_MTIME_DELETED) {
-			if (level >= TC_DUMP_INFO) {
-				printf("%-26s%f\t%d\t%s", ptcent->filename, ptcent->thumbkey,
-					ptcent->thumbfsize, asctime(localtime(&ptcent->mtime)));
-			}
-
-			if (level >= TC_DUMP_IMGS) {
-				thumbdata = (unsigned char *)ptcent + sizeof(TCENTRY) + ptcent->fnlen + 1;
-				thumb = gdImageCreateFromPngPtr(ptcent->thumbfsize, thumbdata);
-				if (!thumb) {
-					fprintf(stderr, "ERROR: failed to create image from thumbcache\n");
-					continue;
-				}
-
-				if (!ImgSavePng(ptcent->filename, thumb)) {
-					if (errno == ENOENT) {
-						if (verbose) 
-							printf("creating directory structure for %s\n", ptcent->filename);
-						if (!BuildPath(ptcent->filename)) {
-							fprintf(stderr, "ERROR: failed to build "
-								"directory to %s\n", ptcent->filename);
-							gdImageDestroy(thumb);
-							continue;
-						}
-						if (!ImgSavePng(ptcent->filename, thumb)) {
-							fprintf(stderr, "ERROR: failed to save %s after "
-								"building directory\n", ptcent->filename);
-							gdImageDestroy(thumb);
-							continue;
-						}
-					} else {
-						fprintf(stderr, "ERROR: failed to save %s\n", ptcent->filename);
-						gdImageDestroy(thumb);
-						continue;
-					}
-				}
-				gdImageDestroy(thumb);
-			}
-			nentries++;
-		} else {
-			ndelentries++;
-		}
-		pos += sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
-	}
-
-	if (level >= TC_DUMP_IMGS && chdir(workdir) == -1) {
-		perror("chdir");
-		return;
-	}
-
-	printf("Number of thumb cache entries: %d\n"
-		"Number of deleted thumb cache entries: %d\n",
-		nentries, ndelentries);
-
-	ThumbCacheBurstReadEnd();
-
-}
-
-
-/*
- * N.B.
- * When not in burst mode, the caller must free(dupfns[i] - sizeof(TCRECORD))
- */
-int ThumbFindMatches(const char *filename, LPTCENTRY *dupents,
-					 unsigned int *dupoffs, unsigned int nmaxdups) {
-	int nitems, i, j, status, res;
-	gdImagePtr img, *thumbs;
-	unsigned int *offsets, dups;
-	float key, delta;
-	LPTCRECORD ptcrec;
-	LPTCENTRY ptcent;
-	KVPAIR *matches;
-	LPTCENTRY *entries;
-	char *fn = NULL;
-
-	if (!filename || !dupents || !dupoffs)
-		return -1;
-
-	img     = NULL;
-	matches = NULL;
-
-	if (!thumbbpt) {
-		thumbbpt = BptOpen(thumb_btree_fn);
-		if (!thumbbpt)
-			return -1;
-	}
-	
-	status = -1;
-
-	img = ThumbCreate(filename, NULL);
-	if (!img) {
-		fprintf(stderr, "ERROR: couldn't create thumbnail\n");
-		goto end;
-	}
-
-	key = _ThumbCalcKey(img->tpixels);
-
-	//(x + y)^2 - x^2 = 2xy + y^2
-	delta = (6.f * (float)sqrt(key / 3.f) * DIFF_TOLERANCE) + (DIFF_TOLERANCE * DIFF_TOLERANCE);
-
-	nitems = BptSearchRange(thumbbpt, key - delta, key + delta, &matches);
-	if (nitems == BT_ERROR) {
-		fprintf(stderr, "ERROR: tree lookup failure\n");
-		goto end;
-	}
-	if (nitems == BT_NOTFOUND) {
-		fprintf(stderr, "ERROR: no items found\n");
-		goto end;
-	}
-
-	offsets = alloca(nitems * sizeof(unsigned int));
-	thumbs  = alloca(nitems * sizeof(gdImagePtr));
-	entries = alloca(nitems * sizeof(LPTCENTRY));
-
-	j = 0;
-	for (i = 0; i != nitems; i++) {
-		if (matches[i].key == key) {
-			if (cacheht) {
-				if (!fn)
-					fn = HtGetItem(cacheht, filename);
-				if (fn) {
-					ptcrec = (LPTCRECORD)(fn - sizeof(TCRECORD));
-					if (matches[i].val == ptcrec->offset)
-						continue;
-				}
-			} else {
-				ptcent = ThumbCacheLookup(matches[i].val);
-				if (!ptcent) {
-					fprintf(stderr, "WARNING: tree contained invalid offset\n");
-					continue;
-				}
-				res = strcmp(ptcent->filename, filename);
-				if (!burstmode)
-					free(ptcent);
-				if (!res)
-					continue;
-			}
-		}
-		offsets[j] = matches[i].val;
-		j++;
-	} 
-
-	if (!j)
-		return 0;
-
-	status = ThumbCacheGet(j, offsets, entries, thumbs);
-
-	if (!status) {
-		fprintf(stderr, "ERROR: failed to read thumbnails from cache\n");
-		goto end;
-	}
-
-	dups = 0;
-	for (i = 0; i != j; i++) {
-		if (!thumbs[i]) {
-			fprintf(stderr, "WARNING, couldn't get thumb\n");
-			continue;
-		}
-		if (ImgCompareFuzzy(img, thumbs[i])) {
-			if (dups >= nmaxdups) {
-				fprintf(stderr, "WARNING: too many matches (>= %d), "
-					"dropping others\n", nmaxdups);
-				for (; i != j; i++) {
-					if (burstmode)
-						free(entries[i]);
-					gdImageDestroy(thumbs[i]);
-				}
-				break;
-			}
-			dupents[dups] = entries[i];
-			dupoffs[dups] = offsets[i];
-			dups++;
-		}
-		gdImageDestroy(thumbs[i]); ///we might need to keep this on hand later for displaying, maybe?
-	}
-
-	status = dups;
-
-end:
-	if (matches)
-		free(matches);
-	if (img)
-		gdImageDestroy(img);
-	return status;
-}
-
-
-unsigned int _ThumbCacheWriteEntry(FILE *tc, LPTCENTRY ptcent,
-						  const char *filename, void *thumbdata) {
-	unsigned int fileoffset, len;
-	unsigned char padding[ALIGN_BYTES];
-	int padlen;
-
-	len = strlen(filename);
-	if (!len || len > UCHAR_MAX)
-		return 0;
-
-	padlen = (ALIGN_BYTES - ((ptcent->thumbfsize + len + 1) & ALIGN_MASK)) & ALIGN_MASK;
-	memset(padding, 0, padlen);
-
-	ptcent->thumbfsize += padlen;
-	ptcent->fnlen       = (unsigned char)len;
-
-	fileoffset = ftell(tc);
-	fwrite(ptcent, sizeof(TCENTRY), 1, tc);
-	fwrite(filename, 1, len + 1, tc);
-	fwrite(thumbdata, ptcent->thumbfsize - padlen, 1, tc);
-	fwrite(padding, 1, padlen, tc);
-	if (ferror(tc))
-		return 0;
-
-	return fileoffset;
-}
-
-
-int _ThumbCacheUpdateStructures(const char *filename, LPTCENTRY ptcent,
-								unsigned int offset, int update) {
-	const char *fn;
-	LPTCRECORD ptcrec;
-
-	if (!thumbbpt) {
-		thumbbpt = BptOpen(thumb_btree_fn);
-		if (!thumbbpt)
-			return 0;
-	}
-
-	if (!BptInsert(thumbbpt, ptcent->thumbkey, offset))
-		return 0;
-
-	if (cacheht) {
-		if (!update) {
-			ptcrec = malloc(sizeof(TCRECORD) + ptcent->fnlen + 1);
-			ptcrec->offset = offset;
-			memcpy(&ptcrec->ent, ptcent, sizeof(TCENTRY));
-			memcpy(&ptcrec->ent.filename, filename, ptcent->fnlen + 1);
-
-			HtInsertItem(cacheht, ptcrec->ent.filename, ptcrec->ent.filename);
-		} else {
-			fn = HtGetItem(cacheht, filename);
-			if (!fn)
-				return 0;
-
-			ptcrec = (LPTCRECORD)(fn - sizeof(TCRECORD));
-			ptcrec->offset = offset;
-			memcpy(&ptcrec->ent, ptcent, sizeof(TCENTRY));
-		}
-	}
-
-	return 1;
-}
-
-
-int ThumbCacheFlush() {
-	if (thumbbpt)
-		BptClose(thumbbpt);
-	if (cacheht)
-		HtResetContents(cacheht);
-
-#ifdef _WIN32
-	if (!DeleteFile(thumb_btree_fn)) {
-		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
-			thumb_btree_fn, GetLastError());
-	}
-	if (!DeleteFile(thumb_cache_fn)) {
-		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
-			thumb_cache_fn, GetLastError());
-	}
-#else
-	if (remove(thumb_btree_fn) == -1)
-		perror("remove thumb_btree_fn");
-	if (remove(thumb_cache_fn) == -1)
-		perror("remove thumb_cache_fn");
-#endif
-	return 1;
-}
-
-
-void _ThumbCacheBuildHt(FILE *tc) {
-	LPTCRECORD ptcrec;
-	TCENTRY entry;
-	int reclen;
-
-	if (cacheht)
-		HtResetContents(cacheht);
-	else
-		cacheht = HtInit(4096, 0, HT_HASH_DEFAULT, 4);
-
-	while (fread(&entry, sizeof(TCENTRY), 1, tc)) {
-		if (entry.mtime != TC_MTIME_DELETED) {
-			reclen = sizeof(TCRECORD) + entry.fnlen + 1;
-			ptcrec = malloc(reclen);
-
-			ptcrec->offset = ftell(tc) - sizeof(TCENTRY);
-			ptcrec->ent    = entry;
-			if (!fread(ptcrec->ent.filename, entry.fnlen + 1, 1, tc)) {
-				fprintf(stderr, "ERROR: failed to read filename from thumb cache\n");
-				return;
-			}
-			fseek(tc, entry.thumbfsize, SEEK_CUR);
-
-			HtInsertItem(cacheht, ptcrec->ent.filename, ptcrec->ent.filename);
-		}
-	}
-}
-
-
-int ThumbCacheUpdate() {
-	TCHEADER tch;
-	int status = 0;
-	time_t dirlastmod;
-	FILE *tc;
-
-	if (verbose)
-		printf(" - Updating thumb cache\n");
-
-	tc = fopen(thumb_cache_fn, "rb+");
-	if (!tc) {
-		if (errno == ENOENT) {
-			tc = fopen(thumb_cache_fn, "wb+");
-			if (!tc) {
-				perror("fopen wb+");
-				return 0;
-			}
-
-			tch.signature  = 'TMBC';
-			tch.lastupdate = 0;
-			fwrite(&tch, sizeof(TCHEADER), 1, tc);
-			
-			tc = freopen(thumb_cache_fn, "rb+", tc);
-			if (!tc) {
-				perror("freopen rb+");
-				return 0;
-			}
-		} else {
-			perror("fopen rb+");
-			return 0;
-		}
-	}
-
-	fread(&tch, sizeof(TCHEADER), 1, tc);
-
-	if (tch.signature != 'TMBC') {
-		fprintf(stderr, "ERROR: thumbcache signature does not match\n");
-		goto done;
-	}
-	
-	dirlastmod = GetLastWriteTime(".");
-	if (tch.lastupdate >= dirlastmod) {
-		if (tch.lastupdate > dirlastmod) {
-			fprintf(stderr, "WARNING: thumbcache recorded last "
-				"mtime > directory last mtime\n");
-		}
-		if (verbose)
-			printf("Cache is up-to-date.\n");
-		
-		status = 1;
-		goto done;
-	}
-	
-	_ThumbCacheBuildHt(tc);
-
-	if (fseek(tc, sizeof(TCHEADER) - sizeof(time_t), SEEK_SET) == -1) {
-		perror("fseek");
-		goto done;
-	}
-	fwrite(&dirlastmod, sizeof(time_t), 1, tc);
-
-	_ThumbCacheUpdateDirScan(tc, "");
-
-	printf("Added %d entries successfully.\n", nadded);
-
-	status = 1;
-done:
-	if (tc)
-		fclose(tc);
-	return status;
-}
-
-
-void _ThumbCacheUpdateDirScan(FILE *tc, const char *dir) {
-	unsigned int status;
-	LPTCRECORD ptcrec;
-	char *fn, relfn[MAX_PATH];
-	int dirlen, len;
-	time_t mtime;
-#ifdef _WIN32
-	HANDLE hFindFile;
-	WIN32_FIND_DATA ffd;
-#else
-	DIR *dirp;
-	struct stat st;
-	struct dirent *entry;
-#endif
-
-	dirlen = strlen(dir);
-	if (dirlen + 3 >= MAX_PATH) {
-		fprintf(stderr, "ERROR: filename too long\n");
-		return;
-	}
-
-	strcpy(relfn, dir);
-#ifdef _WIN32
-	strcpy(relfn + dirlen, "*");
-	hFindFile = FindFirstFile(relfn, &ffd);
-	if (hFindFile == INVALID_HANDLE_VALUE) {
-		status = GetLastError();
-		if (status != ERROR_FILE_NOT_FOUND)
-			printerr("FindFirstFile");
-		return;
-	}
-
-	do {
-		fn = ffd.cFileName;
-		if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && scan_recursive) {
-#else
-	dirp = opendir(relfn);
-	if (!dirp) {
-		perror("opendir");
-		return;
-	}
-
-	while ((entry = readdir(dirp))) {
-		if (lstat(entry->d_name, &st) == -1) {
-			fprintf(stderr, "ERROR: couldn't stat %s, skipping\n", fn);
-			continue;
-		}
-
-		fn = entry->d_name;
-		if (S_ISDIR(st.st_mode) && scan_recursive) {
-#endif
-			if (!(fn[0] == '.' && (!fn[1] || (fn[1] == '.' && !fn[2])))) {
-				len = dirlen + strlen(fn);
-				if (len + 1 >= MAX_PATH) {
-					fprintf(stderr, "ERROR: total rel path len of "
-						"%s too long, skipping\n", fn);
-					continue;
-				}
-
-				strcpy(relfn + dirlen, fn);
-				relfn[len]     = PATH_SEPARATOR;
-				relfn[len + 1] = '\0';
-
-				_ThumbCacheUpdateDirScan(tc, relfn);
-			}
-		} else if (ImgIsImageFile(fn)) {
-			len = dirlen + strlen(fn);
-			if (len >= MAX_PATH) {
-				fprintf(stderr, "ERROR: total rel path len of "
-					"%s too long, skipping\n", fn);
-				continue;
-			}
-
-#ifdef _WIN32
-			mtime = FileTimeToUnixTime(ffd.ftLastWriteTime);
-#else
-			mtime = st.st_mtime;
-#endif
-			strcpy(relfn + dirlen, fn);
-			fn = HtGetItem(cacheht, relfn);
-			if (fn) {
-				ptcrec = (LPTCRECORD)(fn - sizeof(TCRECORD));
-				if (mtime != ptcrec->ent.mtime) {
-					if (verbose)
-						printf("Updating %s...\n", relfn);
-					if (!ThumbCacheReplace(tc, relfn, ptcrec, mtime))
-						printerr("ThumbCacheReplace");
-				}
-			} else {
-				if (verbose)
-					printf("Adding %s to thumb cache...\n", relfn);
-				if (!ThumbCacheAdd(tc, relfn, mtime))
-					printerr("ThumbCacheAdd");
-				else
-					nadded++;
-			}
-		}
-#ifdef _WIN32
-	} while (FindNextFile(hFindFile, &ffd));
-	
-	FindClose(hFindFile);
-#else
-	}
-
-	if (closedir(dirp) == -1)
-		perror("closedir");
-#endif
-}
-
-
-float _ThumbCalcKey(int **tpixels) {
-	unsigned int tr, tg, tb;
-	float avg_r, avg_g, avg_b;
-	int pixel, x, y;
-
-	tr = 0;
-	tg = 0;
-	tb = 0;
-
-	for (y = 0; y != THUMB_CY; y++) {
-		for (x = 0; x != THUMB_CX; x++) {
-			pixel = tpixels[y][x];
-			tr += gdTrueColorGetRed(pixel);
-			tg += gdTrueColorGetGreen(pixel);
-			tb += gdTrueColorGetBlue(pixel);
-
-		}
-	}
-
-	avg_r = (float)tr / (float)THUMB_NPIXELS;
-	avg_g = (float)tg / (float)THUMB_NPIXELS;
-	avg_b = (float)tb / (float)THUMB_NPIXELS;
-
-	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
-}
-
-
-#ifdef _WIN32
-
-float _ThumbCalcKeyAsm(int **tpixels) {
-	unsigned int tr, tg, tb;
-	float avg_r, avg_g, avg_b;
-
-	__asm {
-		push ebx
-		push esi
-		push edi
-		push ebp
-
-		xor eax, eax
-		xor esi, esi
-		xor edi, edi
-
-		mov ebp, tpixels
-
-		push THUMB_CY //temporary stack allocations
-		push ebp      //
-
-		loopy:
-			mov ebp, [esp]
-			mov ecx, [esp + 4]
-			mov ebp, [ebp + ecx * 4 - 4]
-
-			mov ecx, THUMB_CX
-			loopx:
-				mov edx,  [ebp + ecx * 4 - 4]
-				
-				movzx ebx, dl
-				add eax, ebx
-				movzx ebx, dh
-				add esi, ebx
-				shr edx, 16
-				movzx ebx, dl
-				add edi, ebx
-
-				dec ecx
-			jne loopx
-
-			dec dword ptr [esp + 4]
-		jne loopy
-
-		pop ebp
-		pop ebp
-		pop ebp
-
-		mov tb, edi
-		mov tg, esi
-		mov tr, eax
-		
-		pop edi
-		pop esi
-		pop ebx
-	}
-
-	avg_r = (float)tr / (float)THUMB_NPIXELS;
-	avg_g = (float)tg / (float)THUMB_NPIXELS;
-	avg_b = (float)tb / (float)THUMB_NPIXELS;
-
-	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
-}
-
-
-float _ThumbCalcKeySSE(int **tpixels) {
-	unsigned int tr, tg, tb;
-	float avg_r, avg_g, avg_b;
-
-	__asm {
-		//xmm0 - blue accum
-		//xmm1 - green accum
-		//xmm2 - red accum
-		//xmm3 - work reg
-		//xmm4 - pixels
-		//xmm5 - AND mask
-
-		pxor xmm0, xmm0
-		pxor xmm1, xmm1
-		pxor xmm2, xmm2
-
-		mov eax, 0xFF
-		movd xmm5, eax
-		pshufd xmm5, xmm5, 0
-
-		mov esi, tpixels
-		mov ecx, 0x4010
-		loopy:
-			mov edi, [esi]
-			//prefetchnta [edi + 128]
-			loopx:
-				movdqu xmm4, [edi]
-				
-				movdqa xmm3, xmm4
-				andps xmm3, xmm5
-				paddd xmm0, xmm3
-
-				movdqa xmm3, xmm4
-				psrld xmm3, 8
-				andps xmm3, xmm5
-				paddd xmm1, xmm3
-
-				movdqa xmm3, xmm4
-				psrld xmm3, 16
-				paddd xmm2, xmm3
-
-				add edi, 16
-				dec cl
-			jnz loopx
-			add esi, 4
-			mov cl, 16
-			dec ch
-		jnz loopy
-
-	}
-
-	avg_r = (float)tr / (float)THUMB_NPIXELS;
-	avg_g = (float)tg / (float)THUMB_NPIXELS;
-	avg_b = (float)tb / (float)THUMB_NPIXELS;
-
-	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
-}
-
-#endif
-
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 
+ * thumb.c - 
+ *    Contains routines pertaining to thumbnail cache
+ */
+
+#include "main.h"
+#include "stats.h"
+#include "mmfile.h"
+#include "bptree.h"
+#include "hashdb.h"
+#include "pathdict.h"
+#include "img.h"
+#include "hist.h"
+#include "hashtable.h"
+#include "lru.h"
+#include "thumb.h"
+
+#ifdef THUMB_USE_LIBPNG
+#	include <png.h>
+
+typedef struct _pngsrc {
+	const unsigned char *data;
+	png_size_t len;
+	png_size_t pos;
+} PNGSRC, *LPPNGSRC;
+
+void _ThumbPngRead(png_structp png, png_bytep buf, png_size_t len);
+int _ThumbDecodePngRows(unsigned int size, void *data, gdImagePtr thumb);
+#endif
+
+char thumb_btree_fn[256] = "thumbindex.db";
+char thumb_cache_fn[256] = "thumbcache.db";
+char thumb_names_fn[256] = "thumbnames.db";
+char thumb_hashes_fn[256] = "thumbhashes.db";
+char thumb_pixels_fn[256] = "thumbpixels.db";
+char thumb_dirs_fn[256]   = "thumbdirs.db";
+int thumb_lru_size = THUMB_LRU_SIZE;
+
+int _ThumbFindHistMatches(LPTHUMBCACHE cache, LPTHUMBQUERY query, unsigned int selfoffset,
+						  LPTCENTRY *dupents, unsigned int *dupoffs, unsigned int ndups,
+						  unsigned int nmaxdups, LPQUERYSAMPLE sample);
+
+
+//the entry at offset, if the cache is mapped far enough to cover all of it; offsets
+//come from the indexes, which can be out of step with the cache file
+static inline LPTCENTRY _ThumbCacheMappedEntry(LPTHUMBCACHE cache, unsigned int offset) {
+	LPFMAPINFO map;
+	LPTCENTRY ptcent;
+
+	map = cache->burstmode ? &cache->cachemap : &cache->namemap;
+	if (!map->addr || offset < sizeof(TCHEADER) || offset + sizeof(TCENTRY) > map->maplen)
+		return NULL;
+
+	ptcent = (LPTCENTRY)((char *)map->addr + offset);
+	if (offset + sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize > map->maplen)
+		return NULL;
+
+	return ptcent;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * Points cache at the cache files kept in dir, or in the working directory if dir is
+ * NULL.  Nothing is opened until it is first used.
+ */
+int ThumbCacheInit(LPTHUMBCACHE cache, const char *dir) {
+	memset(cache, 0, sizeof(THUMBCACHE));
+
+	if (!_ThumbCachePath(cache->btree_fn, sizeof(cache->btree_fn), dir, thumb_btree_fn)   ||
+		!_ThumbCachePath(cache->cache_fn, sizeof(cache->cache_fn), dir, thumb_cache_fn)   ||
+		!_ThumbCachePath(cache->names_fn, sizeof(cache->names_fn), dir, thumb_names_fn)   ||
+		!_ThumbCachePath(cache->hashes_fn, sizeof(cache->hashes_fn), dir, thumb_hashes_fn) ||
+		!_ThumbCachePath(cache->pixels_fn, sizeof(cache->pixels_fn), dir, thumb_pixels_fn) ||
+		!_ThumbCachePath(cache->dirs_fn, sizeof(cache->dirs_fn), dir, thumb_dirs_fn)) {
+		fprintf(stderr, "ERROR: path to thumb cache in %s too long\n", dir);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+int _ThumbCachePath(char *path, size_t len, const char *dir, const char *filename) {
+	size_t dirlen;
+
+	if (!dir || !dir[0] || IsAbsolutePath(filename))
+		return strlcpy(path, filename, len) < len;
+
+	dirlen = strlen(dir);
+	if (dir[dirlen - 1] == PATH_SEPARATOR)
+		dirlen--;
+
+	return snprintf(path, len, "%.*s%c%s", (int)dirlen, dir,
+		PATH_SEPARATOR, filename) < (int)len;
+}
+
+
+//closes whatever is open; cache can be used again afterwards and reopens as needed
+void ThumbCacheClose(LPTHUMBCACHE cache) {
+	ThumbCacheBurstReadEnd(cache);
+
+	//while the tree and indexes holding the entries are still open
+	if (cache->appendbuf) {
+		if (cache->appendlen) {
+			fprintf(stderr, "WARNING: discarding uncommitted thumb cache entries\n");
+			_ThumbCacheAppendDrop(cache);
+		}
+		free(cache->appendbuf);
+		cache->appendbuf  = NULL;
+		cache->appendsize = 0;
+	}
+
+	if (cache->bpt) {
+		BptClose(cache->bpt);
+		cache->bpt = NULL;
+	}
+	if (cache->names) {
+		HdbClose(cache->names);
+		cache->names = NULL;
+	}
+	if (cache->hashes) {
+		HdbClose(cache->hashes);
+		cache->hashes = NULL;
+	}
+	if (cache->pixels) {
+		HdbClose(cache->pixels);
+		cache->pixels = NULL;
+	}
+	if (cache->dirs) {
+		PdClose(cache->dirs);
+		cache->dirs = NULL;
+	}
+	if (cache->namemap.addr)
+		MMFileClose(&cache->namemap);
+	_ThumbMatchCtxFree(&cache->match);
+}
+
+
+int ThumbCacheBurstReadBegin(LPTHUMBCACHE cache, int reinit) {
+	if (reinit) {
+		if (!MMFileClose(&cache->cachemap)) {
+			fprintf(stderr, "ERROR: failed to close thumb cache\n");
+			return 0;
+		}
+		cache->burstmode = 0;
+	}
+
+	if (cache->burstmode)
+		return 1;
+
+	if (!MMFileOpen(cache->cache_fn,	THUMBCACHE_INITIAL_LEN, &cache->cachemap)) {
+		fprintf(stderr, "ERROR: failed to open thumb cache\n");
+		return 0;
+	}
+
+	cache->burstmode = 1;
+
+	return 1;
+}
+
+
+int ThumbCacheBurstReadEnd(LPTHUMBCACHE cache) {
+	LPLRU lru = cache->decoded;
+
+	if (lru) {
+		if (verbose && lru->hits + lru->misses) {
+			printf("Decoded thumbs: %llu reused, %llu decoded (%.1f%% hit rate), %llu evicted\n",
+				(unsigned long long)lru->hits, (unsigned long long)lru->misses,
+				lru->hits * 100.0 / (lru->hits + lru->misses),
+				(unsigned long long)lru->evictions);
+		}
+		LruDestroy(lru);
+		cache->decoded = NULL;
+	}
+
+	if (cache->burstmode) {
+		if (!MMFileClose(&cache->cachemap)) {
+			fprintf(stderr, "ERROR: failed to close thumb cache\n");
+			return 0;
+		}
+		cache->burstmode = 0;
+	}
+
+	return 1;
+}
+
+
+gdImagePtr ThumbCreate(const char *filename, unsigned int *filesize, uint32_t *contenthash) {
+	gdImagePtr pic, im;
+
+	pic = ImgLoadGdScaled(filename, filesize, THUMB_CX, THUMB_CY, contenthash);
+	if (!pic)
+		return NULL;
+
+	im = gdImageCreateTrueColor(THUMB_CX, THUMB_CY);
+	ImgResample(im, pic);
+	gdImageDestroy(pic);
+
+	return im;
+}
+
+
+void _ThumbFlatten(int **tpixels, int mask) {
+	int x, y;
+
+	for (y = 0; y != THUMB_CY; y++) {
+		for (x = 0; x != THUMB_CX; x++)
+			tpixels[y][x] &= mask; //~0x00010101;
+	}
+}
+
+
+/*
+ * Hashes a flattened copy of the thumb, leaving tpixels as it was.  Dropping the low
+ * bits lets re-encodes of the same picture, which only jitter pixels slightly, hash
+ * the same in most cases.
+ */
+void _ThumbCalcPixelHash(int **tpixels, uint32_t *pixelhash) {
+	int flat[THUMB_CY][THUMB_CX], *rows[THUMB_CY];
+	int y;
+
+	for (y = 0; y != THUMB_CY; y++) {
+		memcpy(flat[y], tpixels[y], sizeof(flat[y]));
+		rows[y] = flat[y];
+	}
+	_ThumbFlatten(rows, THUMB_HASH_MASK);
+
+	HtMurmur3Hash128(flat, sizeof(flat), IMG_HASH_SEED, pixelhash);
+}
+
+
+void _ThumbSetInfo(LPTCENTRY ptcent, LPIMGINFO info) {
+	ptcent->width    = info->width;
+	ptcent->height   = info->height;
+	ptcent->filesize = info->filesize;
+	ptcent->format   = (unsigned char)info->format;
+}
+
+
+/*
+ * info is what ImgProbe found for filename, or NULL to have it probed here.
+ * Files that can't be probed are refused before anything gets decoded.
+ */
+int ThumbCacheAdd(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+				  time_t mtime, LPIMGINFO info) {
+	gdImagePtr thumb = NULL;
+	unsigned int thumbsize, offset;
+	void *thumbdata = NULL;
+	IMGINFO probed;
+	TCENTRY tcent;
+	int status = 0, closetc = 0;
+	PROF_DECL(t);
+
+	if (!filename)
+		return 0;
+
+	if (!info) {
+		if (!ImgProbe(filename, &probed))
+			return 0;
+		info = &probed;
+	}
+
+	if (!tc) {
+		closetc = 1;
+		tc = fopen(cache->cache_fn, "rb+");
+		if (!tc)
+			goto end;
+	}
+
+	memset(&tcent, 0, sizeof(tcent));
+
+	thumb = ThumbCreate(filename, NULL, tcent.contenthash);
+	if (!thumb)
+		goto end;
+
+	PROF_BEGIN(t);
+	thumbdata = gdImagePngPtr(thumb, (int *)&thumbsize);
+	PROF_END(t, STAT_PNG_ENCODE, thumbdata ? thumbsize : 0);
+	if (!thumbdata)
+		goto end;
+
+	tcent.mtime      = mtime;
+	tcent.thumbfsize = thumbsize;
+	tcent.thumbkey   = _ThumbCalcKey(thumb->tpixels);
+	_ThumbCalcPixelHash(thumb->tpixels, tcent.pixelhash);
+	HistCalc(thumb->tpixels, tcent.histrgb, tcent.histhsv);
+	_ThumbSetInfo(&tcent, info);
+
+	offset = _ThumbCacheWriteEntry(cache, tc, &tcent, filename, thumbdata, 0);
+	if (!offset)
+		goto end;
+
+	status = _ThumbCacheUpdateStructures(cache, tc, filename, &tcent, offset, 0);
+
+end:
+	if (thumb)
+		gdImageDestroy(thumb);
+	if (thumbdata)
+		gdFree(thumbdata);
+	if (tc && closetc) {
+		if (!ThumbCacheCommit(cache, tc))
+			status = 0;
+		fclose(tc);
+	}
+
+	return status;
+}
+
+
+int ThumbCacheReplace(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+					  LPTCENTRY ptcent, unsigned int offset, time_t mtime, LPIMGINFO info) {
+	void *thumbdata = NULL;
+	gdImagePtr thumb = NULL;
+	unsigned int origoffset, newoffset, slotlen;
+	uint32_t thumbsize;
+	time_t delmtime;
+	IMGINFO probed;
+	TCENTRY tcent;
+	int status = 0, closetc = 0;
+	PROF_DECL(t);
+
+	if (!filename || !ptcent)
+		return 0;
+
+	if (!info) {
+		if (!ImgProbe(filename, &probed))
+			return 0;
+		info = &probed;
+	}
+
+	if (!cache->bpt) {
+		cache->bpt = BptOpen(cache->btree_fn);
+		if (!cache->bpt)
+			return 0;
+	}
+
+	//ptcent may point into a mapping of the cache itself, so work on a copy
+	tcent = *ptcent;
+
+	if (BptRemoveItem(cache->bpt, tcent.thumbkey, offset) <= 0)
+		return 0;
+	if (cache->decoded)
+		LruRemove(cache->decoded, offset);
+
+	if (!cache->hashes && !_ThumbCacheNamesOpen(cache))
+		return 0;
+	HdbRemove(cache->hashes, tcent.contenthash[0], offset);
+	HdbRemove(cache->pixels, tcent.pixelhash[0], offset);
+
+	if (!tc) {
+		closetc = 1;
+		tc = fopen(cache->cache_fn, "rb+");
+		if (!tc)
+			goto fail;
+	}
+	origoffset = ftell(tc);
+
+	//the old entry is rewritten in place, so it can't be left waiting in the buffer
+	if (cache->appendlen && offset >= cache->appendpos && !_ThumbCacheAppendFlush(cache, tc))
+		goto fail;
+
+	thumb = ThumbCreate(filename, NULL, tcent.contenthash);
+	if (!thumb)
+		goto fail;
+
+	PROF_BEGIN(t);
+	thumbdata = gdImagePngPtr(thumb, (int *)&thumbsize);
+	PROF_END(t, STAT_PNG_ENCODE, thumbdata ? thumbsize : 0);
+	if (!thumbdata)
+		goto fail;
+
+	if (thumbsize <= tcent.thumbfsize) {
+		//reuse the old slot; the trailing bytes after the PNG are zeroed
+		slotlen = tcent.thumbfsize;
+		if (fseek(tc, offset, SEEK_SET))
+			goto fail;
+	} else {
+		//doesn't fit, mark the old entry deleted and append a new one
+		slotlen  = 0;
+		delmtime = TC_MTIME_DELETED;
+		if (fseek(tc, offset + offsetof(TCENTRY, mtime), SEEK_SET))
+			goto fail;
+		fwrite(&delmtime, sizeof(delmtime), 1, tc);
+	}
+	tcent.mtime      = mtime;
+	tcent.thumbfsize = thumbsize;
+	tcent.thumbkey   = _ThumbCalcKey(thumb->tpixels);
+	_ThumbCalcPixelHash(thumb->tpixels, tcent.pixelhash);
+	HistCalc(thumb->tpixels, tcent.histrgb, tcent.histhsv);
+	_ThumbSetInfo(&tcent, info);
+
+	newoffset = _ThumbCacheWriteEntry(cache, tc, &tcent, filename, thumbdata, slotlen);
+	if (!newoffset)
+		goto fail;
+
+	status = _ThumbCacheUpdateStructures(cache, tc, filename, &tcent, newoffset, offset);
+
+fail:
+	if (tc) {
+		if (closetc) {
+			if (!ThumbCacheCommit(cache, tc))
+				status = 0;
+			fclose(tc);
+		} else
+			fseek(tc, origoffset, SEEK_SET);
+	}
+	if (thumb)
+		gdImageDestroy(thumb);
+	if (thumbdata)
+		gdFree(thumbdata);
+	return status;
+}
+
+
+int ThumbCacheRemove(LPTHUMBCACHE cache, unsigned int offset) {
+	uint32_t contenthash, pixelhash, dirid;
+	char *filename, path[MAX_PATH];
+	unsigned int fnlen;
+	float thumbkey;
+	int status  = 0;
+	FILE *tc    = NULL;
+	char *fnbuf = NULL;
+
+	if (cache->burstmode) {
+		LPTCENTRY ptcent;
+	
+		ptcent = _ThumbCacheMappedEntry(cache, offset);
+		if (!ptcent)
+			return 0;
+
+		ptcent->mtime = TC_MTIME_DELETED;
+		if (cache->decoded)
+			LruRemove(cache->decoded, offset);
+
+		thumbkey    = ptcent->thumbkey;
+		contenthash = ptcent->contenthash[0];
+		pixelhash   = ptcent->pixelhash[0];
+		dirid       = ptcent->dirid;
+		fnlen       = ptcent->fnlen;
+		filename    = ptcent->filename;
+	} else {
+		TCENTRY entry;
+
+		tc = fopen(cache->cache_fn, "rb+");
+		if (!tc)
+			return 0;
+
+		if (fseek(tc, offset, SEEK_SET) == -1)
+			goto end;
+		if (!fread(&entry, sizeof(TCENTRY), 1, tc))
+			goto end;
+		fnbuf = malloc(entry.fnlen + 1);
+		if (!fread(fnbuf, entry.fnlen + 1, 1, tc))
+			goto end;
+
+		if (fseek(tc, offset, SEEK_SET) == -1)
+			goto end;
+		entry.mtime = TC_MTIME_DELETED;
+		fwrite(&entry, sizeof(TCENTRY), 1, tc);
+
+		thumbkey    = entry.thumbkey;
+		contenthash = entry.contenthash[0];
+		pixelhash   = entry.pixelhash[0];
+		dirid       = entry.dirid;
+		fnlen       = entry.fnlen;
+		filename    = fnbuf;
+	}
+
+	if (!cache->bpt) {
+		cache->bpt = BptOpen(cache->btree_fn);
+		if (!cache->bpt)
+			goto end;
+	}
+
+	if (BptRemoveItem(cache->bpt, thumbkey, offset) <= 0)
+		goto end;
+
+	if (!cache->names && !_ThumbCacheNamesOpen(cache))
+		goto end;
+
+	if (PdJoin(cache->dirs, dirid, filename, fnlen, path, sizeof(path)))
+		HdbRemove(cache->names, HtDefaultHash(path, strlen(path)), offset);
+	HdbRemove(cache->hashes, contenthash, offset);
+	HdbRemove(cache->pixels, pixelhash, offset);
+
+	status = 1;
+end:
+	if (fnbuf)
+		free(fnbuf);
+	if (tc)
+		fclose(tc);
+	return status;
+}
+
+
+/*
+ * A thumbs[i] that isn't NULL on entry is a THUMB_CX x THUMB_CY true color image of
+ * the caller's to decode the thumb into, and is set to NULL if that fails.  The rest
+ * get new images.  When not in burst mode, entries[i] are read into the cache's
+ * scratch space and only stay valid until the next call, so the caller copies out
+ * any it keeps.
+ */
+int ThumbCacheGet(LPTHUMBCACHE cache, int nitems, unsigned int *offsets,
+				  LPTCENTRY *entries, gdImagePtr *thumbs) {
+	LPMATCHCTX ctx = &cache->match;
+	unsigned char *thumbbuf, *entbuf;
+	gdImagePtr thumb;
+	LPTCENTRY ptcent;
+	TCENTRY tcent;
+	int i, nsuccess;
+	FILE *file;
+
+	if (!offsets || !entries || !thumbs)
+		return 0;
+
+	nsuccess = 0;
+
+	if (cache->burstmode) {
+		if (!cache->decoded && thumb_lru_size > 0)
+			cache->decoded = LruInit(thumb_lru_size * 1048576ULL / THUMB_LRU_ITEM_SIZE, free);
+
+		for (i = 0; i != nitems; i++) {
+			ptcent = _ThumbCacheMappedEntry(cache, offsets[i]);
+			if (!ptcent) {
+				entries[i] = NULL;
+				thumbs[i]  = NULL;
+				fprintf(stderr, "WARNING: index contained invalid offset %u, ignoring\n",
+					offsets[i]);
+				continue;
+			}
+			if (ptcent->thumbfsize >= THUMB_MAX_SIZE) {
+				entries[i] = NULL;
+				thumbs[i]  = NULL;
+				fprintf(stderr, "WARNING: thumb filesize too big, ignoring\n");
+				continue;
+			}
+
+			thumbs[i] = _ThumbCacheDecode(cache, offsets[i], ptcent, thumbs[i]);
+			if (!thumbs[i]) {
+				entries[i] = NULL;		
+				continue;
+			}
+
+			entries[i] = ptcent;
+			nsuccess++;
+		}
+	} else {
+		if ((unsigned int)nitems > ctx->entslots) {
+			entbuf = realloc(ctx->entbuf, nitems * THUMB_ENTRY_SLOT);
+			if (!entbuf)
+				return 0;
+			ctx->entbuf   = entbuf;
+			ctx->entslots = nitems;
+		}
+
+		file = fopen(cache->cache_fn, "rb");
+		if (!file)
+			return 0;
+
+		nsuccess = 0;
+		for (i = 0; i != nitems; i++) {
+			thumb      = thumbs[i];
+			thumbs[i]  = NULL;
+			entries[i] = NULL;
+
+			if (fseek(file, offsets[i], SEEK_SET))
+				continue;
+
+			fread(&tcent, sizeof(TCENTRY), 1, file);
+			if (ferror(file))
+				continue;
+
+			if (tcent.thumbfsize >= THUMB_MAX_SIZE) {
+				fprintf(stderr, "WARNING: thumb filesize too big, ignoring\n");
+				continue;
+			}
+			
+			ptcent = (LPTCENTRY)(ctx->entbuf + i * THUMB_ENTRY_SLOT);
+			memcpy(ptcent, &tcent, sizeof(TCENTRY));
+			fread(ptcent->filename, 1, tcent.fnlen + 1, file);
+			if (ferror(file))
+				continue;
+
+			//read into a buffer kept with the cache, which only grows
+			if (tcent.thumbfsize > ctx->readlen) {
+				thumbbuf = realloc(ctx->readbuf, tcent.thumbfsize);
+				if (!thumbbuf)
+					continue;
+				ctx->readbuf = thumbbuf;
+				ctx->readlen = tcent.thumbfsize;
+			}
+			fread(ctx->readbuf, tcent.thumbfsize, 1, file);
+			if (ferror(file))
+				continue;
+
+			thumbs[i] = _ThumbDecodePng(tcent.thumbfsize, ctx->readbuf, thumb);
+			if (!thumbs[i])
+				continue;
+
+			entries[i] = ptcent;
+			nsuccess++;
+		}
+		fclose(file);
+	}
+	return nsuccess;
+}
+
+
+/*
+ * Decodes the thumb of the mapped entry at offset, into thumb if given or else a new
+ * image.  Those of a cache in burst mode are decoded once and their pixels kept in
+ * cache->decoded, which later calls copy from for as long as they stay in it.
+ */
+gdImagePtr _ThumbCacheDecode(LPTHUMBCACHE cache, unsigned int offset, LPTCENTRY ptcent,
+							 gdImagePtr thumb) {
+	unsigned char *thumbdata;
+	int *pixels;
+	int y;
+
+	if (cache->decoded) {
+		pixels = LruGet(cache->decoded, offset);
+		if (pixels) {
+			PROF_COUNT(thumbhits);
+			if (!thumb) {
+				thumb = gdImageCreateTrueColor(THUMB_CX, THUMB_CY);
+				if (!thumb)
+					return NULL;
+			}
+			for (y = 0; y != THUMB_CY; y++)
+				memcpy(thumb->tpixels[y], pixels + y * THUMB_CX, THUMB_CX * sizeof(int));
+			return thumb;
+		}
+		PROF_COUNT(thumbmisses);
+	}
+
+	thumbdata = (unsigned char *)ptcent + sizeof(TCENTRY) + ptcent->fnlen + 1;
+	thumb = _ThumbDecodePng(ptcent->thumbfsize, thumbdata, thumb);
+	if (!thumb || !cache->decoded || !thumb->tpixels ||
+		gdImageSX(thumb) != THUMB_CX || gdImageSY(thumb) != THUMB_CY)
+		return thumb;
+
+	pixels = malloc(THUMB_NPIXELS * sizeof(int));
+	if (pixels) {
+		for (y = 0; y != THUMB_CY; y++)
+			memcpy(pixels + y * THUMB_CX, thumb->tpixels[y], THUMB_CX * sizeof(int));
+		LruInsert(cache->decoded, offset, pixels);
+	}
+	return thumb;
+}
+
+
+//decodes a thumb's PNG into thumb, a THUMB_CX x THUMB_CY true color image, if given
+gdImagePtr _ThumbDecodePng(unsigned int size, void *data, gdImagePtr thumb) {
+	gdImagePtr img;
+	int y;
+
+#ifdef THUMB_USE_LIBPNG
+	if (thumb) {
+		switch (_ThumbDecodePngRows(size, data, thumb)) {
+			case 1:
+				return thumb;
+			case -1:
+				return NULL;
+		}
+	}
+#endif
+
+	img = gdImageCreateFromPngPtr(size, data);
+	if (!img || !thumb)
+		return img;
+
+	if (!img->tpixels || gdImageSX(img) != THUMB_CX || gdImageSY(img) != THUMB_CY) {
+		gdImageDestroy(img);
+		return NULL;
+	}
+	for (y = 0; y != THUMB_CY; y++)
+		memcpy(thumb->tpixels[y], img->tpixels[y], THUMB_CX * sizeof(int));
+	gdImageDestroy(img);
+
+	return thumb;
+}
+
+
+#ifdef THUMB_USE_LIBPNG
+
+void _ThumbPngRead(png_structp png, png_bytep buf, png_size_t len) {
+	LPPNGSRC src = png_get_io_ptr(png);
+
+	if (len > src->len - src->pos)
+		png_error(png, "thumb data cut short");
+	memcpy(buf, src->data + src->pos, len);
+	src->pos += len;
+}
+
+
+/*
+ * Reads the rows of a thumb straight into the pixels of thumb, with no gd image in
+ * between.  A true color pixel without alpha is the int 0x00RRGGBB, which in memory
+ * is B, G, R, 0 on a little endian machine and 0, R, G, B on a big endian one, so
+ * libpng is set up to produce exactly that.  Only the 8 bit RGB, non-interlaced PNGs
+ * ThumbCreate writes are handled.  Returns 1 if thumb was filled in, 0 for a PNG left
+ * to gd, and -1 for a damaged one.
+ */
+int _ThumbDecodePngRows(unsigned int size, void *data, gdImagePtr thumb) {
+	png_structp png;
+	png_infop info;
+	PNGSRC src;
+
+	if (!thumb->tpixels || gdImageSX(thumb) != THUMB_CX || gdImageSY(thumb) != THUMB_CY)
+		return 0;
+
+	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png)
+		return 0;
+	info = png_create_info_struct(png);
+	if (!info) {
+		png_destroy_read_struct(&png, NULL, NULL);
+		return 0;
+	}
+
+	if (setjmp(png_jmpbuf(png))) {
+		png_destroy_read_struct(&png, &info, NULL);
+		return -1;
+	}
+
+	src.data = data;
+	src.len  = size;
+	src.pos  = 0;
+	png_set_read_fn(png, &src, _ThumbPngRead);
+	png_read_info(png, info);
+
+	if (png_get_image_width(png, info) != THUMB_CX ||
+		png_get_image_height(png, info) != THUMB_CY ||
+		png_get_bit_depth(png, info) != 8 ||
+		png_get_color_type(png, info) != PNG_COLOR_TYPE_RGB ||
+		png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+		png_destroy_read_struct(&png, &info, NULL);
+		return 0;
+	}
+
+#ifdef ENDIAN_BIG
+	png_set_filler(png, 0, PNG_FILLER_BEFORE);
+#else
+	png_set_bgr(png);
+	png_set_filler(png, 0, PNG_FILLER_AFTER);
+#endif
+	png_read_image(png, (png_bytepp)thumb->tpixels);
+	png_read_end(png, NULL);
+
+	png_destroy_read_struct(&png, &info, NULL);
+	return 1;
+}
+
+#endif
+
+
+LPTCENTRY ThumbCacheLookup(LPTHUMBCACHE cache, unsigned int offset) {
+	LPTCENTRY ptcent;
+	TCENTRY entry;
+	FILE *file;
+
+	if (cache->burstmode)
+		return _ThumbCacheMappedEntry(cache, offset);
+
+	ptcent = NULL;
+
+	file = fopen(cache->cache_fn, "rb");
+	if (!file)
+		goto end;
+
+	if (fseek(file, offset, SEEK_SET))
+		goto end;
+
+	if (!fread(&entry, sizeof(TCENTRY), 1, file))
+		goto end;
+
+	ptcent = malloc(sizeof(TCENTRY) + entry.fnlen + 1);
+	memcpy(ptcent, &entry, sizeof(TCENTRY));
+	fread(ptcent->filename, entry.fnlen + 1, 1, file);
+	if (ferror(file)) {
+		free(ptcent);
+		ptcent = NULL;
+		goto end;
+	}
+
+end:
+	if (file)
+		fclose(file);
+	return ptcent;
+}
+
+
+//the entry's path relative to the cache's directory, rebuilt from its directory id
+int ThumbCacheEntryPath(LPTHUMBCACHE cache, LPTCENTRY ptcent, char *path, size_t len) {
+	if (!cache->dirs && _ThumbCacheDirsOpen(cache) != 1)
+		return 0;
+
+	if (!PdJoin(cache->dirs, ptcent->dirid, ptcent->filename, ptcent->fnlen, path, len)) {
+		fprintf(stderr, "WARNING: directory of %s isn't in the directory table\n",
+			ptcent->filename);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void ThumbCacheEnumerate(LPTHUMBCACHE cache, int level) {
+	LPTCHEADER ptchdr;
+	LPTCENTRY ptcent;
+	unsigned char *thumbdata;
+	char path[MAX_PATH];
+	unsigned int pos;
+	gdImagePtr thumb;
+	int nentries = 0, ndelentries = 0;
+
+	if (!ThumbCacheBurstReadBegin(cache, 0)) {
+		fprintf(stderr, "ERROR: failed to open cache for mapping\n");
+		return;
+	}
+
+	//before changing to outpath, since the cache files may be relative to here
+	if (!cache->dirs && _ThumbCacheDirsOpen(cache) != 1)
+		return;
+
+	if (level >= TC_DUMP_IMGS) {
+		if (!outpath[0]) {
+			fprintf(stderr, "ERROR: must specify an output path\n");
+			return;
+		}
+		if (createdir(outpath) == -1 && errno != EEXIST) {
+			perror("mkdir");
+			return;
+		}
+		if (chdir(outpath) == -1) {
+			perror("chdir");
+			return;
+		}
+	}
+
+	ptchdr = (LPTCHEADER)cache->cachemap.addr;
+
+	if (level >= TC_DUMP_INFO) {
+		printf("Directory last modified: %s"
+			"Thumb cache entries:\n"
+			"file                      "
+			"thumb key\tthumb len\tformat\tdimensions\tfile size\tlast modified\n",
+			asctime(localtime(&ptchdr->lastupdate)));
+	}
+
+	pos = sizeof(TCHEADER);
+	while (pos < cache->cachemap.maplen) {
+		ptcent = (LPTCENTRY)((char *)cache->cachemap.addr + pos);
+
+		if (ptcent->mtime != TC_MTIME_DELETED) {
+			if (!ThumbCacheEntryPath(cache, ptcent, path, sizeof(path)))
+				strlcpy(path, ptcent->filename, sizeof(path));
+
+			if (level >= TC_DUMP_INFO) {
+				printf("%-26s%f\t%d\t\t%s\t%ux%u\t%u\t\t%s", path,
+					ptcent->thumbkey, ptcent->thumbfsize,
+					img_fmt_strs[ptcent->format <= IMG_FMT_BMP ? ptcent->format : 0],
+					ptcent->width, ptcent->height, ptcent->filesize,
+					asctime(localtime(&ptcent->mtime)));
+			}
+
+			if (level >= TC_DUMP_IMGS) {
+				thumbdata = (unsigned char *)ptcent + sizeof(TCENTRY) + ptcent->fnlen + 1;
+				thumb = gdImageCreateFromPngPtr(ptcent->thumbfsize, thumbdata);
+				if (!thumb) {
+					fprintf(stderr, "ERROR: failed to create image from thumbcache\n");
+					continue;
+				}
+
+				if (!ImgSavePng(path, thumb)) {
+					if (errno == ENOENT) {
+						if (verbose) 
+							printf("creating directory structure for %s\n", path);
+						if (!BuildPath(path)) {
+							fprintf(stderr, "ERROR: failed to build "
+								"directory to %s\n", path);
+							gdImageDestroy(thumb);
+							continue;
+						}
+						if (!ImgSavePng(path, thumb)) {
+							fprintf(stderr, "ERROR: failed to save %s after "
+								"building directory\n", path);
+							gdImageDestroy(thumb);
+							continue;
+						}
+					} else {
+						fprintf(stderr, "ERROR: failed to save %s\n", path);
+						gdImageDestroy(thumb);
+						continue;
+					}
+				}
+				gdImageDestroy(thumb);
+			}
+			nentries++;
+		} else {
+			ndelentries++;
+		}
+		pos += sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
+	}
+
+	if (level >= TC_DUMP_IMGS && chdir(workdir) == -1) {
+		perror("chdir");
+		return;
+	}
+
+	printf("Number of thumb cache entries: %d\n"
+		"Number of deleted thumb cache entries: %d\n",
+		nentries, ndelentries);
+
+	ThumbCacheBurstReadEnd(cache);
+
+}
+
+
+/*
+ * N.B.
+ * When not in burst mode, the caller must free(dupents[i])
+ */
+int ThumbFindMatches(LPTHUMBCACHE cache, const char *filename, LPTCENTRY *dupents,
+					 unsigned int *dupoffs, unsigned int nmaxdups) {
+	THUMBQUERY query;
+	unsigned int selfoffset;
+	int status;
+
+	if (!filename || !dupents || !dupoffs)
+		return -1;
+
+	if (!ThumbQueryInit(&query, filename)) {
+		fprintf(stderr, "WARNING: %s is not a recognized image, skipping\n", filename);
+		return 0;
+	}
+
+	selfoffset = ThumbQueryFindSelf(cache, &query);
+	status = ThumbQueryMatches(cache, &query, selfoffset, dupents, dupoffs, nmaxdups);
+
+	ThumbQueryFree(&query);
+	return status;
+}
+
+
+int ThumbQueryInit(LPTHUMBQUERY query, const char *filename) {
+	memset(query, 0, sizeof(THUMBQUERY));
+	query->filename = filename;
+
+	return ImgProbe(filename, &query->info);
+}
+
+
+/*
+ * Returns the offset of the query file's own entry in cache, or 0 if it has none.
+ * A current entry already has the file's content hash, which saves reading it again,
+ * and its thumbnail, which saves decoding the image in ThumbQueryDecode.
+ */
+unsigned int ThumbQueryFindSelf(LPTHUMBCACHE cache, LPTHUMBQUERY query) {
+	unsigned int selfoffset;
+	LPTCENTRY ptcent;
+
+	selfoffset = 0;
+	if (cache->names || _ThumbCacheNamesOpen(cache)) {
+		ptcent = _ThumbCacheNamesFind(cache, NULL, query->filename, &selfoffset);
+		if (!ptcent)
+			return 0;
+		if (ptcent->mtime == GetLastWriteTime(query->filename)) {
+			memcpy(query->contenthash, ptcent->contenthash, sizeof(query->contenthash));
+			query->hashed     = 1;
+			query->selfcache  = cache;
+			query->selfoffset = selfoffset;
+		}
+	}
+
+	return selfoffset;
+}
+
+
+/*
+ * Builds everything about the query that takes decoding it.  Done lazily by
+ * ThumbQueryMatches, but a query to be shared between threads must be decoded
+ * first, since after that it is only ever read.
+ */
+int ThumbQueryDecode(LPTHUMBQUERY query) {
+	if (query->img)
+		return 1;
+
+	if (query->selfcache && _ThumbQueryDecodeSelf(query))
+		return 1;
+
+	query->img = ThumbCreate(query->filename, NULL, query->hashed ? NULL : query->contenthash);
+	if (!query->img)
+		return 0;
+	query->hashed = 1;
+
+	query->key = _ThumbCalcKey(query->img->tpixels);
+	_ThumbCalcPixelHash(query->img->tpixels, query->pixelhash);
+	if (match_engine == MATCH_ENGINE_HISTRGB)
+		HistCalc(query->img->tpixels, query->hist, NULL);
+	else if (match_engine == MATCH_ENGINE_HISTHSV)
+		HistCalc(query->img->tpixels, NULL, query->hist);
+
+	return 1;
+}
+
+
+/*
+ * Fills in the query from its own cache entry, whose thumbnail and what was computed
+ * from it are the same ThumbCreate would give now, as the file hasn't changed since.
+ */
+int _ThumbQueryDecodeSelf(LPTHUMBQUERY query) {
+	LPTHUMBCACHE cache = query->selfcache;
+	LPTCENTRY ptcent;
+	gdImagePtr img;
+
+	//the entry may have been added after the cache was last mapped
+	ptcent = _ThumbCacheMappedEntry(cache, query->selfoffset);
+	if (!ptcent || ptcent->mtime == TC_MTIME_DELETED || ptcent->thumbfsize >= THUMB_MAX_SIZE)
+		return 0;
+
+	img = _ThumbCacheDecode(cache, query->selfoffset, ptcent, NULL);
+	if (!img)
+		return 0;
+	if (gdImageSX(img) != THUMB_CX || gdImageSY(img) != THUMB_CY || !img->tpixels) {
+		gdImageDestroy(img);
+		return 0;
+	}
+
+	query->img = img;
+	query->key = ptcent->thumbkey;
+	memcpy(query->pixelhash, ptcent->pixelhash, sizeof(query->pixelhash));
+	if (match_engine == MATCH_ENGINE_HISTRGB)
+		memcpy(query->hist, ptcent->histrgb, sizeof(ptcent->histrgb));
+	else if (match_engine == MATCH_ENGINE_HISTHSV)
+		memcpy(query->hist, ptcent->histhsv, sizeof(ptcent->histhsv));
+
+	return 1;
+}
+
+
+void ThumbQueryFree(LPTHUMBQUERY query) {
+	if (query->img) {
+		gdImageDestroy(query->img);
+		query->img = NULL;
+	}
+}
+
+
+/*
+ * selfoffset is the offset of the query's own entry in cache, if it has one, so it
+ * isn't reported as a match of itself.  When not in burst mode, the caller must
+ * free(dupents[i]).
+ */
+int ThumbQueryMatches(LPTHUMBCACHE cache, LPTHUMBQUERY query, unsigned int selfoffset,
+					  LPTCENTRY *dupents, unsigned int *dupoffs, unsigned int nmaxdups) {
+	LPMATCHCTX ctx = &cache->match;
+	int nitems, nlive, nkept, nbatch, ndecoded, i, j, k, n, status, res;
+	unsigned int *offsets, *live, *kept, dups, entlen;
+	char path[MAX_PATH];
+	float delta, *aspects;
+	gdImagePtr *thumbs;
+	LPTCENTRY *entries;
+	LPTCENTRY ptcent;
+	KVPAIR *matches;
+	QUERYSAMPLE sample;
+	PROF_DECL(t);
+
+	memset(&sample, 0, sizeof(sample));
+	status = -1;
+
+	//byte-for-byte copies are found by content hash and size, and their thumbs never decoded;
+	//the search below still looks for near-duplicates the copies don't stand in for
+	dups = 0;
+	if (!query->hashed)
+		query->hashed = ImgHashFile(query->filename, query->contenthash, NULL);
+	if (query->hashed && (cache->hashes || _ThumbCacheNamesOpen(cache))) {
+		dups = _ThumbFindIdentical(cache, cache->hashes, query->contenthash,
+			offsetof(TCENTRY, contenthash), selfoffset, query->info.filesize, 0, 0,
+			dupents, dupoffs, dups, nmaxdups);
+	}
+
+	if (!cache->bpt) {
+		cache->bpt = BptOpen(cache->btree_fn);
+		if (!cache->bpt)
+			goto end;
+	}
+
+	if (!ThumbQueryDecode(query)) {
+		fprintf(stderr, "ERROR: couldn't create thumbnail\n");
+		goto end;
+	}
+
+	//re-encodes of the same picture usually flatten to the same pixels, but so do
+	//pictures of one flat color, whatever their shape
+	if (cache->pixels) {
+		dups = _ThumbFindIdentical(cache, cache->pixels, query->pixelhash,
+			offsetof(TCENTRY, pixelhash), selfoffset, 0, query->info.width, query->info.height,
+			dupents, dupoffs, dups, nmaxdups);
+	}
+	sample.identical = dups;
+
+	if (match_engine != MATCH_ENGINE_THUMB) {
+		status = _ThumbFindHistMatches(cache, query, selfoffset,
+			dupents, dupoffs, dups, nmaxdups, &sample);
+		if (status >= 0)
+			dups = status;
+		goto end;
+	}
+
+	//(x + y)^2 - x^2 = 2xy + y^2
+	delta = (6.f * (float)sqrt(query->key / 3.f) * DIFF_TOLERANCE) +
+		(DIFF_TOLERANCE * DIFF_TOLERANCE);
+
+	PROF_BEGIN(t);
+	nitems = BptSearchRangeBuf(cache->bpt, query->key - delta, query->key + delta,
+		&ctx->matches, &ctx->matchlen);
+	PROF_END(t, STAT_BPT_SEARCH, nitems > 0 ? nitems : 0);
+	if (nitems == BT_ERROR) {
+		fprintf(stderr, "ERROR: tree lookup failure\n");
+		goto end;
+	}
+	if (nitems == BT_NOTFOUND) {
+		status = dups;
+		goto end;
+	}
+	sample.candidates = nitems;
+
+	if (!_ThumbMatchCtxReserve(ctx, nitems)) {
+		fprintf(stderr, "ERROR: out of memory for %d candidates\n", nitems);
+		goto end;
+	}
+	matches = ctx->matches;
+	offsets = ctx->offsets;
+	entries = ctx->entries;
+	aspects = ctx->aspects;
+	kept    = ctx->kept;
+	live    = ctx->live;
+	thumbs  = ctx->thumbs;
+
+	//weed out deleted entries and anything with the wrong shape before decoding thumbs
+	nlive = 0;
+	for (i = 0; i != nitems; i++) {
+		ptcent = _ThumbCacheMappedEntry(cache, matches[i].val);
+		if (ptcent && ptcent->mtime == TC_MTIME_DELETED)
+			continue;
+		live[nlive]    = i;
+		aspects[nlive] = ptcent ? ImgAspect(ptcent->width, ptcent->height) : 0.f;
+		nlive++;
+	}
+	nkept = ImgAspectFilter(ImgAspect(query->info.width, query->info.height),
+		aspects, kept, nlive);
+	sample.live   = nlive;
+	sample.shaped = nkept;
+
+	j = 0;
+	for (k = 0; k != nkept; k++) {
+		i = live[kept[k]];
+		if (_ThumbMatchFound(dupoffs, dups, matches[i].val))
+			continue;
+		if (matches[i].key == query->key) {
+			if (cache->names) {
+				if (matches[i].val == selfoffset)
+					continue;
+			} else {
+				ptcent = ThumbCacheLookup(cache, matches[i].val);
+				if (!ptcent) {
+					fprintf(stderr, "WARNING: tree contained invalid offset\n");
+					continue;
+				}
+				res = !ThumbCacheEntryPath(cache, ptcent, path, sizeof(path)) ||
+					strcmp(path, query->filename);
+				if (!cache->burstmode)
+					free(ptcent);
+				if (!res)
+					continue;
+			}
+		}
+		offsets[j] = matches[i].val;
+		j++;
+	} 
+
+	if (!j) {
+		status = dups;
+		goto end;
+	}
+
+	//decoded a batch at a time into the images of ctx->pool, which are kept for the next
+	ndecoded = 0;
+	for (k = 0; k < j; k += nbatch) {
+		nbatch = j - k < THUMB_MATCH_BATCH ? j - k : THUMB_MATCH_BATCH;
+		memcpy(thumbs, ctx->pool, nbatch * sizeof(gdImagePtr));
+
+		PROF_BEGIN(t);
+		n = ThumbCacheGet(cache, nbatch, offsets + k, entries + k, thumbs);
+		PROF_END(t, STAT_CACHE_GET, nbatch);
+		ndecoded += n;
+
+		for (i = 0; i != nbatch; i++) {
+			if (!thumbs[i]) {
+				fprintf(stderr, "WARNING, couldn't get thumb\n");
+				continue;
+			}
+			sample.compared++;
+			if (!ImgCompareFuzzy(query->img, thumbs[i]))
+				continue;
+
+			if (dups >= nmaxdups) {
+				fprintf(stderr, "WARNING: too many matches (>= %d), "
+					"dropping others\n", nmaxdups);
+				j = k + nbatch;
+				break;
+			}
+
+			//only the matches are copied out of the scratch space ThumbCacheGet reads into
+			ptcent = entries[k + i];
+			if (!cache->burstmode) {
+				entlen = sizeof(TCENTRY) + ptcent->fnlen + 1;
+				ptcent = malloc(entlen);
+				if (!ptcent) {
+					perror("malloc");
+					continue;
+				}
+				memcpy(ptcent, entries[k + i], entlen);
+			}
+			dupents[dups] = ptcent;
+			dupoffs[dups] = offsets[k + i];
+			dups++;
+		}
+	}
+	sample.decoded = ndecoded;
+
+	if (!ndecoded) {
+		fprintf(stderr, "ERROR: failed to read thumbnails from cache\n");
+		goto end;
+	}
+
+	status = dups;
+
+end:
+	if (status < 0 && !cache->burstmode) {
+		for (i = 0; i != (int)dups; i++)
+			free(dupents[i]);
+	}
+	sample.matches = status > 0 ? status : 0;
+	PROF_QUERY(&sample);
+	return status;
+}
+
+
+int _ThumbMatchFound(const unsigned int *dupoffs, unsigned int ndups, unsigned int offset) {
+	unsigned int i;
+
+	for (i = 0; i != ndups; i++) {
+		if (dupoffs[i] == offset)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Makes room in ctx for the candidates of a query, and the images to decode them
+ * into.  Only grows, so that queries after the largest so far allocate nothing.
+ */
+int _ThumbMatchCtxReserve(LPMATCHCTX ctx, unsigned int nitems) {
+	unsigned int i, len;
+	void *p;
+
+	if (nitems > ctx->len) {
+		len = ctx->len + ctx->len / 2;
+		if (len < nitems)
+			len = nitems;
+
+		if (!(p = realloc(ctx->offsets, len * sizeof(unsigned int))))
+			return 0;
+		ctx->offsets = p;
+		if (!(p = realloc(ctx->live, len * sizeof(unsigned int))))
+			return 0;
+		ctx->live = p;
+		if (!(p = realloc(ctx->kept, len * sizeof(unsigned int))))
+			return 0;
+		ctx->kept = p;
+		if (!(p = realloc(ctx->aspects, len * sizeof(float))))
+			return 0;
+		ctx->aspects = p;
+		if (!(p = realloc(ctx->entries, len * sizeof(LPTCENTRY))))
+			return 0;
+		ctx->entries = p;
+
+		ctx->len = len;
+	}
+
+	for (i = 0; i != nitems && i != THUMB_MATCH_BATCH; i++) {
+		if (!ctx->pool[i]) {
+			ctx->pool[i] = gdImageCreateTrueColor(THUMB_CX, THUMB_CY);
+			if (!ctx->pool[i])
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+void _ThumbMatchCtxFree(LPMATCHCTX ctx) {
+	int i;
+
+	free(ctx->matches);
+	free(ctx->offsets);
+	free(ctx->live);
+	free(ctx->kept);
+	free(ctx->aspects);
+	free(ctx->entries);
+	free(ctx->entbuf);
+	free(ctx->readbuf);
+	for (i = 0; i != THUMB_MATCH_BATCH; i++) {
+		if (ctx->pool[i])
+			gdImageDestroy(ctx->pool[i]);
+	}
+	memset(ctx, 0, sizeof(MATCHCTX));
+}
+
+
+/*
+ * Adds the live entries other than selfoffset whose IMG_HASH_LEN word hash found
+ * hashoff bytes into the entry equals hash to the ndups matches already found, using
+ * hdb as the index of those hashes, and returns the new number of matches.  Entries
+ * whose file isn't filesize bytes long, or whose shape doesn't match cx by cy, are left
+ * out, unless those are 0.  Like ThumbFindMatches, the caller must free(dupents[i])
+ * when not in burst mode.
+ */
+int _ThumbFindIdentical(LPTHUMBCACHE cache, LPHASHDB hdb, const uint32_t *hash,
+						unsigned int hashoff, unsigned int selfoffset, unsigned int filesize,
+						unsigned int cx, unsigned int cy, LPTCENTRY *dupents,
+						unsigned int *dupoffs, unsigned int ndups, unsigned int nmaxdups) {
+	LPTCENTRY ptcent;
+	unsigned int iter, pos;
+
+	iter = 0;
+	while ((pos = HdbLookup(hdb, hash[0], &iter)) != HDB_EMPTY) {
+		if (pos == selfoffset || _ThumbMatchFound(dupoffs, ndups, pos))
+			continue;
+
+		ptcent = ThumbCacheLookup(cache, pos);
+		if (!ptcent) {
+			fprintf(stderr, "WARNING: hash index contained invalid offset\n");
+			continue;
+		}
+
+		if (ptcent->mtime == TC_MTIME_DELETED ||
+			(filesize && ptcent->filesize != filesize) ||
+			memcmp((char *)ptcent + hashoff, hash, IMG_HASH_LEN * sizeof(uint32_t)) ||
+			!ImgAspectMatch(cx, cy, ptcent->width, ptcent->height)) {
+			if (!cache->burstmode)
+				free(ptcent);
+			continue;
+		}
+
+		if (ndups >= nmaxdups) {
+			fprintf(stderr, "WARNING: too many matches (>= %d), "
+				"dropping others\n", nmaxdups);
+			if (!cache->burstmode)
+				free(ptcent);
+			break;
+		}
+
+		dupents[ndups] = ptcent;
+		dupoffs[ndups] = pos;
+		ndups++;
+	}
+
+	return ndups;
+}
+
+
+/*
+ * The histogram engines are meant to see past recoloring and cropping, which move the
+ * mean color further than the thumb engine's key window allows, so the tree is
+ * searched THUMB_HIST_KEY_RANGE either way of the length of the query's mean color
+ * (the key being its square).  The histograms are stored in the entries themselves;
+ * no thumbs need decoding.  Adds to the ndups matches already found, like
+ * _ThumbFindIdentical.
+ */
+int _ThumbFindHistMatches(LPTHUMBCACHE cache, LPTHUMBQUERY query, unsigned int selfoffset,
+						  LPTCENTRY *dupents, unsigned int *dupoffs, unsigned int ndups,
+						  unsigned int nmaxdups, LPQUERYSAMPLE sample) {
+	LPMATCHCTX ctx = &cache->match;
+	LPFMAPINFO fmi;
+	LPTCENTRY ptcent;
+	unsigned int pos, entlen, histoff;
+	float len, minkey, maxkey;
+	int nbins, nitems, i;
+	PROF_DECL(t);
+
+	if (match_engine == MATCH_ENGINE_HISTRGB) {
+		nbins   = HIST_RGB_BINS;
+		histoff = offsetof(TCENTRY, histrgb);
+	} else {
+		nbins   = HIST_HSV_BINS;
+		histoff = offsetof(TCENTRY, histhsv);
+	}
+
+	if (cache->burstmode) {
+		fmi = &cache->cachemap;
+	} else {
+		if (!_ThumbCacheNamesMap(cache))
+			return -1;
+		fmi = &cache->namemap;
+	}
+
+	len    = (float)sqrt(query->key);
+	minkey = len > THUMB_HIST_KEY_RANGE ?
+		(len - THUMB_HIST_KEY_RANGE) * (len - THUMB_HIST_KEY_RANGE) : 0.f;
+	maxkey = (len + THUMB_HIST_KEY_RANGE) * (len + THUMB_HIST_KEY_RANGE);
+
+	PROF_BEGIN(t);
+	nitems = BptSearchRangeBuf(cache->bpt, minkey, maxkey, &ctx->matches, &ctx->matchlen);
+	PROF_END(t, STAT_BPT_SEARCH, nitems > 0 ? nitems : 0);
+	if (nitems == BT_ERROR) {
+		fprintf(stderr, "ERROR: tree lookup failure\n");
+		return -1;
+	}
+	if (nitems == BT_NOTFOUND)
+		return ndups;
+	sample->candidates = nitems;
+
+	for (i = 0; i != nitems; i++) {
+		//entries added since the cache was mapped can't be checked, as before
+		pos = ctx->matches[i].val;
+		if (pos + sizeof(TCENTRY) > fmi->maplen)
+			continue;
+		ptcent = (LPTCENTRY)((char *)fmi->addr + pos);
+		entlen = sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
+		if (pos + entlen > fmi->maplen || ptcent->mtime == TC_MTIME_DELETED)
+			continue;
+		sample->live++;
+
+		if (pos == selfoffset || _ThumbMatchFound(dupoffs, ndups, pos))
+			continue;
+
+		sample->compared++;
+		if (!HistMatch(query->hist, (HISTBIN *)((char *)ptcent + histoff), nbins))
+			continue;
+
+		if (ndups >= nmaxdups) {
+			fprintf(stderr, "WARNING: too many matches (>= %d), "
+				"dropping others\n", nmaxdups);
+			break;
+		}
+
+		if (!cache->burstmode) {
+			dupents[ndups] = malloc(sizeof(TCENTRY) + ptcent->fnlen + 1);
+			if (!dupents[ndups]) {
+				fprintf(stderr, "ERROR: out of memory for match\n");
+				break;
+			}
+			memcpy(dupents[ndups], ptcent, sizeof(TCENTRY) + ptcent->fnlen + 1);
+		} else {
+			dupents[ndups] = ptcent;
+		}
+		dupoffs[ndups] = pos;
+		ndups++;
+	}
+
+	return ndups;
+}
+
+
+/*
+ * slotlen is the size of the thumb data area being overwritten at the current position
+ * of tc, if any.  The thumb data is zero-filled up to that size so the entries following
+ * it stay where they are.  Otherwise the entry goes in the append buffer, and isn't in
+ * the file until the buffer is written out.  Only the file name is stored; its
+ * directory goes in the directory table.
+ */
+unsigned int _ThumbCacheWriteEntry(LPTHUMBCACHE cache, FILE *tc, LPTCENTRY ptcent,
+								   const char *filename, void *thumbdata, unsigned int slotlen) {
+	unsigned int fileoffset, dirlen, len, datalen, padlen, entlen;
+	unsigned char *rec;
+	int status;
+	PROF_DECL(t);
+
+	PROF_BEGIN(t);
+	dirlen = PdSplit(filename);
+	len    = strlen(filename + dirlen);
+	if (!len || len > UCHAR_MAX)
+		return 0;
+
+	if (!cache->dirs && _ThumbCacheDirsOpen(cache) != 1)
+		return 0;
+	ptcent->dirid = PdAdd(cache->dirs, filename, dirlen);
+	if (ptcent->dirid == PD_NOTFOUND)
+		return 0;
+
+	datalen = ptcent->thumbfsize;
+	if (slotlen >= datalen)
+		padlen = slotlen - datalen;
+	else
+		padlen = (ALIGN_BYTES - ((datalen + len + 1) & ALIGN_MASK)) & ALIGN_MASK;
+
+	ptcent->thumbfsize += padlen;
+	ptcent->fnlen       = (unsigned char)len;
+
+	entlen = sizeof(TCENTRY) + len + 1 + ptcent->thumbfsize;
+	if (slotlen) {
+		fileoffset = ftell(tc);
+		rec = malloc(entlen);
+	} else {
+		rec = _ThumbCacheAppendReserve(cache, tc, entlen, &fileoffset);
+	}
+	if (!rec)
+		return 0;
+
+	memcpy(rec, ptcent, sizeof(TCENTRY));
+	memcpy(rec + sizeof(TCENTRY), filename + dirlen, len + 1);
+	memcpy(rec + sizeof(TCENTRY) + len + 1, thumbdata, datalen);
+	memset(rec + sizeof(TCENTRY) + len + 1 + datalen, 0, padlen);
+
+	if (slotlen) {
+		status = fwrite(rec, entlen, 1, tc) == 1;
+		free(rec);
+		if (!status)
+			return 0;
+	}
+
+	PROF_END(t, STAT_CACHE_WRITE, entlen);
+	return fileoffset;
+}
+
+
+/*
+ * Returns room for a new entry of len bytes at the end of the append buffer, and the
+ * offset the entry will have in the cache once written out.  Whatever is already in
+ * the buffer is written out first if the entry doesn't fit behind it.
+ */
+void *_ThumbCacheAppendReserve(LPTHUMBCACHE cache, FILE *tc, unsigned int len,
+							   unsigned int *offset) {
+	unsigned char *buf;
+	unsigned int size;
+	long end;
+
+	if (cache->appendlen + len > cache->appendsize) {
+		if (!_ThumbCacheAppendFlush(cache, tc))
+			return NULL;
+
+		if (len > cache->appendsize) {
+			size = len > THUMB_APPEND_SIZE ? len : THUMB_APPEND_SIZE;
+			buf  = realloc(cache->appendbuf, size);
+			if (!buf) {
+				perror("realloc");
+				return NULL;
+			}
+			cache->appendbuf  = buf;
+			cache->appendsize = size;
+		}
+	}
+
+	if (!cache->appendlen) {
+		if (fseek(tc, 0, SEEK_END) || (end = ftell(tc)) == -1)
+			return NULL;
+		cache->appendpos = (unsigned int)end;
+	}
+
+	*offset = cache->appendpos + cache->appendlen;
+	buf     = cache->appendbuf + cache->appendlen;
+	cache->appendlen += len;
+
+	return buf;
+}
+
+
+/*
+ * Writes out the append buffer with a single write.  The entries are dropped on
+ * failure, and taken back out of the tree and the indexes.
+ */
+int _ThumbCacheAppendFlush(LPTHUMBCACHE cache, FILE *tc) {
+	if (!cache->appendlen)
+		return 1;
+
+	if (fseek(tc, cache->appendpos, SEEK_SET) ||
+		fwrite(cache->appendbuf, cache->appendlen, 1, tc) != 1 || fflush(tc)) {
+		fprintf(stderr, "ERROR: failed to write %u bytes of new entries to %s\n",
+			cache->appendlen, cache->cache_fn);
+
+		//whatever part did make it out would be taken for entries by the next scan
+		clearerr(tc);
+		if (fflush(tc) || truncatefile(tc, cache->appendpos) == -1)
+			perror("truncate");
+		_ThumbCacheAppendDrop(cache);
+		return 0;
+	}
+
+	cache->appendpos += cache->appendlen;
+	cache->appendlen  = 0;
+
+	return 1;
+}
+
+
+/*
+ * Empties the append buffer without writing it out.  Its entries were added to the
+ * tree and the indexes as they were buffered, at offsets past the end of the cache
+ * file, so they are removed again here.  The index stamps go back to where the file
+ * ends; if a failed write left part of the buffer behind, they no longer match the
+ * file and the indexes are rebuilt the next time they are opened.
+ */
+void _ThumbCacheAppendDrop(LPTHUMBCACHE cache) {
+	unsigned int pos, entlen, offset;
+	char path[MAX_PATH];
+	LPTCENTRY ptcent;
+
+	for (pos = 0; pos + sizeof(TCENTRY) <= cache->appendlen; pos += entlen) {
+		ptcent = (LPTCENTRY)(cache->appendbuf + pos);
+		entlen = sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
+		offset = cache->appendpos + pos;
+
+		if (cache->bpt)
+			BptRemoveItem(cache->bpt, ptcent->thumbkey, offset);
+		if (cache->names && cache->dirs &&
+			PdJoin(cache->dirs, ptcent->dirid, ptcent->filename, ptcent->fnlen,
+				path, sizeof(path)))
+			HdbRemove(cache->names, HtDefaultHash(path, strlen(path)), offset);
+		HdbRemove(cache->hashes, ptcent->contenthash[0], offset);
+		HdbRemove(cache->pixels, ptcent->pixelhash[0], offset);
+	}
+
+	if (cache->names && cache->names->header->stamp > cache->appendpos) {
+		cache->names->header->stamp  = cache->appendpos;
+		cache->hashes->header->stamp = cache->appendpos;
+		cache->pixels->header->stamp = cache->appendpos;
+	}
+
+	cache->appendlen = 0;
+}
+
+
+/*
+ * Ends a batch of adds to the cache through tc: the rest of the new entries are
+ * written out, and everything written is synced to disk once, here.
+ */
+int ThumbCacheCommit(LPTHUMBCACHE cache, FILE *tc) {
+	int status;
+	PROF_DECL(t);
+
+	PROF_BEGIN(t);
+	status = _ThumbCacheAppendFlush(cache, tc);
+	if (fflush(tc) || syncfile(tc) == -1) {
+		perror("fsync");
+		status = 0;
+	}
+	PROF_END(t, STAT_CACHE_WRITE, 0);
+
+	free(cache->appendbuf);
+	cache->appendbuf  = NULL;
+	cache->appendsize = 0;
+
+	return status;
+}
+
+
+int _ThumbCacheUpdateStructures(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+								LPTCENTRY ptcent, unsigned int offset, unsigned int oldoffset) {
+	unsigned int entend;
+	uint32_t hash;
+	int status;
+	PROF_DECL(t);
+
+	if (!cache->bpt) {
+		cache->bpt = BptOpen(cache->btree_fn);
+		if (!cache->bpt)
+			return 0;
+	}
+
+	PROF_BEGIN(t);
+	status = BptInsert(cache->bpt, ptcent->thumbkey, offset);
+	PROF_END(t, STAT_BPT_INSERT, 1);
+	if (!status)
+		return 0;
+
+	if (!cache->names) {
+		if (!_ThumbCacheAppendFlush(cache, tc) || !_ThumbCacheNamesOpen(cache))
+			return 0;
+	}
+
+	if (offset != oldoffset) {
+		hash = HtDefaultHash(filename, strlen(filename));
+		if (oldoffset)
+			HdbRemove(cache->names, hash, oldoffset);
+		if (!HdbInsert(cache->names, hash, offset))
+			return 0;
+	}
+
+	//the caller took the old entry out of the hash indexes, as with the tree
+	if (!HdbInsert(cache->hashes, ptcent->contenthash[0], offset) ||
+		!HdbInsert(cache->pixels, ptcent->pixelhash[0], offset))
+		return 0;
+
+	entend = offset + sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
+	if (entend > cache->names->header->stamp) {
+		cache->names->header->stamp  = entend;
+		cache->hashes->header->stamp = entend;
+		cache->pixels->header->stamp = entend;
+	}
+
+	return 1;
+}
+
+
+int ThumbCacheFlush(LPTHUMBCACHE cache) {
+	ThumbCacheClose(cache);
+
+#ifdef _WIN32
+	if (!DeleteFile(cache->btree_fn)) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->btree_fn, GetLastError());
+	}
+	if (!DeleteFile(cache->cache_fn)) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->cache_fn, GetLastError());
+	}
+	if (!DeleteFile(cache->names_fn) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->names_fn, GetLastError());
+	}
+	if (!DeleteFile(cache->hashes_fn) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->hashes_fn, GetLastError());
+	}
+	if (!DeleteFile(cache->pixels_fn) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->pixels_fn, GetLastError());
+	}
+	if (!DeleteFile(cache->dirs_fn) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+		fprintf(stderr, "ERROR: failed to delete %s, err: %d\n",
+			cache->dirs_fn, GetLastError());
+	}
+#else
+	if (remove(cache->btree_fn) == -1)
+		perror("remove thumb_btree_fn");
+	if (remove(cache->cache_fn) == -1)
+		perror("remove thumb_cache_fn");
+	if (remove(cache->names_fn) == -1 && errno != ENOENT)
+		perror("remove thumb_names_fn");
+	if (remove(cache->hashes_fn) == -1 && errno != ENOENT)
+		perror("remove thumb_hashes_fn");
+	if (remove(cache->pixels_fn) == -1 && errno != ENOENT)
+		perror("remove thumb_pixels_fn");
+	if (remove(cache->dirs_fn) == -1 && errno != ENOENT)
+		perror("remove thumb_dirs_fn");
+#endif
+	return 1;
+}
+
+
+/*
+ * The filename index is a file of its own, kept current by every add, replace, and
+ * remove, so it only needs to be rebuilt when it is missing or has fallen out of step
+ * with the cache.  Its stamp holds the length of the cache it was last synced with.
+ * The content and pixel hash indexes are kept the same way and always alongside it.
+ * The cache is mapped here as well, since the indexes only store entry offsets.
+ */
+int _ThumbCacheNamesOpen(LPTHUMBCACHE cache) {
+	LPTCENTRY ptcent;
+	unsigned int pos, entlen;
+	char path[MAX_PATH];
+
+	//matching works without the indexes, only slower, where they mustn't be written
+	if (cache->readonly)
+		return 0;
+
+	if (!cache->names) {
+		cache->names = HdbOpen(cache->names_fn);
+		if (!cache->names)
+			return 0;
+	}
+	if (!cache->hashes) {
+		cache->hashes = HdbOpen(cache->hashes_fn);
+		if (!cache->hashes)
+			return 0;
+	}
+	if (!cache->pixels) {
+		cache->pixels = HdbOpen(cache->pixels_fn);
+		if (!cache->pixels)
+			return 0;
+	}
+	if (!cache->dirs && _ThumbCacheDirsOpen(cache) != 1)
+		return 0;
+
+	if (!_ThumbCacheNamesMap(cache))
+		return 0;
+
+	if (!cache->names->isnew && cache->names->header->stamp == cache->namemap.maplen &&
+		!cache->hashes->isnew && cache->hashes->header->stamp == cache->namemap.maplen &&
+		!cache->pixels->isnew && cache->pixels->header->stamp == cache->namemap.maplen)
+		return 1;
+
+	if (verbose)
+		printf("Rebuilding thumb cache filename and hash indexes...\n");
+
+	HdbClear(cache->names);
+	HdbClear(cache->hashes);
+	HdbClear(cache->pixels);
+
+	pos = sizeof(TCHEADER);
+	while (pos + sizeof(TCENTRY) <= cache->namemap.maplen) {
+		ptcent = (LPTCENTRY)((char *)cache->namemap.addr + pos);
+		entlen = sizeof(TCENTRY) + ptcent->fnlen + 1 + ptcent->thumbfsize;
+		if (pos + entlen > cache->namemap.maplen) {
+			fprintf(stderr, "WARNING: thumb cache is truncated at %u\n", pos);
+			break;
+		}
+
+		if (ptcent->mtime != TC_MTIME_DELETED &&
+			ThumbCacheEntryPath(cache, ptcent, path, sizeof(path))) {
+			if (!HdbInsert(cache->names, HtDefaultHash(path, strlen(path)), pos) ||
+				!HdbInsert(cache->hashes, ptcent->contenthash[0], pos) ||
+				!HdbInsert(cache->pixels, ptcent->pixelhash[0], pos))
+				return 0;
+		}
+
+		pos += entlen;
+	}
+
+	cache->names->header->stamp  = cache->namemap.maplen;
+	cache->names->isnew          = 0;
+	cache->hashes->header->stamp = cache->namemap.maplen;
+	cache->hashes->isnew         = 0;
+	cache->pixels->header->stamp = cache->namemap.maplen;
+	cache->pixels->isnew         = 0;
+
+	return 1;
+}
+
+
+/*
+ * The directory table has to be opened before any entry is written, since entries
+ * only store ids from it.  A table that had to be started over while the cache
+ * already has entries means those ids are lost, so the cache is marked out of date
+ * and the next update rebuilds it just as it would for a TC_VERSION change.  A
+ * search opens the table read-only and never starts it over.
+ *
+ * Returns 1 if the table is usable, -1 if the cache has to be rebuilt first, and 0
+ * on any other failure.
+ */
+int _ThumbCacheDirsOpen(LPTHUMBCACHE cache) {
+	uint32_t version;
+	long cachelen;
+	FILE *file;
+
+	cache->dirs = PdOpen(cache->dirs_fn, cache->readonly);
+	if (!cache->dirs)
+		return 0;
+
+	if (cache->dirs->isnew) {
+		cachelen = 0;
+		file = fopen(cache->cache_fn, "rb+");
+		if (file) {
+			if (!fseek(file, 0, SEEK_END))
+				cachelen = ftell(file);
+			if (cachelen > (long)sizeof(TCHEADER)) {
+				version = 0;
+				if (fseek(file, offsetof(TCHEADER, version), SEEK_SET) ||
+					fwrite(&version, sizeof(version), 1, file) != 1)
+					perror("fwrite");
+			}
+			fclose(file);
+		}
+		if (cachelen > (long)sizeof(TCHEADER)) {
+			fprintf(stderr, "WARNING: directory table %s is missing entries of %s, "
+				"the cache will be rebuilt\n", cache->dirs_fn, cache->cache_fn);
+			PdClose(cache->dirs);
+			cache->dirs = NULL;
+			return -1;
+		}
+		cache->dirs->isnew = 0;
+	}
+
+	return 1;
+}
+
+
+int _ThumbCacheNamesMap(LPTHUMBCACHE cache) {
+	if (cache->namemap.addr && !MMFileClose(&cache->namemap))
+		return 0;
+
+	if (!MMFileOpen(cache->cache_fn, 0, &cache->namemap)) {
+		fprintf(stderr, "ERROR: failed to map thumb cache\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * The entry returned points into the mapping of the cache and is only good until
+ * the next call.  tc, if given, is flushed before remapping to pick up entries
+ * appended through it since the cache was last mapped.
+ */
+LPTCENTRY _ThumbCacheNamesFind(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+							   unsigned int *offset) {
+	LPTCENTRY ptcent;
+	unsigned int iter, pos, dirlen, len;
+	uint32_t hash, dirid;
+
+	len  = strlen(filename);
+	hash = HtDefaultHash(filename, len);
+
+	//nothing has been added from a directory the table doesn't know of
+	dirlen = PdSplit(filename);
+	dirid  = PdLookup(cache->dirs, filename, dirlen);
+	if (dirid == PD_NOTFOUND)
+		return NULL;
+	filename += dirlen;
+	len      -= dirlen;
+
+	iter = 0;
+	while ((pos = HdbLookup(cache->names, hash, &iter)) != HDB_EMPTY) {
+		if (pos + sizeof(TCENTRY) + len + 1 > cache->namemap.maplen) {
+			if (tc && !_ThumbCacheAppendFlush(cache, tc))
+				return NULL;
+			if (!_ThumbCacheNamesMap(cache))
+				return NULL;
+			if (pos + sizeof(TCENTRY) + len + 1 > cache->namemap.maplen) {
+				fprintf(stderr, "WARNING: filename index contained invalid offset\n");
+				continue;
+			}
+		}
+
+		ptcent = (LPTCENTRY)((char *)cache->namemap.addr + pos);
+		if (ptcent->mtime != TC_MTIME_DELETED && ptcent->dirid == dirid &&
+			ptcent->fnlen == len && !memcmp(ptcent->filename, filename, len)) {
+			if (offset)
+				*offset = pos;
+			return ptcent;
+		}
+	}
+
+	return NULL;
+}
+
+
+int ThumbCacheUpdate(LPTHUMBCACHE cache) {
+	THUMBUPDATE update;
+	TCHEADER tch;
+	int status = 0;
+	time_t dirlastmod;
+	FILE *tc;
+
+	if (verbose)
+		printf(" - Updating thumb cache\n");
+
+	tc = _ThumbCacheOpenData(cache, &tch);
+	if (!tc)
+		return 0;
+
+	dirlastmod = GetLastWriteTime(".");
+	if (tch.lastupdate >= dirlastmod) {
+		if (tch.lastupdate > dirlastmod) {
+			fprintf(stderr, "WARNING: thumbcache recorded last "
+				"mtime > directory last mtime\n");
+		}
+		if (verbose)
+			printf("Cache is up-to-date.\n");
+		
+		status = 1;
+		goto done;
+	}
+	
+	if (!_ThumbCacheNamesOpen(cache))
+		goto done;
+
+	update.cache = cache;
+	update.tc    = tc;
+	ThumbScanDir("", _ThumbCacheUpdateVisit, &update);
+
+	//the directory only counts as up to date once everything found in it is written
+	if (!_ThumbCacheAppendFlush(cache, tc))
+		goto done;
+	if (fseek(tc, sizeof(TCHEADER) - sizeof(time_t), SEEK_SET) == -1) {
+		perror("fseek");
+		goto done;
+	}
+	fwrite(&dirlastmod, sizeof(time_t), 1, tc);
+
+	if (!ThumbCacheCommit(cache, tc))
+		goto done;
+
+	printf("Added %d entries successfully.\n", cache->nadded);
+
+	status = 1;
+done:
+	fclose(tc);
+	return status;
+}
+
+
+/*
+ * Opens the cache data file for update, creating it if it doesn't exist yet and
+ * starting over if it was written by another version or its directory table was
+ * lost, and reads its header into tch.
+ */
+FILE *_ThumbCacheOpenData(LPTHUMBCACHE cache, LPTCHEADER tch) {
+	FILE *tc;
+
+	tc = fopen(cache->cache_fn, "rb+");
+	if (!tc) {
+		if (errno == ENOENT) {
+			tc = fopen(cache->cache_fn, "wb+");
+			if (!tc) {
+				perror("fopen wb+");
+				return NULL;
+			}
+
+			tch->signature  = 'TMBC';
+			tch->version    = TC_VERSION;
+			tch->lastupdate = 0;
+			fwrite(tch, sizeof(TCHEADER), 1, tc);
+			
+			tc = freopen(cache->cache_fn, "rb+", tc);
+			if (!tc) {
+				perror("freopen rb+");
+				return NULL;
+			}
+		} else {
+			perror("fopen rb+");
+			return NULL;
+		}
+	}
+
+	if (fread(tch, sizeof(TCHEADER), 1, tc) != 1 || tch->signature != 'TMBC') {
+		fprintf(stderr, "ERROR: thumbcache signature does not match\n");
+		fclose(tc);
+		return NULL;
+	}
+	if (tch->version != TC_VERSION) {
+		fprintf(stderr, "WARNING: thumbcache format is out of date, rebuilding\n");
+		fclose(tc);
+		ThumbCacheFlush(cache);
+		return _ThumbCacheOpenData(cache, tch);
+	}
+
+	if (!cache->dirs) {
+		switch (_ThumbCacheDirsOpen(cache)) {
+			case -1:
+				fclose(tc);
+				ThumbCacheFlush(cache);
+				return _ThumbCacheOpenData(cache, tch);
+			case 0:
+				fclose(tc);
+				return NULL;
+		}
+	}
+
+	return tc;
+}
+
+
+void _ThumbCacheUpdateVisit(void *arg, const char *relfn, time_t mtime) {
+	LPTHUMBUPDATE update = arg;
+
+	_ThumbCacheUpdateFile(update->cache, update->tc, relfn, mtime);
+}
+
+
+//adds relfn to the cache, or refreshes its entry if the file changed since
+void _ThumbCacheUpdateFile(LPTHUMBCACHE cache, FILE *tc, const char *relfn, time_t mtime) {
+	unsigned int offset;
+	LPTCENTRY ptcent;
+	IMGINFO info;
+
+	ptcent = _ThumbCacheNamesFind(cache, tc, relfn, &offset);
+	if (ptcent && mtime == ptcent->mtime)
+		return;
+
+	if (!ImgProbe(relfn, &info)) {
+		if (verbose)
+			printf("Skipping %s, not a recognized image\n", relfn);
+		return;
+	}
+
+	if (ptcent) {
+		if (verbose)
+			printf("Updating %s...\n", relfn);
+		if (!ThumbCacheReplace(cache, tc, relfn, ptcent, offset, mtime, &info))
+			printerr("ThumbCacheReplace");
+	} else {
+		if (verbose)
+			printf("Adding %s to thumb cache...\n", relfn);
+		if (!ThumbCacheAdd(cache, tc, relfn, mtime, &info))
+			printerr("ThumbCacheAdd");
+		else
+			cache->nadded++;
+	}
+}
+
+
+/*
+ * Calls proc for every image file under dir, a relative path ending in a separator
+ * or "" for the working directory, descending into subdirectories if scan_recursive.
+ */
+void ThumbScanDir(const char *dir, LPTHUMBSCANPROC proc, void *arg) {
+	unsigned int status;
+	char *fn, relfn[MAX_PATH];
+	int dirlen, len, nfound;
+	time_t mtime;
+#ifdef _WIN32
+	HANDLE hFindFile;
+	WIN32_FIND_DATA ffd;
+#else
+	DIR *dirp;
+	struct stat st;
+	struct dirent *entry;
+#endif
+	PROF_DECL(t);
+
+	dirlen = strlen(dir);
+	if (dirlen + 3 >= MAX_PATH) {
+		fprintf(stderr, "ERROR: filename too long\n");
+		return;
+	}
+
+	//the visits and subdirectories are timed on their own, only the listing counts here
+	PROF_BEGIN(t);
+	nfound = 0;
+
+	strcpy(relfn, dir);
+#ifdef _WIN32
+	strcpy(relfn + dirlen, "*");
+	hFindFile = FindFirstFile(relfn, &ffd);
+	if (hFindFile == INVALID_HANDLE_VALUE) {
+		status = GetLastError();
+		if (status != ERROR_FILE_NOT_FOUND)
+			printerr("FindFirstFile");
+		return;
+	}
+
+	do {
+		fn = ffd.cFileName;
+		if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && scan_recursive) {
+#else
+	dirp = opendir(dirlen ? relfn : ".");
+	if (!dirp) {
+		perror("opendir");
+		return;
+	}
+
+	while ((entry = readdir(dirp))) {
+		fn = entry->d_name;
+		if (dirlen + strlen(fn) >= MAX_PATH) {
+			fprintf(stderr, "ERROR: total rel path len of "
+				"%s too long, skipping\n", fn);
+			continue;
+		}
+
+		strcpy(relfn + dirlen, fn);
+		if (lstat(relfn, &st) == -1) {
+			fprintf(stderr, "ERROR: couldn't stat %s, skipping\n", relfn);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode) && scan_recursive) {
+#endif
+			if (!(fn[0] == '.' && (!fn[1] || (fn[1] == '.' && !fn[2])))) {
+				len = dirlen + strlen(fn);
+				if (len + 1 >= MAX_PATH) {
+					fprintf(stderr, "ERROR: total rel path len of "
+						"%s too long, skipping\n", fn);
+					continue;
+				}
+
+				strcpy(relfn + dirlen, fn);
+				relfn[len]     = PATH_SEPARATOR;
+				relfn[len + 1] = '\0';
+
+				PROF_PAUSE(t);
+				ThumbScanDir(relfn, proc, arg);
+				PROF_RESUME(t);
+			}
+		} else if (ImgIsImageFile(fn)) {
+			len = dirlen + strlen(fn);
+			if (len >= MAX_PATH) {
+				fprintf(stderr, "ERROR: total rel path len of "
+					"%s too long, skipping\n", fn);
+				continue;
+			}
+
+#ifdef _WIN32
+			mtime = FileTimeToUnixTime(ffd.ftLastWriteTime);
+#else
+			mtime = st.st_mtime;
+#endif
+			strcpy(relfn + dirlen, fn);
+			nfound++;
+
+			PROF_PAUSE(t);
+			proc(arg, relfn, mtime);
+			PROF_RESUME(t);
+		}
+#ifdef _WIN32
+	} while (FindNextFile(hFindFile, &ffd));
+	
+	FindClose(hFindFile);
+#else
+	}
+
+	if (closedir(dirp) == -1)
+		perror("closedir");
+#endif
+
+	PROF_END(t, STAT_DIR_SCAN, nfound);
+}
+
+
+float _ThumbCalcKey(int **tpixels) {
+	unsigned int tr, tg, tb;
+	float avg_r, avg_g, avg_b;
+	int pixel, x, y;
+
+	tr = 0;
+	tg = 0;
+	tb = 0;
+
+	for (y = 0; y != THUMB_CY; y++) {
+		for (x = 0; x != THUMB_CX; x++) {
+			pixel = tpixels[y][x];
+			tr += gdTrueColorGetRed(pixel);
+			tg += gdTrueColorGetGreen(pixel);
+			tb += gdTrueColorGetBlue(pixel);
+
+		}
+	}
+
+	avg_r = (float)tr / (float)THUMB_NPIXELS;
+	avg_g = (float)tg / (float)THUMB_NPIXELS;
+	avg_b = (float)tb / (float)THUMB_NPIXELS;
+
+	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
+}
+
+
+#ifdef _WIN32
+
+float _ThumbCalcKeyAsm(int **tpixels) {
+	unsigned int tr, tg, tb;
+	float avg_r, avg_g, avg_b;
+
+	__asm {
+		push ebx
+		push esi
+		push edi
+		push ebp
+
+		xor eax, eax
+		xor esi, esi
+		xor edi, edi
+
+		mov ebp, tpixels
+
+		push THUMB_CY //temporary stack allocations
+		push ebp      //
+
+		loopy:
+			mov ebp, [esp]
+			mov ecx, [esp + 4]
+			mov ebp, [ebp + ecx * 4 - 4]
+
+			mov ecx, THUMB_CX
+			loopx:
+				mov edx,  [ebp + ecx * 4 - 4]
+				
+				movzx ebx, dl
+				add eax, ebx
+				movzx ebx, dh
+				add esi, ebx
+				shr edx, 16
+				movzx ebx, dl
+				add edi, ebx
+
+				dec ecx
+			jne loopx
+
+			dec dword ptr [esp + 4]
+		jne loopy
+
+		pop ebp
+		pop ebp
+		pop ebp
+
+		mov tb, edi
+		mov tg, esi
+		mov tr, eax
+		
+		pop edi
+		pop esi
+		pop ebx
+	}
+
+	avg_r = (float)tr / (float)THUMB_NPIXELS;
+	avg_g = (float)tg / (float)THUMB_NPIXELS;
+	avg_b = (float)tb / (float)THUMB_NPIXELS;
+
+	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
+}
+
+
+float _ThumbCalcKeySSE(int **tpixels) {
+	unsigned int tr, tg, tb;
+	float avg_r, avg_g, avg_b;
+
+	__asm {
+		//xmm0 - blue accum
+		//xmm1 - green accum
+		//xmm2 - red accum
+		//xmm3 - work reg
+		//xmm4 - pixels
+		//xmm5 - AND mask
+
+		pxor xmm0, xmm0
+		pxor xmm1, xmm1
+		pxor xmm2, xmm2
+
+		mov eax, 0xFF
+		movd xmm5, eax
+		pshufd xmm5, xmm5, 0
+
+		mov esi, tpixels
+		mov ecx, 0x4010
+		loopy:
+			mov edi, [esi]
+			//prefetchnta [edi + 128]
+			loopx:
+				movdqu xmm4, [edi]
+				
+				movdqa xmm3, xmm4
+				andps xmm3, xmm5
+				paddd xmm0, xmm3
+
+				movdqa xmm3, xmm4
+				psrld xmm3, 8
+				andps xmm3, xmm5
+				paddd xmm1, xmm3
+
+				movdqa xmm3, xmm4
+				psrld xmm3, 16
+				paddd xmm2, xmm3
+
+				add edi, 16
+				dec cl
+			jnz loopx
+			add esi, 4
+			mov cl, 16
+			dec ch
+		jnz loopy
+
+	}
+
+	avg_r = (float)tr / (float)THUMB_NPIXELS;
+	avg_g = (float)tg / (float)THUMB_NPIXELS;
+	avg_b = (float)tb / (float)THUMB_NPIXELS;
+
+	return (avg_r * avg_r) + (avg_g * avg_g) + (avg_b * avg_b);
+}
+
+#endif
+
@@ -1,106 +1,251 @@
-/*-
- * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without modification, are
- * permitted provided that the following conditions are met:
- *  1. Redistributions of source code must retain the above copyright notice, this list of
- *     conditions and the following disclaimer.
- *  2. Redistributions in binary form must reproduce the above copyright notice, this list
- *     of conditions and the following disclaimer in the documentation and/or other materials
- *     provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
- * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
- * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
- * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
- * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
- * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
- * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#ifndef THUMB_HEADER
-#define THUMB_HEADER
-
-#define THUMBCACHE_INITIAL_LEN sizeof(TCHEADER)
-#define TC_MTIME_DELETED 0
-
-#define TC_DUMP_NONE 0
-#define TC_DUMP_INFO 1
-#define TC_DUMP_IMGS 2
-
-// >10MB would be a little too big for a 64x64 PNG image...
-#define THUMB_MAX_SIZE (10 * 1024 * 1024)
-
-/*
- * Thumb Cache File Format:
- *
- * [UINT32] 'TMBC' signature
- * [time_t] timestamp of directory's recorded last update
- * For each entry:
- *     [time_t]  date image was last modified
- *     [UINT32]  thumbnail data size
- *     [FLOAT]   thumbnail color key
- *     [UINT8]   filename length
- *     [CHAR []] filename
- *     [void]    image thumbnail data
- */
-
-//#pragma pack(push, 1)
-
-typedef struct _tcheader {
-	uint32_t signature;
-	time_t lastupdate;
-} TCHEADER, *LPTCHEADER;
-
-typedef struct _tcentry {
-	time_t mtime;
-	unsigned char fnlen;
-	uint32_t thumbfsize;
-	float thumbkey;
-	char filename[0];
-} TCENTRY, *LPTCENTRY;
-
-//#pragma pack(pop)
-
-typedef struct _tcrecord {
-	unsigned int offset;
-	TCENTRY ent;
-} TCRECORD, *LPTCRECORD;
-
-extern char thumb_btree_fn[256];
-extern char thumb_cache_fn[256];
-extern int burstmode;
-
-
-int ThumbCacheBurstReadBegin(int reinit);
-int ThumbCacheBurstReadEnd();
-
-gdImagePtr ThumbCreate(const char *filename, unsigned int *filesize);
-
-void ThumbCacheEnumerate(int level);
-int ThumbCacheUpdate();
-int ThumbFindMatches(const char *filename, LPTCENTRY *dupents,
-					 unsigned int *dupoffs, unsigned int nmaxdups);
-
-int ThumbCacheAdd(FILE *tc, const char *filename, time_t mtime);
-int ThumbCacheReplace(FILE *tc, const char *filename, LPTCRECORD ptcrec, time_t mtime);
-int ThumbCacheRemove(unsigned int offset);
-int ThumbCacheGet(int nitems, unsigned int *offsets,
-				  LPTCENTRY *entries, gdImagePtr *thumbs);
-LPTCENTRY ThumbCacheLookup(unsigned int offset);
-int ThumbCacheFlush();
-
-float _ThumbCalcKey(int **tpixels);
-void _ThumbFlatten(int **tpixels, int mask);
-void _ThumbCacheBuildHt(FILE *tc);
-unsigned int _ThumbCacheWriteEntry(FILE *tc, LPTCENTRY ptcent,
-						  const char *filename, void *thumbdata);
-int _ThumbCacheUpdateStructures(const char *filename, LPTCENTRY ptcent,
-								unsigned int offset, int update);
-void _ThumbCacheUpdateDirScan(FILE *tc, const char *dir);
-
-#endif //THUMB_HEADER
-
+/*-
+ * Copyright (c) 2012 Ryan Kwolek <kwolekr2@cs.scranton.edu>. 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this list of
+ *     conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef THUMB_HEADER
+#define THUMB_HEADER
+
+/////////// Compile-time configuration ////////////
+#define THUMB_HASH_MASK 0x00F0F0F0 //bits of each thumb pixel kept for the pixel hash
+#define THUMB_APPEND_SIZE (1024 * 1024) //new entries are written out in blocks of about this size
+#define THUMB_LRU_SIZE 16 //MB of decoded thumbs each cache keeps in burst mode, 0 for none
+#define THUMB_MATCH_BATCH 64 //candidates decoded and compared at a time by ThumbQueryMatches
+#define THUMB_HIST_KEY_RANGE 16.f //furthest apart in mean color the histogram engines look
+#ifndef _WIN32
+#	define THUMB_USE_LIBPNG //decode cached thumbs with libpng straight into the caller's image
+#endif
+///////////////////////////////////////////////////
+
+#define THUMBCACHE_INITIAL_LEN sizeof(TCHEADER)
+#define TC_MTIME_DELETED 0
+
+#define TC_DUMP_NONE 0
+#define TC_DUMP_INFO 1
+#define TC_DUMP_IMGS 2
+
+//what one decoded thumb costs the LRU, for sizing it in MB
+#define THUMB_LRU_ITEM_SIZE (THUMB_NPIXELS * sizeof(int) + sizeof(LRUNODE))
+
+// >10MB would be a little too big for a 64x64 PNG image...
+#define THUMB_MAX_SIZE (10 * 1024 * 1024)
+
+//room for any entry header and its file name, a multiple of sizeof(time_t)
+#define THUMB_ENTRY_SLOT (sizeof(TCENTRY) + UCHAR_MAX + 1)
+
+/*
+ * Thumb Cache File Format:
+ *
+ * [UINT32] 'TMBC' signature
+ * [UINT32] format version
+ * [time_t] timestamp of directory's recorded last update
+ * For each entry:
+ *     [time_t]  date image was last modified
+ *     [UINT32]  thumbnail data size
+ *     [FLOAT]   thumbnail color key
+ *     [UINT32]  image width, or 0 if unknown
+ *     [UINT32]  image height, or 0 if unknown
+ *     [UINT32]  image file size
+ *     [UINT32[4]] 128 bit hash of the image file's contents
+ *     [UINT32[4]] 128 bit hash of the thumbnail pixels, masked by THUMB_HASH_MASK
+ *     [UINT16[64]]  RGB histogram of the thumbnail
+ *     [UINT16[128]] HSV histogram of the thumbnail
+ *     [UINT32]  id of the file's directory in the cache's directory table
+ *     [UINT8]   file name length, not counting the directory
+ *     [UINT8]   image format, one of IMG_FMT_*
+ *     [UINT8[6]] reserved, pads the entry header to a multiple of sizeof(time_t)
+ *     [CHAR []] file name, without the directory
+ *     [void]    image thumbnail data
+ */
+
+#define TC_VERSION 8
+
+//#pragma pack(push, 1)
+
+typedef struct _tcheader {
+	uint32_t signature;
+	uint32_t version;
+	time_t lastupdate;
+} TCHEADER, *LPTCHEADER;
+
+//filename must land exactly at sizeof(TCENTRY) so entries can be used in place
+typedef struct _tcentry {
+	time_t mtime;
+	uint32_t thumbfsize;
+	float thumbkey;
+	uint32_t width;
+	uint32_t height;
+	uint32_t filesize;
+	uint32_t contenthash[IMG_HASH_LEN];
+	uint32_t pixelhash[IMG_HASH_LEN];
+	HISTBIN histrgb[HIST_RGB_BINS];
+	HISTBIN histhsv[HIST_HSV_BINS];
+	uint32_t dirid;
+	unsigned char fnlen;
+	unsigned char format;
+	unsigned char reserved[6];
+	char filename[0];
+} TCENTRY, *LPTCENTRY;
+
+//#pragma pack(pop)
+
+//scratch space of ThumbQueryMatches, grown as needed and kept between queries
+typedef struct _matchctx {
+	KVPAIR *matches;
+	unsigned int matchlen;
+	unsigned int *offsets;
+	unsigned int *live;
+	unsigned int *kept;
+	float *aspects;
+	LPTCENTRY *entries;
+	unsigned int len;    //entries the arrays from offsets on have room for
+	unsigned char *entbuf;  //entry headers and names read when not in burst mode, by slot
+	unsigned int entslots;
+	unsigned char *readbuf; //thumbs read from the cache file when not in burst mode
+	unsigned int readlen;
+	gdImagePtr pool[THUMB_MATCH_BATCH]; //THUMB_CX x THUMB_CY images thumbs are decoded into
+	gdImagePtr thumbs[THUMB_MATCH_BATCH];
+} MATCHCTX, *LPMATCHCTX;
+
+//one directory's set of cache files; callers must include mmfile.h, bptree.h, hashdb.h
+//and pathdict.h
+typedef struct _thumbcache {
+	char btree_fn[256];
+	char cache_fn[256];
+	char names_fn[256];
+	char hashes_fn[256];
+	char pixels_fn[256];
+	char dirs_fn[256];
+	LPBPTREE bpt;
+	LPHASHDB names;
+	LPHASHDB hashes;
+	LPHASHDB pixels;
+	LPPATHDICT dirs;
+	FMAPINFO cachemap;
+	FMAPINFO namemap;
+	unsigned char *appendbuf;
+	unsigned int appendsize;
+	unsigned int appendlen;
+	unsigned int appendpos;
+	LPLRU decoded; //pixels of thumbs already decoded, by offset, while in burst mode
+	MATCHCTX match;
+	int burstmode;
+	int readonly; //only searched, so no index is created or rebuilt; see _ThumbCacheNamesOpen
+	int nadded;
+} THUMBCACHE, *LPTHUMBCACHE;
+
+//an image being searched for, decoded at most once however many caches it is matched against
+typedef struct _thumbquery {
+	const char *filename;
+	IMGINFO info;
+	gdImagePtr img;
+	float key;
+	int hashed;
+	uint32_t contenthash[IMG_HASH_LEN];
+	uint32_t pixelhash[IMG_HASH_LEN];
+	HISTBIN hist[HIST_HSV_BINS];
+	LPTHUMBCACHE selfcache; //holds a current entry of the file, if set
+	unsigned int selfoffset;
+} THUMBQUERY, *LPTHUMBQUERY;
+
+typedef struct _thumbupdate {
+	LPTHUMBCACHE cache;
+	FILE *tc;
+} THUMBUPDATE, *LPTHUMBUPDATE;
+
+typedef void (*LPTHUMBSCANPROC)(void *arg, const char *relfn, time_t mtime);
+
+extern char thumb_btree_fn[256];
+extern char thumb_cache_fn[256];
+extern char thumb_names_fn[256];
+extern char thumb_hashes_fn[256];
+extern char thumb_pixels_fn[256];
+extern char thumb_dirs_fn[256];
+extern int thumb_lru_size;
+
+
+int ThumbCacheInit(LPTHUMBCACHE cache, const char *dir);
+void ThumbCacheClose(LPTHUMBCACHE cache);
+int ThumbCacheBurstReadBegin(LPTHUMBCACHE cache, int reinit);
+int ThumbCacheBurstReadEnd(LPTHUMBCACHE cache);
+
+gdImagePtr ThumbCreate(const char *filename, unsigned int *filesize, uint32_t *contenthash);
+
+void ThumbCacheEnumerate(LPTHUMBCACHE cache, int level);
+int ThumbCacheUpdate(LPTHUMBCACHE cache);
+void ThumbScanDir(const char *dir, LPTHUMBSCANPROC proc, void *arg);
+int ThumbFindMatches(LPTHUMBCACHE cache, const char *filename, LPTCENTRY *dupents,
+					 unsigned int *dupoffs, unsigned int nmaxdups);
+
+int ThumbQueryInit(LPTHUMBQUERY query, const char *filename);
+unsigned int ThumbQueryFindSelf(LPTHUMBCACHE cache, LPTHUMBQUERY query);
+int ThumbQueryDecode(LPTHUMBQUERY query);
+void ThumbQueryFree(LPTHUMBQUERY query);
+int ThumbQueryMatches(LPTHUMBCACHE cache, LPTHUMBQUERY query, unsigned int selfoffset,
+					  LPTCENTRY *dupents, unsigned int *dupoffs, unsigned int nmaxdups);
+
+int ThumbCacheAdd(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+				  time_t mtime, LPIMGINFO info);
+int ThumbCacheReplace(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+					  LPTCENTRY ptcent, unsigned int offset, time_t mtime, LPIMGINFO info);
+int ThumbCacheRemove(LPTHUMBCACHE cache, unsigned int offset);
+int ThumbCacheGet(LPTHUMBCACHE cache, int nitems, unsigned int *offsets,
+				  LPTCENTRY *entries, gdImagePtr *thumbs);
+LPTCENTRY ThumbCacheLookup(LPTHUMBCACHE cache, unsigned int offset);
+int ThumbCacheEntryPath(LPTHUMBCACHE cache, LPTCENTRY ptcent, char *path, size_t len);
+int ThumbCacheFlush(LPTHUMBCACHE cache);
+int ThumbCacheCommit(LPTHUMBCACHE cache, FILE *tc);
+
+int _ThumbCachePath(char *path, size_t len, const char *dir, const char *filename);
+float _ThumbCalcKey(int **tpixels);
+void _ThumbFlatten(int **tpixels, int mask);
+void _ThumbCalcPixelHash(int **tpixels, uint32_t *pixelhash);
+void _ThumbSetInfo(LPTCENTRY ptcent, LPIMGINFO info);
+int _ThumbFindIdentical(LPTHUMBCACHE cache, LPHASHDB hdb, const uint32_t *hash,
+						unsigned int hashoff, unsigned int selfoffset, unsigned int filesize,
+						unsigned int cx, unsigned int cy, LPTCENTRY *dupents,
+						unsigned int *dupoffs, unsigned int ndups, unsigned int nmaxdups);
+int _ThumbMatchFound(const unsigned int *dupoffs, unsigned int ndups, unsigned int offset);
+int _ThumbCacheDirsOpen(LPTHUMBCACHE cache);
+int _ThumbCacheNamesOpen(LPTHUMBCACHE cache);
+int _ThumbCacheNamesMap(LPTHUMBCACHE cache);
+LPTCENTRY _ThumbCacheNamesFind(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+							   unsigned int *offset);
+unsigned int _ThumbCacheWriteEntry(LPTHUMBCACHE cache, FILE *tc, LPTCENTRY ptcent,
+								   const char *filename, void *thumbdata, unsigned int slotlen);
+void *_ThumbCacheAppendReserve(LPTHUMBCACHE cache, FILE *tc, unsigned int len,
+							   unsigned int *offset);
+int _ThumbCacheAppendFlush(LPTHUMBCACHE cache, FILE *tc);
+void _ThumbCacheAppendDrop(LPTHUMBCACHE cache);
+gdImagePtr _ThumbCacheDecode(LPTHUMBCACHE cache, unsigned int offset, LPTCENTRY ptcent,
+							 gdImagePtr thumb);
+gdImagePtr _ThumbDecodePng(unsigned int size, void *data, gdImagePtr thumb);
+int _ThumbMatchCtxReserve(LPMATCHCTX ctx, unsigned int nitems);
+void _ThumbMatchCtxFree(LPMATCHCTX ctx);
+int _ThumbQueryDecodeSelf(LPTHUMBQUERY query);
+int _ThumbCacheUpdateStructures(LPTHUMBCACHE cache, FILE *tc, const char *filename,
+								LPTCENTRY ptcent, unsigned int offset, unsigned int oldoffset);
+FILE *_ThumbCacheOpenData(LPTHUMBCACHE cache, LPTCHEADER tch);
+void _ThumbCacheUpdateVisit(void *arg, const char *relfn, time_t mtime);
+void _ThumbCacheUpdateFile(LPTHUMBCACHE cache, FILE *tc, const char *relfn, time_t mtime);
+
+#endif //THUMB_HEADER
+